@@ -70,6 +70,31 @@ typedef struct ifc_print_job_st {
      */
     void (*enable_timeout)(const struct ifc_print_job_st *this_p,
             int enable);
+
+    /*
+     * Interrupts any send in progress and makes further sends fail, so a cancelled job stops
+     * without waiting out a network timeout. Returns true if the job's data was cut short, or
+     * false if all of it had already been sent, in which case nothing is interrupted. May be
+     * called from any thread. May be NULL.
+     */
+    bool (*abort)(const struct ifc_print_job_st *this_p);
+
+    /*
+     * Returns the printer's id for the job being sent, or -1 while it is not known yet.
+     * May be NULL.
+     */
+    int (*get_job_id)(const struct ifc_print_job_st *this_p);
+
+    /*
+     * Sends out any data still held back by send_data. May be NULL.
+     */
+    status_t (*flush)(const struct ifc_print_job_st *this_p);
+
+    /*
+     * Sends the rest of an open file after any data already sent, returning the amount of data
+     * written or -1 for an error. May be NULL, in which case the file goes through send_data.
+     */
+    int (*send_file)(const struct ifc_print_job_st *this_p, int fd);
 } ifc_print_job_t;
 
 /*
@@ -78,7 +103,7 @@ typedef struct ifc_print_job_st {
 const ifc_print_job_t *printer_connect(int port_num);
 
 /*
- * Opens a socket to printer:port and returns it.
+ * Opens a non-blocking socket to printer:port and returns it.
  */
 int wConnect(const char *printer_addr, int port_num, long int timeout_msec);
 
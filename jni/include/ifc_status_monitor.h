@@ -56,6 +56,11 @@ typedef struct ifc_status_monitor_st {
      */
     void (*stop)(const struct ifc_status_monitor_st *this_p);
 
+    /*
+     * Tells a started monitor the printer's id for the job to follow. May be NULL.
+     */
+    void (*set_job_id)(const struct ifc_status_monitor_st *this_p, int job_id);
+
     /*
      * Destroy printer status monitor
      */
@@ -58,13 +58,16 @@ typedef struct {
     status_t (*msgQDelete)(msg_q_id msgQ);
 
     /**
-     * Sends a message to a message queue. Returns OK or ERROR.
+     * Sends a message to a message queue. timeout may be WAIT_FOREVER, NO_WAIT or a number of
+     * milliseconds to wait for room. priority may be MSG_Q_FIFO, or MSG_Q_URGENT to have the
+     * message received ahead of queued ones. Returns OK or ERROR.
      */
     status_t (*msgQSend)(msg_q_id msgQ, const char *buffer, unsigned long nbytes, int timeout,
             int priority);
 
     /**
-     * Collects a message, returning 0 if successful. timeout may be WAIT_FOREVER or NO_WAIT.
+     * Collects a message, returning 0 if successful. timeout may be WAIT_FOREVER, NO_WAIT or a
+     * number of milliseconds.
      */
     status_t (*msgQReceive)(msg_q_id msgQ, char *buffer, unsigned long max_nbytes, int timeout);
 
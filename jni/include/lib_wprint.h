@@ -45,6 +45,12 @@
 
 #define STRIPE_HEIGHT           (16)
 #define BUFFERED_ROWS           (STRIPE_HEIGHT * 8)
+#define MAX_SEND_BUFFS          (32)
+
+// Per-job decode memory budget in bytes, auto-sized from device RAM when not specified
+#define MIN_MEMORY_BUDGET       (1 * 1024 * 1024)
+#define DEFAULT_MEMORY_BUDGET   (4 * 1024 * 1024)
+#define MAX_MEMORY_BUDGET       (64 * 1024 * 1024)
 
 #define MAX_MIME_LENGTH         (64)
 #define MAX_PRINTER_ADDR_LENGTH (64)
@@ -123,6 +129,14 @@ typedef enum {
 
 typedef void (*wprint_status_cb_t)(wJob_t job_id, void *parm);
 
+/*
+ * How spooled jobs of equal priority are ordered. The values match BackendConstants.SCHED_*.
+ */
+typedef enum {
+    WPRINT_SCHED_FIFO, // in the order they were started
+    WPRINT_SCHED_SHORTEST_FIRST, // smallest estimated job (pages x copies x resolution) first
+} wprint_sched_policy_t;
+
 /*
  * Parameters describing a job request
  */
@@ -159,7 +173,25 @@ typedef struct {
     unsigned int printable_area_height;
     unsigned int strip_height;
 
+    // memory budget in bytes for decoding, 0 to size it from device RAM
+    unsigned int memory_budget;
+    // most strip buffers in flight between decode and send, derived from memory_budget. The
+    // plugin tunes the depth it actually uses, and the PWG strip height, page by page.
+    unsigned int send_buffers;
+    // peak memory in bytes used to decode and queue a page of this job
+    unsigned int peak_memory_used;
+
+    // scheduling priority among spooled jobs, higher runs first
+    int priority;
+    // milliseconds the job waited in the spool before it started running
+    unsigned int queue_wait_msec;
+
     bool cancelled;
+    // set along with cancelled once the transport has been interrupted; nothing more reaches
+    // the printer, so plugins may stop without finishing the page
+    bool aborted;
+    // milliseconds from the cancel request until the job stopped
+    unsigned int cancel_latency_msec;
     bool last_page;
     int page_num;
     int copy_num;
@@ -371,6 +403,18 @@ status_t wprintCancelJob(wJob_t job_handle);
  */
 status_t wprintExit(void);
 
+/*
+ * Selects how spooled jobs of equal priority are ordered. Waiting jobs gain priority as they
+ * age, so no job is starved by a stream of higher priority or smaller jobs.
+ */
+void wprintSetSchedulingPolicy(wprint_sched_policy_t policy);
+
+/*
+ * Reports how long a job waited in the spool before it started running, in milliseconds.
+ * Returns OK, or ERROR if the job is unknown.
+ */
+status_t wprintGetJobQueueWait(wJob_t job_handle, unsigned int *queue_wait_msec);
+
 /*
  * Supplies info about the sending application and OS name
  */
@@ -98,6 +98,13 @@ typedef struct {
     int print_scalings_supported_count;
     char print_scaling_default[MAX_PRINT_SCALING_LENGTH]; /* Printer default value */
     unsigned char jobPagesPerSetSupported;
+
+    // Create-Job and Send-Document are both in operations-supported
+    unsigned char createJobSupported;
+
+    // Document data may be sent gzip or deflate compressed (compression-supported)
+    unsigned char compressionGzip;
+    unsigned char compressionDeflate;
 } printer_capabilities_t;
 
 #endif // __PRINTER_CAPABILITIES_TYPES_H__
\ No newline at end of file
@@ -20,10 +20,18 @@
 
 #include "wtypes.h"
 
+/*
+ * Timeouts are NO_WAIT, WAIT_FOREVER or a positive number of milliseconds
+ */
 #define WAIT_FOREVER -1
 #define NO_WAIT 0
 
+/*
+ * Send priorities. MSG_Q_URGENT messages are received ahead of anything already queued and may
+ * use a small reserve of slots beyond max_msgs, so they are accepted even by a full queue.
+ */
 #define MSG_Q_FIFO 0
+#define MSG_Q_URGENT 1
 
 typedef void *msg_q_id;
 
@@ -37,9 +45,17 @@ msg_q_id msgQCreate(int max_msgs, int max_msg_length);
 
 status_t msgQDelete(msg_q_id msgQ);
 
+/*
+ * Sends a message, blocking up to timeout while the queue is full. Returns OK, or ERROR with
+ * errno set to ETIMEDOUT if no room became available in time.
+ */
 status_t msgQSend(msg_q_id msgQ, const char *buffer, unsigned long nbytes, int timeout,
         int priority);
 
+/*
+ * Receives the next message, blocking up to timeout while the queue is empty. Returns OK, or
+ * ERROR with errno set to ETIMEDOUT if nothing arrived in time.
+ */
 status_t msgQReceive(msg_q_id msgQ, char *buffer, unsigned long max_nbytes, int timeout);
 
 int msgQNumMsgs(msg_q_id msgQ);
@@ -0,0 +1,78 @@
+/*
+ * Copyright (C) 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef __WPRINT_SEND_QUEUE_H__
+#define __WPRINT_SEND_QUEUE_H__
+
+#include <stddef.h>
+#include "wtypes.h"
+
+/*
+ * Bounded queue of output segments written out by a sender thread of its own, so the job can
+ * go on encoding while earlier data is still on the wire. Data is copied into fixed size
+ * segments; a full segment is queued for the sender and the writer only blocks when every
+ * segment is queued. One thread writes into the queue; any thread may abort it.
+ */
+typedef struct send_queue_st send_queue_t;
+
+/*
+ * Writes one segment to its destination. Returns OK, or ERROR after which the rest of the
+ * queued data is dropped.
+ */
+typedef status_t (*send_queue_write_t)(void *param, const char *buffer, size_t length);
+
+/*
+ * Creates a queue of depth segments of segment_size bytes and starts its sender thread, which
+ * passes each segment to write_fn. Returns NULL on failure.
+ */
+send_queue_t *send_queue_create(unsigned int depth, size_t segment_size,
+        send_queue_write_t write_fn, void *param);
+
+/*
+ * Stops the sender thread, dropping anything still queued, and frees the queue
+ */
+void send_queue_destroy(send_queue_t *queue);
+
+/*
+ * Copies data into the queue, blocking while all segments are taken. Returns ERROR once a
+ * write has failed or the queue was aborted.
+ */
+status_t send_queue_write(send_queue_t *queue, const char *buffer, size_t length);
+
+/*
+ * Queues the partly filled segment, if any, without waiting for it to be written. Stores the
+ * number of segments queued since the last flush in segments, if not NULL. Returns ERROR once a
+ * write has failed or the queue was aborted.
+ */
+status_t send_queue_flush(send_queue_t *queue, unsigned int *segments);
+
+/*
+ * Queues the partly filled segment and waits until everything is written. Logs the queue's
+ * occupancy and wait times since the last drain. Returns ERROR if any write failed.
+ */
+status_t send_queue_drain(send_queue_t *queue);
+
+/*
+ * Clears a write failure so a drained queue can carry the next request
+ */
+void send_queue_reset(send_queue_t *queue);
+
+/*
+ * Drops queued data and fails all further writes. A write in progress is not interrupted;
+ * the caller has to unblock it, for instance by shutting the socket down.
+ */
+void send_queue_abort(send_queue_t *queue);
+
+#endif // __WPRINT_SEND_QUEUE_H__
@@ -18,13 +18,38 @@
 
 #include "ipp_print.h"
 #include <math.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <zlib.h>
 #include "ipphelper.h"
 #include "wprint_debug.h"
+#include "wprint_send_queue.h"
 
 #include "plugins/media.h"
 
 #define TAG "ipp_print"
 
+// Document data gathered into one HTTP chunk before it is written out
+#ifndef IPP_SEND_BUFFER_SIZE
+#define IPP_SEND_BUFFER_SIZE (128 * 1024)
+#endif
+
+// Chunks that may wait for the sender thread while the job encodes the next one
+#ifndef IPP_SEND_QUEUE_DEPTH
+#define IPP_SEND_QUEUE_DEPTH 3
+#endif
+
+// zlib level used while compression pays off, and how many uncompressed chunks go by before
+// compression is tried again
+#ifndef IPP_COMPRESSION_LEVEL
+#define IPP_COMPRESSION_LEVEL Z_BEST_SPEED
+#endif
+
+#ifndef IPP_COMPRESSION_PROBE
+#define IPP_COMPRESSION_PROBE 16
+#endif
+
 static status_t _init(const ifc_print_job_t *this_p, const char *printer_address, int port,
         const char *printer_uri, bool use_secure_uri);
 
@@ -40,11 +65,25 @@ static status_t _end_job(const ifc_print_job_t *this_p);
 
 static void _destroy(const ifc_print_job_t *this_p);
 
+static bool _abort(const ifc_print_job_t *this_p);
+
+static int _get_job_id(const ifc_print_job_t *this_p);
+
+static status_t _flush(const ifc_print_job_t *this_p);
+
 static const ifc_print_job_t _print_job_ifc = {
         .init = _init, .validate_job = _validate_job, .start_job = _start_job,
         .send_data = _send_data, .end_job = _end_job, .destroy = _destroy, .enable_timeout = NULL,
+        .abort = _abort, .get_job_id = _get_job_id, .flush = _flush,
 };
 
+// Progress of the document data, see _abort()
+typedef enum {
+    SEND_OPEN, // still going out
+    SEND_DONE, // all of it written
+    SEND_ABORTED, // cut short by _abort()
+} send_state_t;
+
 /*
  * Struct for handling an ipp print job
  */
@@ -52,11 +91,37 @@ typedef struct {
     http_t *http;
     char printer_uri[1024];
     char http_resource[1024];
-    http_status_t status;
+    volatile http_status_t status;
     ifc_print_job_t ifc;
     const char *useragent;
+    atomic_int send_state;
+
+    // Operation carrying the document data, and the printer's job id once known
+    ipp_op_t op;
+    volatile int job_id;
+    char document_format[64];
+
+    // Chunks on their way to the printer, and counts of sends against chunks actually written.
+    // While the send queue is active, status and send_chunks belong to its sender thread and
+    // are only read here once the queue is drained.
+    send_queue_t *send_queue;
+    unsigned int send_calls, send_chunks;
+    unsigned int flushed_calls, flushed_chunks;
+
+    // Compression keyword sent with the document (NULL when sent as is), and the stream that
+    // the send queue's thread runs the data through
+    const char *compression;
+    z_stream zstream;
+    char *compress_buffer;
+    int compress_level;
+    unsigned int compress_segments, stored_segments;
+    unsigned long long compress_in, compress_out;
 } ipp_print_job_t;
 
+static bool _aborted(ipp_print_job_t *ipp_job) {
+    return (atomic_load(&ipp_job->send_state) == SEND_ABORTED);
+}
+
 /*
  * Returns a print job handle for an ipp print job
  */
@@ -69,7 +134,9 @@ const ifc_print_job_t *ipp_get_print_ifc(const ifc_wprint_t *wprint_ifc) {
     }
 
     memset(ipp_job, 0, sizeof(ipp_print_job_t));
+    atomic_init(&ipp_job->send_state, SEND_OPEN);
     ipp_job->status = HTTP_CONTINUE;
+    ipp_job->job_id = -1;
 
     memcpy(&ipp_job->ifc, &_print_job_ifc, sizeof(ifc_print_job_t));
 
@@ -88,7 +155,7 @@ static status_t _init(const ifc_print_job_t *this_p, const char *printer_address
 
     ipp_job = IMPL(ipp_print_job_t, ifc, this_p);
     if (ipp_job->http != NULL) {
-        httpClose(ipp_job->http);
+        ipp_http_release(ipp_job->http);
     }
 
     if ((printer_uri == NULL) || (strlen(printer_uri) == 0)) {
@@ -102,19 +169,7 @@ static status_t _init(const ifc_print_job_t *this_p, const char *printer_address
     httpAssembleURIf(HTTP_URI_CODING_ALL, ipp_job->printer_uri, sizeof(ipp_job->printer_uri),
             ipp_scheme, NULL, printer_address, ippPortNumber, "%s", printer_uri);
     getResourceFromURI(ipp_job->printer_uri, ipp_job->http_resource, 1024);
-    if (use_secure_uri) {
-        ipp_job->http = httpConnect2(printer_address, ippPortNumber, NULL, AF_UNSPEC,
-                HTTP_ENCRYPTION_ALWAYS, 1, HTTP_TIMEOUT_MILLIS, NULL);
-
-        // If ALWAYS doesn't work, fall back to REQUIRED
-        if (ipp_job->http == NULL) {
-            ipp_job->http = httpConnect2(printer_address, ippPortNumber, NULL, AF_UNSPEC,
-                    HTTP_ENCRYPTION_REQUIRED, 1, HTTP_TIMEOUT_MILLIS, NULL);
-        }
-    } else {
-        ipp_job->http = httpConnect2(printer_address, ippPortNumber, NULL, AF_UNSPEC,
-                HTTP_ENCRYPTION_IF_REQUESTED, 1, HTTP_TIMEOUT_MILLIS, NULL);
-    }
+    ipp_job->http = ipp_http_acquire(printer_address, ippPortNumber, use_secure_uri);
 
     httpSetTimeout(ipp_job->http, DEFAULT_IPP_TIMEOUT, NULL, 0);
 
@@ -130,9 +185,14 @@ static void _destroy(const ifc_print_job_t *this_p) {
 
     ipp_job = IMPL(ipp_print_job_t, ifc, this_p);
     if (ipp_job->http != NULL) {
-        httpClose(ipp_job->http);
+        ipp_http_release(ipp_job->http);
     }
 
+    send_queue_destroy(ipp_job->send_queue);
+    if (ipp_job->compression != NULL) {
+        deflateEnd(&ipp_job->zstream);
+    }
+    free(ipp_job->compress_buffer);
     free(ipp_job);
 }
 
@@ -173,7 +233,7 @@ static void _get_pwg_media_size(media_size_t media_size, float *mediaWidth, floa
  * Fills and returns an ipp request object with the given job parameters
  */
 static ipp_t *_fill_job(int ipp_op, char *printer_uri, const wprint_job_params_t *job_params,
-        const printer_capabilities_t *printer_caps) {
+        const printer_capabilities_t *printer_caps, const char *compression) {
     LOGD("_fill_job: Enter");
     ipp_t *request = NULL; // IPP request object
     ipp_attribute_t *attrptr; // Attribute pointer
@@ -200,6 +260,10 @@ static ipp_t *_fill_job(int ipp_op, char *printer_uri, const wprint_job_params_t
     ippAddString(request, IPP_TAG_OPERATION, IPP_TAG_NAME, "requesting-user-name", NULL,
             job_params->job_originating_user_name);
     ippAddString(request, IPP_TAG_OPERATION, IPP_TAG_NAME, "job-name", NULL, job_params->job_name);
+    if (compression != NULL) {
+        ippAddString(request, IPP_TAG_OPERATION, IPP_TAG_KEYWORD, "compression", NULL,
+                compression);
+    }
 
     // Fields for Document source application and source OS
     bool is_doc_format_details_supported = (
@@ -462,7 +526,8 @@ static status_t _validate_job(const ifc_print_job_t *this_p, wprint_job_params_t
             ipp_job->useragent = job_params->useragent;
         }
 
-        request = _fill_job(IPP_VALIDATE_JOB, ipp_job->printer_uri, job_params, printer_caps);
+        request = _fill_job(IPP_VALIDATE_JOB, ipp_job->printer_uri, job_params, printer_caps,
+                NULL);
 
         if (ipp_job->useragent != NULL) {
             httpSetDefaultField(ipp_job->http, HTTP_FIELD_USER_AGENT, ipp_job->useragent);
@@ -502,6 +567,287 @@ static status_t _validate_job(const ifc_print_job_t *this_p, wprint_job_params_t
     return result;
 }
 
+/*
+ * Creates the job with Create-Job so its id is known before any document data is sent. Returns
+ * the job id, or -1 if the job could not be created and Print-Job should be used instead.
+ */
+static int _create_job(ipp_print_job_t *ipp_job, const wprint_job_params_t *job_params,
+        const printer_capabilities_t *printer_caps) {
+    int job_id = -1;
+    ipp_t *request, *response;
+    ipp_attribute_t *attrptr;
+    ipp_status_t ipp_status;
+
+    request = _fill_job(IPP_CREATE_JOB, ipp_job->printer_uri, job_params, printer_caps, NULL);
+    if (request == NULL) {
+        return job_id;
+    }
+
+    // Send-Document repeats the format chosen for the job
+    if ((attrptr = ippFindAttribute(request, "document-format", IPP_TAG_MIMETYPE)) != NULL) {
+        strlcpy(ipp_job->document_format, ippGetString(attrptr, 0, NULL),
+                sizeof(ipp_job->document_format));
+    } else {
+        strlcpy(ipp_job->document_format, PRINT_FORMAT_AUTO, sizeof(ipp_job->document_format));
+    }
+
+    response = ipp_doCupsRequest(ipp_job->http, request, ipp_job->http_resource,
+            ipp_job->printer_uri);
+    ipp_status = cupsLastError();
+    if ((response != NULL) && (ipp_status < IPP_BAD_REQUEST) &&
+            ((attrptr = ippFindAttribute(response, "job-id", IPP_TAG_INTEGER)) != NULL)) {
+        job_id = ippGetInteger(attrptr, 0);
+    }
+    LOGI("_create_job: ipp_status %d job_id %d", ipp_status, job_id);
+
+    ippDelete(request);
+    ippDelete(response);
+    return job_id;
+}
+
+/*
+ * Returns a Send-Document request that carries the data of the job created by _create_job()
+ */
+static ipp_t *_fill_document(ipp_print_job_t *ipp_job, const wprint_job_params_t *job_params) {
+    ipp_t *request = ippNewRequest(IPP_SEND_DOCUMENT);
+    if (request == NULL) {
+        return request;
+    }
+
+    if (set_ipp_version(request, ipp_job->printer_uri, NULL, IPP_VERSION_RESOLVED) != 0) {
+        ippDelete(request);
+        return NULL;
+    }
+
+    ippAddString(request, IPP_TAG_OPERATION, IPP_TAG_URI, "printer-uri", NULL,
+            ipp_job->printer_uri);
+    ippAddInteger(request, IPP_TAG_OPERATION, IPP_TAG_INTEGER, "job-id", ipp_job->job_id);
+    ippAddString(request, IPP_TAG_OPERATION, IPP_TAG_NAME, "requesting-user-name", NULL,
+            job_params->job_originating_user_name);
+    if (ipp_job->compression != NULL) {
+        ippAddString(request, IPP_TAG_OPERATION, IPP_TAG_KEYWORD, "compression", NULL,
+                ipp_job->compression);
+    }
+    ippAddString(request, IPP_TAG_OPERATION, IPP_TAG_MIMETYPE, "document-format", NULL,
+            ipp_job->document_format);
+    ippAddBoolean(request, IPP_TAG_OPERATION, "last-document", 1);
+    return request;
+}
+
+/*
+ * Cancels a job made by _create_job() whose document could not be sent, so it does not sit in
+ * the printer's queue until the printer times it out
+ */
+static void _cancel_created_job(ipp_print_job_t *ipp_job, const wprint_job_params_t *job_params) {
+    ipp_t *request, *response;
+
+    request = ippNewRequest(IPP_CANCEL_JOB);
+    if (request == NULL) {
+        return;
+    }
+
+    ippAddString(request, IPP_TAG_OPERATION, IPP_TAG_URI, "printer-uri", NULL,
+            ipp_job->printer_uri);
+    ippAddInteger(request, IPP_TAG_OPERATION, IPP_TAG_INTEGER, "job-id", ipp_job->job_id);
+    ippAddString(request, IPP_TAG_OPERATION, IPP_TAG_NAME, "requesting-user-name", NULL,
+            job_params->job_originating_user_name);
+
+    response = ipp_doCupsRequest(ipp_job->http, request, ipp_job->http_resource,
+            ipp_job->printer_uri);
+    LOGD("_cancel_created_job: job_id %d ipp_status %d", ipp_job->job_id, cupsLastError());
+
+    ippDelete(request);
+    ippDelete(response);
+    ipp_job->job_id = -1;
+}
+
+/*
+ * Writes one HTTP chunk of document data
+ */
+static http_status_t _write_chunk(ipp_print_job_t *ipp_job, const char *buffer, size_t length) {
+    ipp_job->status = cupsWriteRequestData(ipp_job->http, buffer, length);
+    ipp_job->send_chunks++;
+    return ipp_job->status;
+}
+
+static unsigned long long _now_usec(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (unsigned long long) now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+/*
+ * Releases the compression stream of the last request, if any
+ */
+static void _end_compression(ipp_print_job_t *ipp_job) {
+    if (ipp_job->compression != NULL) {
+        deflateEnd(&ipp_job->zstream);
+        ipp_job->compression = NULL;
+    }
+}
+
+/*
+ * Sets up a gzip or deflate stream for the document data if the printer takes one, preferring
+ * gzip. Returns the compression keyword for the request, or NULL to send the data as it is.
+ */
+static const char *_start_compression(ipp_print_job_t *ipp_job,
+        const printer_capabilities_t *printer_caps) {
+    const char *compression;
+    int window_bits;
+
+    _end_compression(ipp_job);
+    if (printer_caps->compressionGzip) {
+        compression = "gzip";
+        window_bits = MAX_WBITS + 16;
+    } else if (printer_caps->compressionDeflate) {
+        // IPP deflate is the raw RFC 1951 stream, without a zlib header
+        compression = "deflate";
+        window_bits = -MAX_WBITS;
+    } else {
+        return NULL;
+    }
+
+    if (ipp_job->compress_buffer == NULL) {
+        ipp_job->compress_buffer = (char *) malloc(IPP_SEND_BUFFER_SIZE);
+        if (ipp_job->compress_buffer == NULL) {
+            LOGE("_start_compression: no buffer, sending uncompressed");
+            return NULL;
+        }
+    }
+
+    memset(&ipp_job->zstream, 0, sizeof(ipp_job->zstream));
+    if (deflateInit2(&ipp_job->zstream, IPP_COMPRESSION_LEVEL, Z_DEFLATED, window_bits, 8,
+            Z_DEFAULT_STRATEGY) != Z_OK) {
+        LOGE("_start_compression: deflateInit2 failed, sending uncompressed");
+        return NULL;
+    }
+
+    ipp_job->compression = compression;
+    ipp_job->compress_level = IPP_COMPRESSION_LEVEL;
+    ipp_job->compress_segments = ipp_job->stored_segments = 0;
+    ipp_job->compress_in = ipp_job->compress_out = 0;
+    return compression;
+}
+
+/*
+ * Runs the compressor with the given flush mode and writes out all it produces. Adds the time
+ * spent writing to write_usec.
+ */
+static status_t _deflate(ipp_print_job_t *ipp_job, int flush, unsigned long long *write_usec) {
+    z_stream *zstream = &ipp_job->zstream;
+    unsigned long long start;
+    size_t produced;
+    int zresult;
+
+    do {
+        zstream->next_out = (Bytef *) ipp_job->compress_buffer;
+        zstream->avail_out = IPP_SEND_BUFFER_SIZE;
+        zresult = deflate(zstream, flush);
+        if (zresult == Z_STREAM_ERROR) {
+            LOGE("_deflate: stream error");
+            return ERROR;
+        }
+
+        produced = IPP_SEND_BUFFER_SIZE - zstream->avail_out;
+        if (produced > 0) {
+            start = _now_usec();
+            if (_write_chunk(ipp_job, ipp_job->compress_buffer, produced) != HTTP_CONTINUE) {
+                return ERROR;
+            }
+            *write_usec += _now_usec() - start;
+            ipp_job->compress_out += produced;
+        }
+    } while ((zstream->avail_out == 0) || ((flush == Z_FINISH) && (zresult != Z_STREAM_END)));
+    return OK;
+}
+
+/*
+ * Compresses one segment and writes it out. Each segment ends in a sync flush so the printer
+ * is never left waiting on data held in the compressor.
+ *
+ * Compression only pays while the link is slower than the compressor, so each segment checks
+ * the time spent compressing against the time the saved bytes would have taken on the link.
+ * When it does not pay the stream carries on at level 0 (stored blocks), and compression is
+ * tried again every IPP_COMPRESSION_PROBE segments as the content and the link change.
+ */
+static status_t _compress_segment(ipp_print_job_t *ipp_job, const char *buffer, size_t length) {
+    z_stream *zstream = &ipp_job->zstream;
+    unsigned long long start, compress_usec, write_usec = 0, saved_usec = 0;
+    unsigned long long out_before = ipp_job->compress_out, out;
+    int level = ipp_job->compress_level;
+
+    zstream->next_in = (Bytef *) buffer;
+    zstream->avail_in = length;
+    start = _now_usec();
+    if (_deflate(ipp_job, Z_SYNC_FLUSH, &write_usec) != OK) {
+        return ERROR;
+    }
+    compress_usec = _now_usec() - start - write_usec;
+    out = ipp_job->compress_out - out_before;
+    ipp_job->compress_in += length;
+    ipp_job->compress_segments++;
+
+    if (ipp_job->compress_level == 0) {
+        ipp_job->stored_segments++;
+        if ((ipp_job->stored_segments % IPP_COMPRESSION_PROBE) == 0) {
+            level = IPP_COMPRESSION_LEVEL;
+        }
+    } else {
+        if ((out > 0) && (length > out)) {
+            saved_usec = (length - out) * write_usec / out;
+        }
+        if (saved_usec < compress_usec) {
+            level = 0;
+        }
+    }
+
+    if (level != ipp_job->compress_level) {
+        LOGD("_compress_segment: level %d, %zu -> %llu bytes, compress %llu us, write %llu us",
+                level, length, out, compress_usec, write_usec);
+        // nothing is pending after the sync flush, but give the switch room for output anyway
+        zstream->next_out = (Bytef *) ipp_job->compress_buffer;
+        zstream->avail_out = IPP_SEND_BUFFER_SIZE;
+        if (deflateParams(zstream, level, Z_DEFAULT_STRATEGY) == Z_OK) {
+            ipp_job->compress_level = level;
+        }
+        if ((zstream->avail_out < IPP_SEND_BUFFER_SIZE) && (_write_chunk(ipp_job,
+                ipp_job->compress_buffer, IPP_SEND_BUFFER_SIZE - zstream->avail_out)
+                != HTTP_CONTINUE)) {
+            return ERROR;
+        }
+        ipp_job->compress_out += IPP_SEND_BUFFER_SIZE - zstream->avail_out;
+    }
+    return OK;
+}
+
+/*
+ * Ends the compressed stream, once everything before it is written
+ */
+static status_t _finish_compression(ipp_print_job_t *ipp_job) {
+    unsigned long long write_usec = 0;
+
+    ipp_job->zstream.next_in = NULL;
+    ipp_job->zstream.avail_in = 0;
+    if (_deflate(ipp_job, Z_FINISH, &write_usec) != OK) {
+        return ERROR;
+    }
+    LOGI("_finish_compression: %s %llu -> %llu bytes, %u of %u segments stored",
+            ipp_job->compression, ipp_job->compress_in, ipp_job->compress_out,
+            ipp_job->stored_segments, ipp_job->compress_segments);
+    return OK;
+}
+
+/*
+ * Send queue callback, run on the queue's sender thread
+ */
+static status_t _write_segment(void *param, const char *buffer, size_t length) {
+    ipp_print_job_t *ipp_job = (ipp_print_job_t *) param;
+    if (ipp_job->compression != NULL) {
+        return _compress_segment(ipp_job, buffer, length);
+    }
+    return ((_write_chunk(ipp_job, buffer, length) == HTTP_CONTINUE) ? OK : ERROR);
+}
+
 static status_t _start_job(const ifc_print_job_t *this_p, const wprint_job_params_t *job_params,
         const printer_capabilities_t *printer_caps) {
     LOGD("_start_job: Enter");
@@ -512,6 +858,27 @@ static status_t _start_job(const ifc_print_job_t *this_p, const wprint_job_param
     int failed_count = 0;
 
     LOGD("_start_job entry");
+    if (this_p != NULL) {
+        // Each start is a new job on the printer
+        int done = SEND_DONE;
+        ipp_job = IMPL(ipp_print_job_t, ifc, this_p);
+        ipp_job->job_id = -1;
+        // an aborted job stays aborted
+        atomic_compare_exchange_strong(&ipp_job->send_state, &done, SEND_OPEN);
+
+        if (ipp_job->send_queue == NULL) {
+            ipp_job->send_queue = send_queue_create(IPP_SEND_QUEUE_DEPTH, IPP_SEND_BUFFER_SIZE,
+                    _write_segment, ipp_job);
+            if (ipp_job->send_queue == NULL) {
+                LOGE("_start_job: no send queue, writing synchronously");
+            }
+        } else {
+            send_queue_reset(ipp_job->send_queue);
+        }
+        ipp_job->send_calls = ipp_job->send_chunks = 0;
+        ipp_job->flushed_calls = ipp_job->flushed_chunks = 0;
+    }
+
     do {
         retry = false;
         if (this_p == NULL) {
@@ -525,15 +892,30 @@ static status_t _start_job(const ifc_print_job_t *this_p, const wprint_job_param
         if ((job_params->useragent != NULL) && (strlen(job_params->useragent) > 0)) {
             ipp_job->useragent = job_params->useragent;
         }
-        request = _fill_job(IPP_PRINT_JOB, ipp_job->printer_uri, job_params, printer_caps);
+        if (ipp_job->useragent != NULL) {
+            httpSetDefaultField(ipp_job->http, HTTP_FIELD_USER_AGENT, ipp_job->useragent);
+        }
+
+        ipp_job->compression = _start_compression(ipp_job, printer_caps);
+
+        // Where the printer allows it, learn the job id up front rather than after all the data
+        if (printer_caps->createJobSupported && (ipp_job->job_id == -1) && (failed_count == 0)) {
+            ipp_job->job_id = _create_job(ipp_job, job_params, printer_caps);
+        }
+
+        if (ipp_job->job_id != -1) {
+            ipp_job->op = IPP_SEND_DOCUMENT;
+            request = _fill_document(ipp_job, job_params);
+        } else {
+            ipp_job->op = IPP_PRINT_JOB;
+            request = _fill_job(IPP_PRINT_JOB, ipp_job->printer_uri, job_params, printer_caps,
+                    ipp_job->compression);
+        }
 
         if (request == NULL) {
             continue;
         }
 
-        if (ipp_job->useragent != NULL) {
-            httpSetDefaultField(ipp_job->http, HTTP_FIELD_USER_AGENT, ipp_job->useragent);
-        }
         ipp_job->status = cupsSendRequest(ipp_job->http, request, ipp_job->http_resource, 0);
         if (ipp_job->status != HTTP_CONTINUE) {
             failed_count++;
@@ -549,15 +931,32 @@ static status_t _start_job(const ifc_print_job_t *this_p, const wprint_job_param
             }
         }
         ippDelete(request);
-        LOGI("_start_job httpPrint fd %d status %d ipp_status %d", ipp_job->http->fd,
-                ipp_job->status, cupsLastError());
+        LOGI("_start_job %s httpPrint fd %d status %d ipp_status %d", ippOpString(ipp_job->op),
+                ipp_job->http->fd, ipp_job->status, cupsLastError());
 
         result = ((ipp_job->status == HTTP_CONTINUE) ? OK : ERROR);
+        if ((result == ERROR) && (ipp_job->job_id != -1)) {
+            _cancel_created_job(ipp_job, job_params);
+        }
     } while (retry);
 
     return result;
 }
 
+/*
+ * Waits for the sender thread to write out everything queued
+ */
+static http_status_t _drain(ipp_print_job_t *ipp_job) {
+    if (ipp_job->send_queue != NULL) {
+        send_queue_drain(ipp_job->send_queue);
+    }
+    return ipp_job->status;
+}
+
+/*
+ * Gathers small writes into large chunks that the send queue's thread writes out, so the job
+ * goes on encoding while earlier data is on the wire. Without a queue the data is written here.
+ */
 static int _send_data(const ifc_print_job_t *this_p, const char *buffer, size_t length) {
     ipp_print_job_t *ipp_job;
     if (this_p == NULL) {
@@ -569,25 +968,67 @@ static int _send_data(const ifc_print_job_t *this_p, const char *buffer, size_t
         return ERROR;
     }
 
-    if (ipp_job->status != HTTP_CONTINUE) {
+    if (_aborted(ipp_job)) {
         return ERROR;
     }
 
-    if (length != 0) {
-        if (ipp_job->useragent != NULL) {
-            httpSetDefaultField(ipp_job->http, HTTP_FIELD_USER_AGENT, ipp_job->useragent);
+    if (ipp_job->send_queue != NULL) {
+        // a failed write on the sender thread shows up as a failed queue
+        if (send_queue_write(ipp_job->send_queue, buffer, length) != OK) {
+            return ERROR;
         }
-        ipp_job->status = cupsWriteRequestData(ipp_job->http, buffer, length);
+        if (length != 0) {
+            ipp_job->send_calls++;
+        }
+        return length;
+    }
+
+    if (ipp_job->status != HTTP_CONTINUE) {
+        return ERROR;
+    }
+    if (length != 0) {
+        ipp_job->send_calls++;
+        _write_segment(ipp_job, buffer, length);
     }
     return ((ipp_job->status == HTTP_CONTINUE) ? length : (int) ERROR);
 }
 
+/*
+ * Hands the partly filled chunk to the sender at the end of a page so the printer can start
+ * on it
+ */
+static status_t _flush(const ifc_print_job_t *this_p) {
+    ipp_print_job_t *ipp_job;
+    unsigned int chunks;
+    status_t result;
+    if (this_p == NULL) {
+        return ERROR;
+    }
+
+    ipp_job = IMPL(ipp_print_job_t, ifc, this_p);
+    if ((ipp_job->http == NULL) || _aborted(ipp_job)) {
+        return ERROR;
+    }
+
+    if (ipp_job->send_queue != NULL) {
+        // each queued segment goes out as one chunk, or a few once compressed
+        result = send_queue_flush(ipp_job->send_queue, &chunks);
+    } else {
+        chunks = ipp_job->send_chunks - ipp_job->flushed_chunks;
+        ipp_job->flushed_chunks = ipp_job->send_chunks;
+        result = ((ipp_job->status == HTTP_CONTINUE) ? OK : ERROR);
+    }
+    LOGD("_flush: %u sends in %u chunks since the last flush",
+            ipp_job->send_calls - ipp_job->flushed_calls, chunks);
+    ipp_job->flushed_calls = ipp_job->send_calls;
+    return result;
+}
+
 static status_t _end_job(const ifc_print_job_t *this_p) {
     LOGD("_end_job: Enter");
     status_t result = ERROR;
     ipp_t *response;
     ipp_attribute_t *attrptr;
-    int op = IPP_PRINT_JOB;
     ipp_print_job_t *ipp_job;
     int job_id = -1;
 
@@ -605,10 +1046,30 @@ static status_t _end_job(const ifc_print_job_t *this_p) {
 
     LOGD("_end_job: entry httpPrint %d", ipp_job->http->fd);
 
-    if (ipp_job->useragent != NULL) {
-        httpSetDefaultField(ipp_job->http, HTTP_FIELD_USER_AGENT, ipp_job->useragent);
+    if (_aborted(ipp_job)) {
+        // the request body was cut short, so the printer discards it
+        LOGD("_end_job: request aborted");
+        return CANCELLED;
     }
-    ipp_job->status = cupsWriteRequestData(ipp_job->http, buffer, 0);
+
+    // the zero length write ends the chunked body, so the buffered data has to go first. The
+    // connection belongs to the sender thread until the queue is drained.
+    if ((_drain(ipp_job) == HTTP_CONTINUE) &&
+            ((ipp_job->compression == NULL) || (_finish_compression(ipp_job) == OK))) {
+        if (ipp_job->useragent != NULL) {
+            httpSetDefaultField(ipp_job->http, HTTP_FIELD_USER_AGENT, ipp_job->useragent);
+        }
+        ipp_job->status = cupsWriteRequestData(ipp_job->http, buffer, 0);
+    }
+    if (ipp_job->status == HTTP_CONTINUE) {
+        // from here on a cancel goes to the printer rather than cutting the request short
+        int open = SEND_OPEN;
+        if (!atomic_compare_exchange_strong(&ipp_job->send_state, &open, SEND_DONE)) {
+            LOGD("_end_job: request aborted");
+            return CANCELLED;
+        }
+    }
+    LOGI("_end_job: %u sends in %u chunks", ipp_job->send_calls, ipp_job->send_chunks);
 
     if (ipp_job->status != HTTP_CONTINUE) {
         LOGE("Error: from cupsWriteRequestData http.fd %d:  status %d",
@@ -619,10 +1080,14 @@ static status_t _end_job(const ifc_print_job_t *this_p) {
         response = cupsGetResponse(ipp_job->http, ipp_job->http_resource);
 
         if ((attrptr = ippFindAttribute(response, "job-id", IPP_TAG_INTEGER)) == NULL) {
-            LOGE("sent cupsGetResponse %s job id is null; received", ippOpString(op));
+            LOGE("sent cupsGetResponse %s job id is null; received", ippOpString(ipp_job->op));
         } else {
             job_id = ippGetInteger(attrptr, 0);
-            LOGI("sent cupsGetResponse %s job_id %d; received", ippOpString(op), job_id);
+            LOGI("sent cupsGetResponse %s job_id %d; received", ippOpString(ipp_job->op),
+                    job_id);
+            if (ipp_job->job_id == -1) {
+                ipp_job->job_id = job_id;
+            }
         }
 
         if (response != NULL) {
@@ -647,3 +1112,35 @@ static status_t _end_job(const ifc_print_job_t *this_p) {
 
     return result;
 }
+
+/*
+ * Interrupts a request in progress by shutting its socket down. The connection itself is closed
+ * by _destroy(). Once the whole request body has been written the request is left to complete.
+ */
+static bool _abort(const ifc_print_job_t *this_p) {
+    ipp_print_job_t *ipp_job;
+    int open = SEND_OPEN;
+    if (this_p == NULL) {
+        return false;
+    }
+
+    ipp_job = IMPL(ipp_print_job_t, ifc, this_p);
+    if (!atomic_compare_exchange_strong(&ipp_job->send_state, &open, SEND_ABORTED)) {
+        // either the whole request body is out already, or it was cut short before
+        return (open == SEND_ABORTED);
+    }
+    if (ipp_job->send_queue != NULL) {
+        send_queue_abort(ipp_job->send_queue);
+    }
+    if ((ipp_job->http != NULL) && (httpGetFd(ipp_job->http) >= 0)) {
+        shutdown(httpGetFd(ipp_job->http), SHUT_RDWR);
+    }
+    return true;
+}
+
+static int _get_job_id(const ifc_print_job_t *this_p) {
+    if (this_p == NULL) {
+        return -1;
+    }
+    return IMPL(ipp_print_job_t, ifc, this_p)->job_id;
+}
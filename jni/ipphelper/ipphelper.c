@@ -16,6 +16,9 @@
  * limitations under the License.
  */
 
+#include <poll.h>
+#include <pthread.h>
+#include <time.h>
 #include "lib_wprint.h"
 #include "cups.h"
 #include "http-private.h"
@@ -28,6 +31,32 @@
 #define TAG "ipphelper"
 #define IPP_JOB_UNKNOWN ((ipp_jstate_t)(-1))
 
+// Most connections the pool keeps, and how long one may sit idle before it is closed
+#define HTTP_POOL_SIZE 8
+#define HTTP_POOL_IDLE_MSEC 15000
+
+// Lease asked for on event subscriptions. Once it runs out the monitor goes back to polling.
+#define NOTIFY_LEASE_SECONDS 3600
+
+/*
+ * A pooled connection, keyed by host, port and scheme. Connections are in use by one caller
+ * at a time and are idle in between.
+ */
+typedef struct {
+    http_t *http;
+    char host[256];
+    int port;
+    bool secure;
+    bool in_use;
+    long connect_msec;
+    struct timespec idle_since;
+} http_pool_entry_t;
+
+static http_pool_entry_t _http_pool[HTTP_POOL_SIZE];
+static pthread_mutex_t _http_pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static unsigned int _http_pool_hits, _http_pool_misses;
+static unsigned long _http_pool_saved_msec;
+
 const char *resource_extensions_arr[] = {
         DEFAULT_IPP_URI_RESOURCE, "/"
 };
@@ -35,12 +64,12 @@ const char *resource_extensions_arr[] = {
 /*
  * Get the IPP version of the given printer
  */
-static status_t determine_ipp_version(char *, http_t *);
+static status_t determine_ipp_version(char *, http_t *, int *, int *);
 
 /*
  * Tests IPP versions and sets it to the latest working version
  */
-static status_t test_and_set_ipp_version(char *, http_t *, int, int);
+static status_t test_and_set_ipp_version(char *, http_t *, int, int, int *, int *);
 
 /*
  * Parses supported IPP versions from the IPP response and copies them into ippVersions
@@ -152,43 +181,131 @@ typedef struct {
 
 static const char *__request_ipp_version[] = {"ipp-versions-supported"};
 
-static int __ipp_version_major = 2;
-static int __ipp_version_minor = 0;
+// Printers whose negotiated IPP version is remembered
+#define IPP_VERSION_CACHE_SIZE 16
+
+// Version used with a printer until it rejects it
+#define DEFAULT_IPP_VERSION_MAJOR 2
+#define DEFAULT_IPP_VERSION_MINOR 0
+
+/*
+ * IPP version negotiated with a printer, keyed by printer URI. probed is set once the version
+ * came from the printer itself, after which the printer is not probed again.
+ */
+typedef struct {
+    char printer_uri[MAX_URI_LENGTH + 1];
+    int major;
+    int minor;
+    bool probed;
+} ipp_version_entry_t;
+
+static ipp_version_entry_t _ipp_versions[IPP_VERSION_CACHE_SIZE];
+static int _ipp_versions_used;
+static int _ipp_versions_next;
+static pthread_mutex_t _ipp_versions_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * Looks up the version to use with a printer, the default if it has not been negotiated.
+ * Returns true if the version was probed from the printer.
+ */
+static bool _get_printer_ipp_version(const char *printer_uri, int *major, int *minor) {
+    bool probed = false;
+    int i;
+
+    *major = DEFAULT_IPP_VERSION_MAJOR;
+    *minor = DEFAULT_IPP_VERSION_MINOR;
+    if (printer_uri == NULL) {
+        return false;
+    }
+    pthread_mutex_lock(&_ipp_versions_lock);
+    for (i = 0; i < _ipp_versions_used; i++) {
+        if (strcmp(_ipp_versions[i].printer_uri, printer_uri) == 0) {
+            *major = _ipp_versions[i].major;
+            *minor = _ipp_versions[i].minor;
+            probed = _ipp_versions[i].probed;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&_ipp_versions_lock);
+    return probed;
+}
+
+/*
+ * Remembers the version probed from a printer, replacing the oldest entry when full
+ */
+static void _set_printer_ipp_version(const char *printer_uri, int major, int minor) {
+    ipp_version_entry_t *entry = NULL;
+    int i;
+
+    pthread_mutex_lock(&_ipp_versions_lock);
+    for (i = 0; i < _ipp_versions_used; i++) {
+        if (strcmp(_ipp_versions[i].printer_uri, printer_uri) == 0) {
+            entry = &_ipp_versions[i];
+            break;
+        }
+    }
+    if (entry == NULL) {
+        if (_ipp_versions_used < IPP_VERSION_CACHE_SIZE) {
+            entry = &_ipp_versions[_ipp_versions_used++];
+        } else {
+            entry = &_ipp_versions[_ipp_versions_next];
+            _ipp_versions_next = (_ipp_versions_next + 1) % IPP_VERSION_CACHE_SIZE;
+        }
+        strncpy(entry->printer_uri, printer_uri, MAX_URI_LENGTH);
+        entry->printer_uri[MAX_URI_LENGTH] = '\0';
+    }
+    entry->major = major;
+    entry->minor = minor;
+    entry->probed = true;
+    pthread_mutex_unlock(&_ipp_versions_lock);
+}
 
 status_t set_ipp_version(ipp_t *op_to_set, char *printer_uri, http_t *http,
         ipp_version_state use_existing_version) {
+    int major, minor, used_major, used_minor;
+    bool probed;
+
     LOGD("set_ipp_version(): Enter %d", use_existing_version);
     if (op_to_set == NULL) {
         return ERROR;
     }
+    probed = _get_printer_ipp_version(printer_uri, &major, &minor);
     switch (use_existing_version) {
         case NEW_REQUEST_SEQUENCE:
-            __ipp_version_major = 2;
-            __ipp_version_minor = 0;
-            break;
         case IPP_VERSION_RESOLVED:
             break;
         case IPP_VERSION_UNSUPPORTED:
-            if (determine_ipp_version(printer_uri, http) != 0) {
+            used_major = ippGetVersion(op_to_set, &used_minor);
+            if (probed && ((used_major != major) || (used_minor != minor))) {
+                // another request already negotiated with this printer, retry with its result
+                break;
+            }
+            if (probed) {
+                LOGE("set_ipp_version(): %s rejects its negotiated version %d.%d", printer_uri,
+                        major, minor);
                 return ERROR;
             }
+            if (determine_ipp_version(printer_uri, http, &major, &minor) != 0) {
+                return ERROR;
+            }
+            _set_printer_ipp_version(printer_uri, major, minor);
             break;
     }
-    ippSetVersion(op_to_set, __ipp_version_major, __ipp_version_minor);
-    LOGD("set_ipp_version(): Done");
+    ippSetVersion(op_to_set, major, minor);
+    LOGD("set_ipp_version(): Done, %d.%d", major, minor);
     return OK;
 }
 
-static status_t determine_ipp_version(char *printer_uri, http_t *http) {
+static status_t determine_ipp_version(char *printer_uri, http_t *http, int *major, int *minor) {
     LOGD("determine_ipp_version(): Enter printer_uri =  %s", printer_uri);
 
     if (http == NULL) {
         LOGE("determine_ipp_version(): http is NULL cannot continue");
         return ERROR;
     }
-    if ((test_and_set_ipp_version(printer_uri, http, 1, 1) == OK)
-            || (test_and_set_ipp_version(printer_uri, http, 1, 0) == OK)
-            || (test_and_set_ipp_version(printer_uri, http, 2, 0) == OK)) {
+    if ((test_and_set_ipp_version(printer_uri, http, 1, 1, major, minor) == OK)
+            || (test_and_set_ipp_version(printer_uri, http, 1, 0, major, minor) == OK)
+            || (test_and_set_ipp_version(printer_uri, http, 2, 0, major, minor) == OK)) {
         LOGD("successfully set ipp version.");
     } else {
         LOGD("could not get ipp version using any known ipp version.");
@@ -197,7 +314,12 @@ static status_t determine_ipp_version(char *printer_uri, http_t *http) {
     return OK;
 }
 
-static status_t test_and_set_ipp_version(char *printer_uri, http_t *http, int major, int minor) {
+/*
+ * Asks the printer which versions it supports using the given version, writing the highest
+ * supported one to set_major and set_minor
+ */
+static status_t test_and_set_ipp_version(char *printer_uri, http_t *http, int major, int minor,
+        int *set_major, int *set_minor) {
     status_t return_value = ERROR;
     int service_unavailable_retry_count = 0;
     int bad_request_retry_count = 0;
@@ -260,23 +382,23 @@ static status_t test_and_set_ipp_version(char *printer_uri, http_t *http, int ma
 
             parse_IPPVersions(response, &ippVersions);
             if (ippVersions.supportsIpp20) {
-                __ipp_version_major = 2;
-                __ipp_version_minor = 0;
+                *set_major = 2;
+                *set_minor = 0;
                 return_value = OK;
                 LOGD("test_and_set_ipp_version(): ipp version set to %d,%d",
-                        __ipp_version_major, __ipp_version_minor);
+                        *set_major, *set_minor);
             } else if (ippVersions.supportsIpp11) {
-                __ipp_version_major = 1;
-                __ipp_version_minor = 1;
+                *set_major = 1;
+                *set_minor = 1;
                 return_value = OK;
                 LOGD("test_and_set_ipp_version(): ipp version set to %d,%d",
-                        __ipp_version_major, __ipp_version_minor);
+                        *set_major, *set_minor);
             } else if (ippVersions.supportsIpp10) {
-                __ipp_version_major = 1;
-                __ipp_version_minor = 0;
+                *set_major = 1;
+                *set_minor = 0;
                 return_value = OK;
                 LOGD("test_and_set_ipp_version(): ipp version set to %d,%d",
-                        __ipp_version_major, __ipp_version_minor);
+                        *set_major, *set_minor);
             } else {
                 LOGD("test_and_set_ipp_version: ipp version not found");
                 return_value = ERROR;
@@ -1592,6 +1714,29 @@ void parse_printerAttributes(ipp_t *response, printer_capabilities_t *capabiliti
         capabilities->jobPagesPerSetSupported = 1;
     }
 
+    if ((attrptr = ippFindAttribute(response, "operations-supported", IPP_TAG_ENUM)) != NULL) {
+        int create_job = 0, send_document = 0;
+        for (i = 0; i < ippGetCount(attrptr); i++) {
+            int op = ippGetInteger(attrptr, i);
+            create_job |= (op == IPP_CREATE_JOB);
+            send_document |= (op == IPP_SEND_DOCUMENT);
+        }
+        capabilities->createJobSupported = (create_job && send_document);
+    }
+
+    capabilities->compressionGzip = 0;
+    capabilities->compressionDeflate = 0;
+    if ((attrptr = ippFindAttribute(response, "compression-supported", IPP_TAG_KEYWORD)) != NULL) {
+        for (i = 0; i < ippGetCount(attrptr); i++) {
+            const char *compression = ippGetString(attrptr, i, NULL);
+            if (strcmp(compression, "gzip") == 0) {
+                capabilities->compressionGzip = 1;
+            } else if (strcmp(compression, "deflate") == 0) {
+                capabilities->compressionDeflate = 1;
+            }
+        }
+    }
+
     debuglist_printerCapabilities(capabilities);
 }
 
@@ -1655,6 +1800,9 @@ void debuglist_printerCapabilities(printer_capabilities_t *capabilities) {
     }
     LOGD("print_scaling_default: %s",capabilities->print_scaling_default);
     LOGD("jobPagesPerSetSupported: %d", capabilities->jobPagesPerSetSupported);
+    LOGD("createJobSupported: %d", capabilities->createJobSupported);
+    LOGD("compression gzip: %d deflate: %d", capabilities->compressionGzip,
+            capabilities->compressionDeflate);
 }
 
 void debuglist_printerStatus(printer_state_dyn_t *printer_state_dyn) {
@@ -1711,10 +1859,217 @@ static int ipp_server_cert_cb(http_t *http, void *tls, cups_array_t *certs, void
     return error;
 }
 
+/*
+ * Returns milliseconds elapsed on the monotonic clock since start
+ */
+static long _http_elapsed_msec(const struct timespec *start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return ((now.tv_sec - start->tv_sec) * 1000L) + ((now.tv_nsec - start->tv_nsec) / 1000000L);
+}
+
+/*
+ * Returns true if a connection can be left idle or picked up again. Nothing may arrive on an
+ * idle connection, so one with data to read has been closed by the printer or is out of step.
+ */
+static bool _http_reusable(http_t *http) {
+    struct pollfd pfd;
+
+    if ((http->fd < 0) || (http->state != HTTP_WAITING) || (httpError(http) != 0)) {
+        return false;
+    }
+    pfd.fd = http->fd;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+    return (poll(&pfd, 1, 0) == 0);
+}
+
+/*
+ * Returns a pooled or new connection as ipp_http_acquire() does. If reused is not NULL it is
+ * set to whether the connection came from the pool.
+ */
+static http_t *_http_acquire(const char *printer_addr, int port, bool secure, bool *reused) {
+    http_t *stale[HTTP_POOL_SIZE];
+    int num_stale = 0, i;
+    http_t *http = NULL;
+    long connect_msec = 0;
+    struct timespec start;
+
+    if (reused != NULL) {
+        *reused = false;
+    }
+    if (printer_addr == NULL) {
+        return NULL;
+    }
+
+    pthread_mutex_lock(&_http_pool_lock);
+    for (i = 0; i < HTTP_POOL_SIZE; i++) {
+        http_pool_entry_t *entry = &_http_pool[i];
+        if ((entry->http == NULL) || entry->in_use) {
+            continue;
+        }
+        if ((_http_elapsed_msec(&entry->idle_since) > HTTP_POOL_IDLE_MSEC) ||
+                !_http_reusable(entry->http)) {
+            stale[num_stale++] = entry->http;
+            entry->http = NULL;
+        } else if ((http == NULL) && (entry->port == port) && (entry->secure == secure) &&
+                (strcmp(entry->host, printer_addr) == 0)) {
+            entry->in_use = true;
+            http = entry->http;
+            connect_msec = entry->connect_msec;
+            _http_pool_hits++;
+            _http_pool_saved_msec += (unsigned long) connect_msec;
+        }
+    }
+    if (http == NULL) {
+        _http_pool_misses++;
+    }
+    pthread_mutex_unlock(&_http_pool_lock);
+
+    for (i = 0; i < num_stale; i++) {
+        httpClose(stale[i]);
+    }
+
+    if (http != NULL) {
+        LOGD("ipp_http_acquire(): reusing %s:%d, saved %ld ms (hits %u, misses %u, saved %lu ms)",
+                printer_addr, port, connect_msec, _http_pool_hits, _http_pool_misses,
+                _http_pool_saved_msec);
+        if (reused != NULL) {
+            *reused = true;
+        }
+        return http;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if (secure) {
+        http = httpConnect2(printer_addr, port, NULL, AF_UNSPEC, HTTP_ENCRYPTION_ALWAYS, 1,
+                HTTP_TIMEOUT_MILLIS, NULL);
+
+        // If ALWAYS doesn't work, fall back to REQUIRED
+        if (http == NULL) {
+            http = httpConnect2(printer_addr, port, NULL, AF_UNSPEC, HTTP_ENCRYPTION_REQUIRED, 1,
+                    HTTP_TIMEOUT_MILLIS, NULL);
+        }
+    } else {
+        http = httpConnect2(printer_addr, port, NULL, AF_UNSPEC, HTTP_ENCRYPTION_IF_REQUESTED,
+                1, HTTP_TIMEOUT_MILLIS, NULL);
+    }
+    if (http == NULL) {
+        return NULL;
+    }
+    connect_msec = _http_elapsed_msec(&start);
+    LOGD("ipp_http_acquire(): connected to %s:%d in %ld ms", printer_addr, port, connect_msec);
+
+    // with the pool full the connection is simply closed when released
+    pthread_mutex_lock(&_http_pool_lock);
+    for (i = 0; i < HTTP_POOL_SIZE; i++) {
+        http_pool_entry_t *entry = &_http_pool[i];
+        if (entry->http == NULL) {
+            entry->http = http;
+            strncpy(entry->host, printer_addr, sizeof(entry->host) - 1);
+            entry->host[sizeof(entry->host) - 1] = '\0';
+            entry->port = port;
+            entry->secure = secure;
+            entry->in_use = true;
+            entry->connect_msec = connect_msec;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&_http_pool_lock);
+    return http;
+}
+
+http_t *ipp_http_acquire(const char *printer_addr, int port, bool secure) {
+    return _http_acquire(printer_addr, port, secure, NULL);
+}
+
+/*
+ * Takes a connection out of the pool and closes it
+ */
+static void _http_discard(http_t *http) {
+    int i;
+
+    pthread_mutex_lock(&_http_pool_lock);
+    for (i = 0; i < HTTP_POOL_SIZE; i++) {
+        if (_http_pool[i].http == http) {
+            _http_pool[i].http = NULL;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&_http_pool_lock);
+    httpClose(http);
+}
+
+/*
+ * A reused TLS connection skips the handshake and with it the server certificate callback, so
+ * hand the peer certificate to the caller's validator as the handshake would have. Returns 0
+ * if it is accepted, -1 if it is rejected, or 1 if it cannot be read back from the connection.
+ */
+static int _http_revalidate(http_t *http, const wprint_connect_info_t *connect_info) {
+    cups_array_t *certs = NULL;
+    int error;
+
+    if ((httpCopyCredentials(http, &certs) != 0) || (certs == NULL)) {
+        return 1;
+    }
+    error = ipp_server_cert_cb(http, NULL, certs, (void *) connect_info);
+    httpFreeCredentials(certs);
+    return ((error != 0) ? -1 : 0);
+}
+
+void ipp_http_release(http_t *http) {
+    int i;
+
+    if (http == NULL) {
+        return;
+    }
+
+    pthread_mutex_lock(&_http_pool_lock);
+    for (i = 0; i < HTTP_POOL_SIZE; i++) {
+        http_pool_entry_t *entry = &_http_pool[i];
+        if (entry->http == http) {
+            if (_http_reusable(http)) {
+                entry->in_use = false;
+                clock_gettime(CLOCK_MONOTONIC, &entry->idle_since);
+                http = NULL;
+            } else {
+                entry->http = NULL;
+            }
+            break;
+        }
+    }
+    pthread_mutex_unlock(&_http_pool_lock);
+
+    if (http != NULL) {
+        httpClose(http);
+    }
+}
+
+void ipp_http_pool_flush(void) {
+    http_t *idle[HTTP_POOL_SIZE];
+    int num_idle = 0, i;
+
+    pthread_mutex_lock(&_http_pool_lock);
+    for (i = 0; i < HTTP_POOL_SIZE; i++) {
+        if ((_http_pool[i].http != NULL) && !_http_pool[i].in_use) {
+            idle[num_idle++] = _http_pool[i].http;
+            _http_pool[i].http = NULL;
+        }
+    }
+    pthread_mutex_unlock(&_http_pool_lock);
+
+    for (i = 0; i < num_idle; i++) {
+        httpClose(idle[i]);
+    }
+}
+
 http_t *ipp_cups_connect(const wprint_connect_info_t *connect_info, char *printer_uri,
         unsigned int uriLength) {
     const char *uri_path;
     http_t *curl_http = NULL;
+    bool secure = (strstr(connect_info->uri_scheme, IPPS_PREFIX) != NULL);
+    bool reused;
+    int check;
 
     cupsSetServerCertCB(ipp_server_cert_cb, (void *)connect_info);
 
@@ -1726,19 +2081,23 @@ http_t *ipp_cups_connect(const wprint_connect_info_t *connect_info, char *printe
 
     int ippPortNumber = ((connect_info->port_num == IPP_PORT) ? ippPort() : connect_info->port_num);
 
-    if (strstr(connect_info->uri_scheme,IPPS_PREFIX) != NULL) {
-        curl_http = httpConnect2(connect_info->printer_addr, ippPortNumber, NULL, AF_UNSPEC,
-                HTTP_ENCRYPTION_ALWAYS, 1, HTTP_TIMEOUT_MILLIS, NULL);
-
-        // If ALWAYS doesn't work, fall back to REQUIRED
-        if (curl_http == NULL) {
-            curl_http = httpConnect2(connect_info->printer_addr, ippPortNumber, NULL, AF_UNSPEC,
-                    HTTP_ENCRYPTION_REQUIRED, 1, HTTP_TIMEOUT_MILLIS, NULL);
+    do {
+        check = 0;
+        curl_http = _http_acquire(connect_info->printer_addr, ippPortNumber, secure, &reused);
+        if ((curl_http != NULL) && reused && secure &&
+                (connect_info->validate_certificate != NULL)) {
+            check = _http_revalidate(curl_http, connect_info);
+            if (check > 0) {
+                // without the certificate the connection cannot be vouched for, open a new one
+                LOGD("ipp_cups_connect: no certificate on pooled connection, reconnecting");
+                _http_discard(curl_http);
+            } else if (check < 0) {
+                LOGD("ipp_cups_connect: pooled connection's certificate rejected");
+                ipp_http_release(curl_http);
+                curl_http = NULL;
+            }
         }
-    } else {
-        curl_http = httpConnect2(connect_info->printer_addr, ippPortNumber, NULL, AF_UNSPEC,
-                HTTP_ENCRYPTION_IF_REQUESTED, 1, HTTP_TIMEOUT_MILLIS, NULL);
-    }
+    } while (check > 0);
 
     httpSetTimeout(curl_http, (double)connect_info->timeout / 1000, NULL, 0);
     httpAssembleURIf(HTTP_URI_CODING_ALL, printer_uri, uriLength, connect_info->uri_scheme, NULL,
@@ -1884,8 +2243,8 @@ int getJobId(http_t *http,
               job_state_dyn_t *job_state_dyn,
               const char *requesting_user) {
     int job_id = -1;
-    // Requested print job attributes
-    static const char *jattrs[] = {"job-id"};
+    // Requested print job attributes. The state comes along so the caller needs no second request
+    static const char *jattrs[] = {"job-id", "job-state", "job-state-reasons"};
     ipp_t *request = NULL;  /* IPP request object */
     ipp_t *response = NULL; /* IPP response object */
 
@@ -1904,7 +2263,12 @@ int getJobId(http_t *http,
             job_state_dyn->job_state_reasons[0] = IPP_JOB_STATE_REASON_UNABLE_TO_CONNECT;
         } else {
             ipp_attribute_t *attr = ippFindAttribute(response, "job-id", IPP_TAG_INTEGER);
-            if (attr != NULL) job_id = ippGetInteger(attr, 0);
+            if (attr != NULL) {
+                ipp_jstate_t job_state = IPP_JOB_UNKNOWN;
+                job_id = ippGetInteger(attr, 0);
+                set_jobStateDyn(response, &job_state, job_state_dyn);
+                parse_jobStateReasons(response, job_state_dyn);
+            }
         }
     }
 
@@ -1915,6 +2279,188 @@ int getJobId(http_t *http,
     return job_id;
 }
 
+/*
+ * Resets job_state_dyn reasons and fills them from the job-state attributes in event
+ */
+static void _apply_job_event(ipp_t *event, job_state_dyn_t *job_state_dyn) {
+    ipp_jstate_t job_state = IPP_JOB_UNKNOWN;
+    int i;
+
+    for (i = 0; i <= IPP_JOB_STATE_REASON_MAX_VALUE; i++) {
+        job_state_dyn->job_state_reasons[i] = IPP_JOB_STATE_REASON_MAX_VALUE;
+    }
+    set_jobStateDyn(event, &job_state, job_state_dyn);
+    parse_jobStateReasons(event, job_state_dyn);
+}
+
+/*
+ * Resets printer_state_dyn and fills it from the printer-state attributes in event
+ */
+static void _apply_printer_event(ipp_t *event, printer_state_dyn_t *printer_state_dyn) {
+    ipp_pstate_t printer_state = IPP_PRINTER_STOPPED;
+    int i;
+
+    printer_state_dyn->printer_status = PRINT_STATUS_IDLE;
+    for (i = 0; i <= PRINT_STATUS_MAX_STATE; i++) {
+        printer_state_dyn->printer_reasons[i] = PRINT_STATUS_MAX_STATE;
+    }
+    get_PrinterStateReason(event, &printer_state, printer_state_dyn);
+}
+
+/*
+ * Sorts one event notification group, keeping it in *job_event when it carries the state of
+ * job_id and in *printer_event when it carries printer state. A job-state-changed event may
+ * carry printer attributes as well (CUPS sends both), so it can be kept in both. Events arrive
+ * oldest first, so a kept event replaces the previous one.
+ */
+static void _sort_event(ipp_t *event, int job_id, ipp_t **printer_event, ipp_t **job_event) {
+    ipp_attribute_t *attr;
+    bool for_job, for_printer;
+
+    attr = ippFindAttribute(event, "notify-job-id", IPP_TAG_INTEGER);
+    for_job = (attr != NULL && job_id != -1 && ippGetInteger(attr, 0) == job_id &&
+            ippFindAttribute(event, "job-state", IPP_TAG_ENUM) != NULL);
+    for_printer = (ippFindAttribute(event, "printer-state", IPP_TAG_ENUM) != NULL);
+
+    if (for_job) {
+        if (*job_event != NULL) ippDelete(*job_event);
+        *job_event = event;
+    }
+    if (for_printer) {
+        if (*printer_event != NULL) ippDelete(*printer_event);
+        if (for_job) {
+            *printer_event = ippNew();
+            if (*printer_event != NULL) ippCopyAttributes(*printer_event, event, 0, NULL, NULL);
+        } else {
+            *printer_event = event;
+        }
+    }
+    if (!for_job && !for_printer) {
+        ippDelete(event);
+    }
+}
+
+int ipp_create_subscription(http_t *http, char *http_resource, char *printer_uri,
+        const char *requesting_user) {
+    static const char *events[] = {"printer-state-changed", "job-state-changed"};
+    int subscription_id = -1;
+    ipp_t *request, *response;
+    ipp_attribute_t *attr;
+    ipp_status_t ipp_status;
+
+    request = ippNewRequest(IPP_OP_CREATE_PRINTER_SUBSCRIPTIONS);
+    if (request == NULL) return -1;
+
+    ippAddString(request, IPP_TAG_OPERATION, IPP_TAG_URI, "printer-uri", NULL, printer_uri);
+    ippAddString(request, IPP_TAG_OPERATION, IPP_TAG_NAME, "requesting-user-name", NULL,
+            requesting_user);
+    ippAddString(request, IPP_TAG_SUBSCRIPTION, IPP_TAG_KEYWORD, "notify-pull-method", NULL,
+            "ippget");
+    ippAddStrings(request, IPP_TAG_SUBSCRIPTION, IPP_TAG_KEYWORD, "notify-events",
+            sizeof(events) / sizeof(events[0]), NULL, events);
+    ippAddInteger(request, IPP_TAG_SUBSCRIPTION, IPP_TAG_INTEGER, "notify-lease-duration",
+            NOTIFY_LEASE_SECONDS);
+
+    response = ipp_doCupsRequest(http, request, http_resource, printer_uri);
+    ipp_status = cupsLastError();
+    if (response == NULL || ipp_status >= IPP_BAD_REQUEST) {
+        LOGD("ipp_create_subscription(): not supported, ipp_status %d: %s", ipp_status,
+                ippErrorString(ipp_status));
+    } else if ((attr = ippFindAttribute(response, "notify-subscription-id", IPP_TAG_INTEGER))
+            != NULL) {
+        subscription_id = ippGetInteger(attr, 0);
+    }
+
+    ippDelete(request);
+    if (response != NULL) ippDelete(response);
+
+    LOGD("ipp_create_subscription() returning subscription-id: %d", subscription_id);
+    return subscription_id;
+}
+
+ipp_status_t ipp_get_notifications(http_t *http, char *http_resource, char *printer_uri,
+        int subscription_id, int *sequence, int job_id, printer_state_dyn_t *printer_state_dyn,
+        job_state_dyn_t *job_state_dyn, const char *requesting_user) {
+    ipp_t *request, *response;
+    ipp_t *event = NULL, *printer_event = NULL, *job_event = NULL;
+    ipp_attribute_t *attr;
+    ipp_status_t ipp_status;
+    int events = 0;
+
+    request = ippNewRequest(IPP_OP_GET_NOTIFICATIONS);
+    if (request == NULL) return IPP_INTERNAL_ERROR;
+
+    ippAddString(request, IPP_TAG_OPERATION, IPP_TAG_URI, "printer-uri", NULL, printer_uri);
+    ippAddString(request, IPP_TAG_OPERATION, IPP_TAG_NAME, "requesting-user-name", NULL,
+            requesting_user);
+    ippAddInteger(request, IPP_TAG_OPERATION, IPP_TAG_INTEGER, "notify-subscription-ids",
+            subscription_id);
+    ippAddInteger(request, IPP_TAG_OPERATION, IPP_TAG_INTEGER, "notify-sequence-numbers",
+            *sequence);
+    ippAddBoolean(request, IPP_TAG_OPERATION, "notify-wait", 0);
+
+    response = ipp_doCupsRequest(http, request, http_resource, printer_uri);
+    ipp_status = cupsLastError();
+    if (response == NULL || ipp_status >= IPP_BAD_REQUEST) {
+        LOGE("ipp_get_notifications(): ipp_status %d: %s", ipp_status,
+                ippErrorString(ipp_status));
+        if (ipp_status < IPP_BAD_REQUEST) ipp_status = IPP_INTERNAL_ERROR;
+    } else {
+        // Each event is its own group; a nameless attribute separates adjacent groups.
+        for (attr = ippFirstAttribute(response); attr; attr = ippNextAttribute(response)) {
+            if (ippGetGroupTag(attr) != IPP_TAG_EVENT_NOTIFICATION || ippGetName(attr) == NULL) {
+                if (event != NULL) _sort_event(event, job_id, &printer_event, &job_event);
+                event = NULL;
+                continue;
+            }
+            if (event == NULL) {
+                event = ippNew();
+                events++;
+            }
+            ippCopyAttribute(event, attr, 0);
+            if (strcmp(ippGetName(attr), "notify-sequence-number") == 0 &&
+                    ippGetInteger(attr, 0) >= *sequence) {
+                *sequence = ippGetInteger(attr, 0) + 1;
+            }
+        }
+        if (event != NULL) _sort_event(event, job_id, &printer_event, &job_event);
+
+        if (printer_event != NULL) {
+            _apply_printer_event(printer_event, printer_state_dyn);
+            ippDelete(printer_event);
+        }
+        if (job_event != NULL) {
+            _apply_job_event(job_event, job_state_dyn);
+            ippDelete(job_event);
+        }
+        LOGD("ipp_get_notifications(): %d events, next sequence %d", events, *sequence);
+    }
+
+    ippDelete(request);
+    if (response != NULL) ippDelete(response);
+    return ipp_status;
+}
+
+void ipp_cancel_subscription(http_t *http, char *http_resource, char *printer_uri,
+        int subscription_id, const char *requesting_user) {
+    ipp_t *request, *response;
+
+    request = ippNewRequest(IPP_OP_CANCEL_SUBSCRIPTION);
+    if (request == NULL) return;
+
+    ippAddString(request, IPP_TAG_OPERATION, IPP_TAG_URI, "printer-uri", NULL, printer_uri);
+    ippAddInteger(request, IPP_TAG_OPERATION, IPP_TAG_INTEGER, "notify-subscription-id",
+            subscription_id);
+    ippAddString(request, IPP_TAG_OPERATION, IPP_TAG_NAME, "requesting-user-name", NULL,
+            requesting_user);
+
+    response = ipp_doCupsRequest(http, request, http_resource, printer_uri);
+    LOGD("ipp_cancel_subscription(%d): ipp_status %d", subscription_id, cupsLastError());
+
+    ippDelete(request);
+    if (response != NULL) ippDelete(response);
+}
+
 int tryNextResourceExtension(char *printer_uri) {
     char scheme[1024];
     char username[1024];
@@ -90,7 +90,9 @@ extern void get_PrinterStateReason(ipp_t *response, ipp_pstate_t *printer_state,
 extern void parse_printerAttributes(ipp_t *response, printer_capabilities_t *capabilities);
 
 /*
- * Sets IPP version
+ * Sets the request's IPP version to the one negotiated with the printer at printer_uri, 2.0
+ * until the printer rejects it. With IPP_VERSION_UNSUPPORTED the printer is probed over http,
+ * once per session, for a version it accepts. Returns OK or ERROR.
  */
 extern status_t set_ipp_version(ipp_t *, char *, http_t *, ipp_version_state);
 
@@ -139,14 +141,58 @@ extern void getResourceFromURI(const char *uri, char *resource, int resourcelen)
 http_t *ipp_cups_connect(const wprint_connect_info_t *info, char *printer_uri,
         unsigned int uriLength);
 
+/*
+ * Returns an idle connection to printer_addr:port from the connection pool, or opens a new one
+ * if there is none. secure selects TLS. Returns NULL on failure. Connections from this and from
+ * ipp_cups_connect() must be handed back with ipp_http_release() rather than closed.
+ */
+http_t *ipp_http_acquire(const char *printer_addr, int port, bool secure);
+
+/*
+ * Returns a connection to the pool to be reused, or closes it if it is no longer usable
+ */
+void ipp_http_release(http_t *http);
+
+/*
+ * Closes all idle pooled connections
+ */
+void ipp_http_pool_flush(void);
+
 /*
  * Executes a CUPS request with the given ipp request structure
  */
 ipp_t *ipp_doCupsRequest(http_t *http, ipp_t *request, char *http_resource, char *printer_uri);
 
+/*
+ * Returns the id of the requesting user's current job, or -1 if there is none. The job's state
+ * comes back in the same request and is copied into job_state_dyn.
+ */
 extern int getJobId(http_t *http, char *http_resource, char *printer_uri,
         job_state_dyn_t *job_state_dyn, const char *requesting_user);
 
+/*
+ * Creates an ippget pull subscription for printer and job state events. Returns the
+ * subscription id, or -1 if the printer does not support event notifications.
+ */
+extern int ipp_create_subscription(http_t *http, char *http_resource, char *printer_uri,
+        const char *requesting_user);
+
+/*
+ * Fetches the events queued on subscription_id from *sequence onwards and advances *sequence.
+ * The newest printer state event is applied to printer_state_dyn and the newest state event
+ * for job_id to job_state_dyn; either is left untouched when there was no such event. An
+ * error status means the subscription is no longer usable.
+ */
+extern ipp_status_t ipp_get_notifications(http_t *http, char *http_resource, char *printer_uri,
+        int subscription_id, int *sequence, int job_id, printer_state_dyn_t *printer_state_dyn,
+        job_state_dyn_t *job_state_dyn, const char *requesting_user);
+
+/*
+ * Cancels a subscription made with ipp_create_subscription()
+ */
+extern void ipp_cancel_subscription(http_t *http, char *http_resource, char *printer_uri,
+        int subscription_id, const char *requesting_user);
+
 extern int tryNextResourceExtension(char *printer_uri);
 
 #define IPP_PREFIX "ipp"
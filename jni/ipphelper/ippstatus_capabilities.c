@@ -19,6 +19,8 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <pthread.h>
+#include <time.h>
 #include "lib_wprint.h"
 #include "ippstatus_capabilities.h"   // move these to above the calls to cups files
 #include "ipphelper.h"
@@ -28,6 +30,16 @@
 
 #define TAG "ippstatus_capabilities"
 
+// Printers whose capabilities are remembered, and how long a remembered copy may be used. A
+// copy is revalidated against the printer's change times each time it is used; a printer that
+// reports no change times cannot be revalidated, so its copy is only trusted briefly.
+#define CAPS_CACHE_SIZE 8
+#define CAPS_CACHE_TTL_MSEC (10 * 60 * 1000)
+#define CAPS_CACHE_UNVALIDATED_TTL_MSEC (60 * 1000)
+
+// Change time reported when the printer does not support the attribute
+#define NO_CHANGE_TIME (-1)
+
 /*
  * Requested printer attributes
  */
@@ -71,9 +83,38 @@ static const char *pattrs[] = {
         "media-col-ready",
         "print-scaling-supported",
         "print-scaling-default",
-        "job-pages-per-set-supported"
+        "job-pages-per-set-supported",
+        "operations-supported",
+        "compression-supported",
+        "printer-config-change-time",
+        "printer-state-change-time"
+};
+
+/*
+ * Attributes requested to revalidate cached capabilities
+ */
+static const char *change_time_attrs[] = {
+        "printer-config-change-time",
+        "printer-state-change-time"
 };
 
+/*
+ * Capabilities of a printer as parsed from its last full response, keyed by printer URI
+ */
+typedef struct {
+    bool valid;
+    char printer_uri[MAX_URI_LENGTH + 1];
+    int config_change_time;
+    int state_change_time;
+    struct timespec fetched;
+    struct timespec last_used;
+    printer_capabilities_t capabilities;
+} caps_cache_entry_t;
+
+static caps_cache_entry_t _caps_cache[CAPS_CACHE_SIZE];
+static pthread_mutex_t _caps_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static unsigned int _caps_cache_hits, _caps_cache_misses;
+
 static void _init(const ifc_printer_capabilities_t *this_p,
         const wprint_connect_info_t *info);
 
@@ -118,8 +159,8 @@ static void _init(const ifc_printer_capabilities_t *this_p,
         caps = IMPL(ipp_capabilities_t, ifc, this_p);
 
         if (caps->http != NULL) {
-            LOGD("_init(): http != NULL closing HTTP");
-            httpClose(caps->http);
+            LOGD("_init(): http != NULL releasing HTTP");
+            ipp_http_release(caps->http);
         }
 
         caps->http = ipp_cups_connect(connect_info, caps->printer_caps.printerUri,
@@ -131,6 +172,173 @@ static void _init(const ifc_printer_capabilities_t *this_p,
     } while (0);
 }
 
+/*
+ * Returns milliseconds elapsed on the monotonic clock since start
+ */
+static long _elapsed_msec(const struct timespec *start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return ((now.tv_sec - start->tv_sec) * 1000L) + ((now.tv_nsec - start->tv_nsec) / 1000000L);
+}
+
+/*
+ * Reads the printer's change times from a response, NO_CHANGE_TIME for any it lacks
+ */
+static void _read_change_times(ipp_t *response, int *config_change_time,
+        int *state_change_time) {
+    ipp_attribute_t *attrptr;
+
+    *config_change_time = *state_change_time = NO_CHANGE_TIME;
+    if ((attrptr = ippFindAttribute(response, "printer-config-change-time",
+            IPP_TAG_INTEGER)) != NULL) {
+        *config_change_time = ippGetInteger(attrptr, 0);
+    }
+    if ((attrptr = ippFindAttribute(response, "printer-state-change-time",
+            IPP_TAG_INTEGER)) != NULL) {
+        *state_change_time = ippGetInteger(attrptr, 0);
+    }
+}
+
+/*
+ * Asks the printer for its change times alone. Returns OK or ERROR.
+ */
+static status_t _get_change_times(ipp_capabilities_t *caps, int *config_change_time,
+        int *state_change_time) {
+    ipp_t *request, *response;
+    ipp_status_t ipp_status;
+    status_t result = ERROR;
+
+    request = ippNewRequest(IPP_GET_PRINTER_ATTRIBUTES);
+    ippAddString(request, IPP_TAG_OPERATION, IPP_TAG_URI, "printer-uri", NULL,
+            caps->printer_caps.printerUri);
+    ippAddStrings(request, IPP_TAG_OPERATION, IPP_TAG_KEYWORD, "requested-attributes",
+            sizeof(change_time_attrs) / sizeof(change_time_attrs[0]), NULL, change_time_attrs);
+
+    response = ipp_doCupsRequest(caps->http, request, caps->printer_caps.httpResource,
+            caps->printer_caps.printerUri);
+    if (response != NULL) {
+        ipp_status = cupsLastError();
+        if ((ipp_status >= IPP_OK) && (ipp_status < IPP_REDIRECTION_OTHER_SITE)) {
+            _read_change_times(response, config_change_time, state_change_time);
+            result = OK;
+        }
+    }
+    ippDelete(response);
+    ippDelete(request);
+    return result;
+}
+
+/*
+ * Returns the cache entry for printer_uri, or NULL. Must be called with _caps_cache_lock held.
+ */
+static caps_cache_entry_t *_caps_cache_find(const char *printer_uri) {
+    int i;
+    for (i = 0; i < CAPS_CACHE_SIZE; i++) {
+        if (_caps_cache[i].valid && (strcmp(_caps_cache[i].printer_uri, printer_uri) == 0)) {
+            return &_caps_cache[i];
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Fills capabilities from the cache if the printer's change times show the cached copy is still
+ * current. Returns true on a hit.
+ */
+static bool _caps_cache_lookup(ipp_capabilities_t *caps, printer_capabilities_t *capabilities) {
+    caps_cache_entry_t *entry;
+    int cached_config_time = NO_CHANGE_TIME, cached_state_time = NO_CHANGE_TIME;
+    int config_time, state_time;
+    long age = CAPS_CACHE_TTL_MSEC + 1;
+    bool hit = false;
+
+    pthread_mutex_lock(&_caps_cache_lock);
+    if ((entry = _caps_cache_find(caps->printer_caps.printerUri)) != NULL) {
+        cached_config_time = entry->config_change_time;
+        cached_state_time = entry->state_change_time;
+        age = _elapsed_msec(&entry->fetched);
+    }
+    pthread_mutex_unlock(&_caps_cache_lock);
+
+    config_time = cached_config_time;
+    state_time = cached_state_time;
+    if ((age > CAPS_CACHE_TTL_MSEC) || ((cached_config_time == NO_CHANGE_TIME) &&
+            (cached_state_time == NO_CHANGE_TIME) && (age > CAPS_CACHE_UNVALIDATED_TTL_MSEC))) {
+        entry = NULL;
+    } else if (((cached_config_time != NO_CHANGE_TIME) || (cached_state_time != NO_CHANGE_TIME))
+            && (_get_change_times(caps, &config_time, &state_time) != OK)) {
+        entry = NULL;
+    }
+
+    pthread_mutex_lock(&_caps_cache_lock);
+    // the entry may have been refreshed or replaced while the printer was asked
+    if (entry != NULL) {
+        entry = _caps_cache_find(caps->printer_caps.printerUri);
+    }
+    if ((entry != NULL) && (entry->config_change_time == config_time) &&
+            (entry->state_change_time == state_time)) {
+        memcpy(capabilities, &entry->capabilities, sizeof(printer_capabilities_t));
+        clock_gettime(CLOCK_MONOTONIC, &entry->last_used);
+        hit = true;
+    }
+    if (hit) {
+        _caps_cache_hits++;
+    } else {
+        _caps_cache_misses++;
+    }
+    LOGD("_caps_cache_lookup(): %s (hits %u, misses %u)", hit ? "hit" : "miss",
+            _caps_cache_hits, _caps_cache_misses);
+    pthread_mutex_unlock(&_caps_cache_lock);
+    return hit;
+}
+
+/*
+ * Remembers freshly parsed capabilities for the printer, replacing the least recently used
+ * entry when the cache is full
+ */
+static void _caps_cache_store(const char *printer_uri, const printer_capabilities_t *capabilities,
+        ipp_t *response) {
+    caps_cache_entry_t *entry;
+    int i;
+
+    pthread_mutex_lock(&_caps_cache_lock);
+    if ((entry = _caps_cache_find(printer_uri)) == NULL) {
+        entry = &_caps_cache[0];
+        for (i = 0; i < CAPS_CACHE_SIZE; i++) {
+            if (!_caps_cache[i].valid) {
+                entry = &_caps_cache[i];
+                break;
+            }
+            if ((_caps_cache[i].last_used.tv_sec < entry->last_used.tv_sec) ||
+                    ((_caps_cache[i].last_used.tv_sec == entry->last_used.tv_sec) &&
+                    (_caps_cache[i].last_used.tv_nsec < entry->last_used.tv_nsec))) {
+                entry = &_caps_cache[i];
+            }
+        }
+        strncpy(entry->printer_uri, printer_uri, MAX_URI_LENGTH);
+        entry->printer_uri[MAX_URI_LENGTH] = '\0';
+    }
+    _read_change_times(response, &entry->config_change_time, &entry->state_change_time);
+    memcpy(&entry->capabilities, capabilities, sizeof(printer_capabilities_t));
+    clock_gettime(CLOCK_MONOTONIC, &entry->fetched);
+    entry->last_used = entry->fetched;
+    entry->valid = true;
+    pthread_mutex_unlock(&_caps_cache_lock);
+}
+
+/*
+ * Forgets the printer's capabilities
+ */
+static void _caps_cache_remove(const char *printer_uri) {
+    caps_cache_entry_t *entry;
+
+    pthread_mutex_lock(&_caps_cache_lock);
+    if ((entry = _caps_cache_find(printer_uri)) != NULL) {
+        entry->valid = false;
+    }
+    pthread_mutex_unlock(&_caps_cache_lock);
+}
+
 static status_t _get_capabilities(const ifc_printer_capabilities_t *this_p,
         printer_capabilities_t *capabilities) {
     LOGD("_get_capabilities: Enter");
@@ -158,6 +366,13 @@ static status_t _get_capabilities(const ifc_printer_capabilities_t *this_p,
             break;
         }
 
+        if ((capabilities != NULL) && _caps_cache_lookup(caps, capabilities)) {
+            LOGD("_get_capabilities: %s unchanged, using cached capabilities",
+                    caps->printer_caps.printerUri);
+            result = OK;
+            break;
+        }
+
         request = ippNewRequest(op);
 
         ippAddString(request, IPP_TAG_OPERATION, IPP_TAG_URI, "printer-uri", NULL,
@@ -198,8 +413,12 @@ static status_t _get_capabilities(const ifc_printer_capabilities_t *this_p,
 
         if (ipp_status >= IPP_OK && ipp_status < IPP_REDIRECTION_OTHER_SITE && response != NULL) {
             result = OK;
+            if (capabilities != NULL) {
+                _caps_cache_store(caps->printer_caps.printerUri, capabilities, response);
+            }
         } else {
             result = ERROR;
+            _caps_cache_remove(caps->printer_caps.printerUri);
         }
     } while (0);
 
@@ -225,7 +444,7 @@ static void _destroy(const ifc_printer_capabilities_t *this_p) {
 
         caps = IMPL(ipp_capabilities_t, ifc, this_p);
         if (caps->http != NULL) {
-            httpClose(caps->http);
+            ipp_http_release(caps->http);
         }
         free(caps);
     } while (0);
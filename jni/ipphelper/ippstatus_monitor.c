@@ -24,6 +24,8 @@
 #include <stdio.h>
 #include <semaphore.h>
 #include <fcntl.h>
+#include <errno.h>
+#include <time.h>
 
 #include "lib_wprint.h"
 #include "ippstatus_monitor.h"
@@ -36,6 +38,21 @@
 
 #define TAG "ippstatus_monitor"
 
+/*
+ * Polling starts fast and backs off by doubling while nothing changes; any change drops it back
+ * to the minimum. A running job is watched more closely than an idle printer so its end is
+ * noticed promptly.
+ */
+#define MONITOR_INTERVAL_MIN_MSEC 250
+#define MONITOR_JOB_INTERVAL_MAX_MSEC 2000
+#define MONITOR_INTERVAL_MAX_MSEC 5000
+
+// Cap while still searching for the job, which may take a while to show up
+#define MONITOR_SEEK_INTERVAL_MAX_MSEC 1000
+
+// With event notifications, state is still polled after this long without an event
+#define MONITOR_VERIFY_MSEC 10000
+
 static void _init(const ifc_status_monitor_t *this_p, const wprint_connect_info_t *);
 
 static void _get_status(const ifc_status_monitor_t *this_p, printer_state_dyn_t *printer_state_dyn);
@@ -47,6 +64,8 @@ static void _start(const ifc_status_monitor_t *this_p, void (*status_cb)(
 
 static void _stop(const ifc_status_monitor_t *this_p);
 
+static void _set_job_id(const ifc_status_monitor_t *this_p, int job_id);
+
 static status_t _cancel(const ifc_status_monitor_t *this_p, const char *requesting_user);
 
 static void _destroy(const ifc_status_monitor_t *this_p);
@@ -55,7 +74,8 @@ static void _get_job_state(const ifc_status_monitor_t *this_p, job_state_dyn_t *
         int job_id);
 
 static const ifc_status_monitor_t _status_ifc = {.init = _init, .get_status = _get_status,
-        .cancel = _cancel, .start = _start, .stop = _stop, .destroy = _destroy,};
+        .cancel = _cancel, .start = _start, .stop = _stop, .destroy = _destroy,
+        .set_job_id = _set_job_id,};
 
 typedef struct {
     unsigned char initialized;
@@ -69,8 +89,22 @@ typedef struct {
     pthread_mutexattr_t mutexattr;
     ifc_status_monitor_t ifc;
     char requesting_user[1024];
+
+    // The printer's id for the job being followed, -1 until _set_job_id() provides it
+    volatile int job_id;
+
+    // Event subscription used in place of polling, 0 when there is none
+    int subscription_id;
+    int notify_sequence;
 } ipp_monitor_t;
 
+static void _subscribe(ipp_monitor_t *monitor);
+
+static int _get_events(ipp_monitor_t *monitor, printer_state_dyn_t *printer_state_dyn,
+        job_state_dyn_t *job_state_dyn, int job_id);
+
+static void _wait(ipp_monitor_t *monitor, int msec);
+
 const ifc_status_monitor_t *ipp_status_get_monitor_ifc(const ifc_wprint_t *wprint_ifc) {
     ipp_monitor_t *monitor = (ipp_monitor_t *) malloc(sizeof(ipp_monitor_t));
 
@@ -99,7 +133,7 @@ static void _init(const ifc_status_monitor_t *this_p, const wprint_connect_info_
         }
 
         if (monitor->http != NULL) {
-            httpClose(monitor->http);
+            ipp_http_release(monitor->http);
         }
 
         monitor->http = ipp_cups_connect(connect_info, monitor->printer_uri,
@@ -108,6 +142,9 @@ static void _init(const ifc_status_monitor_t *this_p, const wprint_connect_info_
 
         monitor->monitor_running = 0;
         monitor->stop_monitor = 0;
+        monitor->job_id = -1;
+        monitor->subscription_id = 0;
+        monitor->notify_sequence = 1;
 
         pthread_mutexattr_init(&monitor->mutexattr);
         pthread_mutexattr_settype(&(monitor->mutexattr), PTHREAD_MUTEX_RECURSIVE_NP);
@@ -137,7 +174,7 @@ static void _destroy(const ifc_status_monitor_t *this_p) {
         }
 
         if (monitor->http != NULL) {
-            httpClose(monitor->http);
+            ipp_http_release(monitor->http);
         }
 
         free(monitor);
@@ -193,7 +230,7 @@ static void _start(const ifc_status_monitor_t *this_p,
                 const printer_state_dyn_t *old_status, void *status_param),
         void (*job_state_cb)(const job_state_dyn_t *new_state, void *param),
         void *param) {
-    int i, job_id = -1;
+    int i, job_id = -1, known_job_id = -1;
     printer_state_dyn_t last_status, curr_status;
     job_state_dyn_t old_state, new_state;
     ipp_monitor_t *monitor = NULL;
@@ -252,7 +289,9 @@ static void _start(const ifc_status_monitor_t *this_p,
             if (status_cb != NULL) {
                 (*status_cb)(&curr_status, &last_status, param);
             }
-            sem_wait(&monitor->monitor_sem);
+            while (!monitor->stop_monitor) {
+                sem_wait(&monitor->monitor_sem);
+            }
 
             last_status.printer_status = PRINT_STATUS_UNKNOWN;
             last_status.printer_reasons[0] = PRINT_STATUS_SHUTTING_DOWN;
@@ -260,34 +299,88 @@ static void _start(const ifc_status_monitor_t *this_p,
             curr_status.printer_status = PRINT_STATUS_UNKNOWN;
             curr_status.printer_reasons[0] = PRINT_STATUS_SHUTTING_DOWN;
         } else {
+            int interval = MONITOR_INTERVAL_MIN_MSEC;
+            int max_interval = (job_state_cb != NULL) ? MONITOR_JOB_INTERVAL_MAX_MSEC
+                    : MONITOR_INTERVAL_MAX_MSEC;
+            int printer_polled = 0, job_polled = 0, quiet_msec = 0;
+            int ticks = 0, changes = 0, event_ticks = 0;
+
+            // Printer and job events for the whole job then come back in one request per tick
+            if (job_state_cb != NULL) {
+                pthread_mutex_lock(&monitor->mutex);
+                _subscribe(monitor);
+                pthread_mutex_unlock(&monitor->mutex);
+            }
+
             while (!monitor->stop_monitor) {
+                int changed = 0;
+                int verify = !printer_polled || (quiet_msec >= MONITOR_VERIFY_MSEC);
+                ticks++;
+
                 pthread_mutex_lock(&monitor->mutex);
-                _get_status(this_p, &curr_status);
+                if (monitor->job_id != known_job_id) {
+                    // A new job to follow. Its state is read directly before events take over.
+                    known_job_id = job_id = monitor->job_id;
+                    job_polled = 0;
+                    changed = 1;
+                }
+                if (!verify && _get_events(monitor, &curr_status, &new_state, job_id)) {
+                    event_ticks++;
+                } else {
+                    _get_status(this_p, &curr_status);
+                    printer_polled = 1;
+                    job_polled = 0;
+                }
                 pthread_mutex_unlock(&monitor->mutex);
                 if ((status_cb != NULL) &&
                         (memcmp(&curr_status, &last_status, sizeof(printer_state_dyn_t)) != 0)) {
                     (*status_cb)(&curr_status, &last_status, param);
                     memcpy(&last_status, &curr_status, sizeof(printer_state_dyn_t));
+                    changed = 1;
                 }
 
                 // Do not call for job state if thread has been stopped
                 if (job_state_cb != NULL && !monitor->stop_monitor) {
-                    pthread_mutex_lock(&monitor->mutex);
-                    if (job_id == -1) {
+                    if (known_job_id == -1) {
+                        // Until the print interface reports the id, search the queue for the
+                        // user's job. Finding it brings its state along.
+                        pthread_mutex_lock(&monitor->mutex);
                         job_id = getJobId(monitor->http, monitor->http_resource,
-                                          monitor->printer_uri, &new_state,
-                                          monitor->requesting_user);
+                                monitor->printer_uri, &new_state, monitor->requesting_user);
+                        pthread_mutex_unlock(&monitor->mutex);
+                    } else if (!job_polled) {
+                        _get_job_state(this_p, &new_state, job_id);
+                        job_polled = (monitor->subscription_id != 0);
                     }
-                    _get_job_state(this_p, &new_state, job_id);
-                    pthread_mutex_unlock(&monitor->mutex);
 
                     if (memcmp(&new_state, &old_state, sizeof(job_state_dyn_t)) != 0) {
                         (*job_state_cb)(&new_state, param);
                         memcpy(&old_state, &new_state, sizeof(job_state_dyn_t));
+                        changed = 1;
                     }
                 }
-                sleep(1);
+
+                if (changed) {
+                    changes++;
+                    interval = MONITOR_INTERVAL_MIN_MSEC;
+                } else {
+                    interval = MIN(interval * 2, ((job_state_cb != NULL) && (known_job_id == -1))
+                            ? MONITOR_SEEK_INTERVAL_MAX_MSEC : max_interval);
+                }
+                quiet_msec = (changed || verify) ? 0 : quiet_msec + interval;
+                _wait(monitor, interval);
             }
+
+            pthread_mutex_lock(&monitor->mutex);
+            if (monitor->subscription_id != 0) {
+                ipp_cancel_subscription(monitor->http, monitor->http_resource,
+                        monitor->printer_uri, monitor->subscription_id,
+                        monitor->requesting_user);
+                monitor->subscription_id = 0;
+            }
+            pthread_mutex_unlock(&monitor->mutex);
+            LOGI("_start(): %d ticks, %d changes, %d served by event notifications", ticks,
+                    changes, event_ticks);
         }
         monitor->monitor_running = 0;
     } while (0);
@@ -311,8 +404,30 @@ static void _stop(const ifc_status_monitor_t *this_p) {
             continue;
         }
 
-        sem_post(&monitor->monitor_sem);
+        // Set the flag first so the woken monitor thread sees it
         monitor->stop_monitor = 1;
+        sem_post(&monitor->monitor_sem);
+    } while (0);
+}
+
+/*
+ * Records the job to follow and wakes the monitor so it looks at the job right away
+ */
+static void _set_job_id(const ifc_status_monitor_t *this_p, int job_id) {
+    ipp_monitor_t *monitor;
+    LOGD("_set_job_id(): %d", job_id);
+    do {
+        if (this_p == NULL) {
+            continue;
+        }
+
+        monitor = IMPL(ipp_monitor_t, ifc, this_p);
+        if (!monitor->initialized) {
+            continue;
+        }
+
+        monitor->job_id = job_id;
+        sem_post(&monitor->monitor_sem);
     } while (0);
 }
 
@@ -334,6 +449,12 @@ static status_t _cancel(const ifc_status_monitor_t *this_p, const char *requesti
                 break;
             }
 
+            // Only search the queue when the printer has not told us which job is ours
+            if (monitor->job_id != -1) {
+                job_id = monitor->job_id;
+                break;
+            }
+
             request = ippNewRequest(IPP_GET_JOBS);
             if (request == NULL) {
                 break;
@@ -469,4 +590,56 @@ static void _get_job_state(const ifc_status_monitor_t *this_p, job_state_dyn_t *
         } while (0);
         pthread_mutex_unlock(&monitor->mutex);
     }
-}
\ No newline at end of file
+}
+
+/*
+ * Subscribes to printer and job state events if the printer supports ippget notifications
+ */
+static void _subscribe(ipp_monitor_t *monitor) {
+    int subscription_id = ipp_create_subscription(monitor->http, monitor->http_resource,
+            monitor->printer_uri, monitor->requesting_user);
+    monitor->subscription_id = (subscription_id > 0) ? subscription_id : 0;
+    monitor->notify_sequence = 1;
+}
+
+/*
+ * Applies the events received since the last call. Returns 0 if there is no usable
+ * subscription, in which case the caller polls instead.
+ */
+static int _get_events(ipp_monitor_t *monitor, printer_state_dyn_t *printer_state_dyn,
+        job_state_dyn_t *job_state_dyn, int job_id) {
+    ipp_status_t ipp_status;
+
+    if (monitor->subscription_id == 0 || monitor->stop_monitor) {
+        return 0;
+    }
+
+    ipp_status = ipp_get_notifications(monitor->http, monitor->http_resource,
+            monitor->printer_uri, monitor->subscription_id, &monitor->notify_sequence, job_id,
+            printer_state_dyn, job_state_dyn, monitor->requesting_user);
+    if (ipp_status >= IPP_BAD_REQUEST) {
+        // The lease ran out or the printer dropped it; polling takes over from here
+        LOGD("_get_events(): subscription %d lost, polling", monitor->subscription_id);
+        monitor->subscription_id = 0;
+        return 0;
+    }
+    return 1;
+}
+
+/*
+ * Sleeps for msec or until _stop() posts the monitor semaphore
+ */
+static void _wait(ipp_monitor_t *monitor, int msec) {
+    struct timespec timeout;
+
+    clock_gettime(CLOCK_REALTIME, &timeout);
+    timeout.tv_sec += msec / 1000;
+    timeout.tv_nsec += (msec % 1000) * 1000000L;
+    if (timeout.tv_nsec >= 1000000000L) {
+        timeout.tv_sec++;
+        timeout.tv_nsec -= 1000000000L;
+    }
+
+    while ((sem_timedwait(&monitor->monitor_sem, &timeout) == -1) && (errno == EINTR)) {
+    }
+}
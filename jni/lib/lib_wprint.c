@@ -20,6 +20,7 @@
 #include <stdlib.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <unistd.h>
 
 #ifndef _GNU_SOURCE
 #define _GNU_SOURCE
@@ -31,6 +32,8 @@
 #include <pthread.h>
 
 #include <semaphore.h>
+#include <stdatomic.h>
+#include <time.h>
 #include <printer_capabilities_types.h>
 
 #include "ifc_print_job.h"
@@ -66,10 +69,19 @@
 #define _MAX_SPOOLED_JOBS     100
 #define _MAX_MSGS             (_MAX_SPOOLED_JOBS * 5)
 
+// Number of jobs that may run at once, each on a different printer
+#define _MAX_CONCURRENT_JOBS  4
+
 #define _MAX_PAGES_PER_JOB   1000
 
+// How long wprintPage() waits for room in a full page queue before failing
+#define _PAGE_SEND_TIMEOUT_MSEC  5000
+
 #define MAX_IDLE_WAIT        (5 * 60)
 
+// A waiting job gains one priority level for each interval it spends in the spool
+#define _PRIORITY_AGING_MSEC (30 * 1000)
+
 #define DEFAULT_RESOLUTION   (300)
 
 // When searching for a supported resolution this is the max resolution we will consider.
@@ -87,7 +99,8 @@
  */
 
 // _ENCODE_HANDLE() is only called from _get_handle()
-#define _ENCODE_HANDLE(X) ( (((++_running_number) & 0xffffff) << 8) | ((X) & 0xff) )
+#define _ENCODE_HANDLE(X) \
+        ( (((atomic_fetch_add(&_running_number, 1) + 1) & 0xffffff) << 8) | ((X) & 0xff) )
 #define _DECODE_HANDLE(X) ((X) & 0xff)
 
 #undef snprintf
@@ -150,6 +163,9 @@ typedef struct {
     bool use_secure_uri;
 
     const ifc_status_monitor_t *status_ifc;
+
+    // The printer's id for the job, -1 until the print interface reports it
+    int remote_job_id;
     char debug_path[MAX_PATHNAME_LENGTH + 1];
     char printer_uri[1024];
     int job_debug_fd;
@@ -158,8 +174,36 @@ typedef struct {
     /* A buffer of bytes containing the certificate received while setting up this job, if any. */
     uint8 *certificate;
     int certificate_len;
+
+    printer_capabilities_t printer_caps;
+    struct timespec cancel_time;
+    pthread_t job_status_tid;
+
+    // While _run_job() waits for the printer to be ready, the status thread only stores each new
+    // printer state in ready_state and signals the job's event. The job is still QUEUED but
+    // already claimed, so a cancel leaves its teardown to _run_job().
+    bool awaiting_ready;
+    bool ready_state_new;
+    printer_state_dyn_t ready_state;
+    sem_t job_start_wait_sem;
+    sem_t job_end_wait_sem;
 } _job_queue_t;
 
+/*
+ * Scheduling state of a job queue entry, guarded by _q_lock. This is kept apart from
+ * _job_queue_t so the scheduler never reads an entry that is being refilled for a new job.
+ */
+typedef struct {
+    wJob_t job_handle;
+    unsigned long printer_hash;
+    unsigned long run_seq;
+    int priority;
+    uint64 cost;
+    struct timespec queued;
+    bool run_pending;
+    bool running;
+} _job_sched_t;
+
 /*
  * An entry for queued pages
  */
@@ -184,23 +228,39 @@ typedef struct {
 } _io_plugin_t;
 
 static _job_queue_t _job_queue[_MAX_SPOOLED_JOBS];
+
+/*
+ * Each entry of _job_queue is guarded by its own recursive lock, so status callbacks and page
+ * submission for one job do not contend with other jobs. Entries are claimed and released
+ * through _job_slots without any lock.
+ */
+static pthread_mutex_t _job_locks[_MAX_SPOOLED_JOBS];
+
+// Signalled on a job's lock when the job is cancelled, wprint is stopping or, while the job waits
+// for the printer to be ready, the printer's state changes
+static pthread_cond_t _job_events[_MAX_SPOOLED_JOBS];
+static atomic_int _job_slots[_MAX_SPOOLED_JOBS];
+static atomic_ulong _running_number;
+
+static _job_sched_t _job_sched[_MAX_SPOOLED_JOBS];
 static msg_q_id _msgQ;
 
-static pthread_t _job_status_tid;
 static pthread_t _job_tid;
+static pthread_t _worker_tids[_MAX_CONCURRENT_JOBS];
 
+// guards _job_sched, never taken before a job lock
 static pthread_mutex_t _q_lock;
 static pthread_mutexattr_t _q_lock_attr;
 
-static sem_t _job_end_wait_sem;
-static sem_t _job_start_wait_sem;
+// signalled under _q_lock when a job becomes runnable or a printer becomes free
+static pthread_cond_t _run_cond;
+static unsigned long _run_seq = 0;
+static wprint_sched_policy_t _sched_policy = WPRINT_SCHED_FIFO;
 
 static _io_plugin_t _io_plugins[2];
 
 static volatile bool stop_run = false;
 
-static printer_capabilities_t g_printer_caps = {0};
-
 char g_osName[MAX_ID_STRING_LENGTH + 1] = {0};
 char g_appName[MAX_ID_STRING_LENGTH + 1] = {0};
 char g_appVersion[MAX_ID_STRING_LENGTH + 1] = {0};
@@ -224,7 +284,8 @@ static char *getPCLTypeString(pcl_t pclenum) {
 }
 
 /*
- * Return a _job_queue_t item by its job_handle or NULL if not found.
+ * Return a _job_queue_t item by its job_handle or NULL if not found. The entry should be locked
+ * by the caller, see _lock_job_desc().
  */
 static _job_queue_t *_get_job_desc(wJob_t job_handle) {
     unsigned long index;
@@ -409,32 +470,108 @@ static const ifc_print_job_t *_get_print_ifc(port_t port_num) {
 }
 
 /*
- * Lock the semaphore for this module
+ * Lock the scheduler state of this module
  */
 static void _lock(void) {
     pthread_mutex_lock(&_q_lock);
 }
 
 /*
- * Unlock the semaphore for this module
+ * Unlock the scheduler state of this module
  */
 static void _unlock(void) {
     pthread_mutex_unlock(&_q_lock);
 }
 
+/*
+ * Lock a single job queue entry
+ */
+static void _lock_job(_job_queue_t *jq) {
+    pthread_mutex_lock(&_job_locks[jq - _job_queue]);
+}
+
+/*
+ * Unlock a single job queue entry
+ */
+static void _unlock_job(_job_queue_t *jq) {
+    pthread_mutex_unlock(&_job_locks[jq - _job_queue]);
+}
+
+/*
+ * Wake anything waiting on events for this job entry
+ */
+static void _signal_job(_job_queue_t *jq) {
+    pthread_cond_broadcast(&_job_events[jq - _job_queue]);
+}
+
+/*
+ * Wait up to msec for an event on this job entry. The entry must be locked exactly once by the
+ * caller; the lock is released while waiting and held again on return.
+ */
+static void _wait_job_event(_job_queue_t *jq, int msec) {
+    struct timespec deadline;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += msec / 1000;
+    deadline.tv_nsec += (msec % 1000) * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+    pthread_cond_timedwait(&_job_events[jq - _job_queue], &_job_locks[jq - _job_queue],
+            &deadline);
+}
+
+/*
+ * Returns the number of milliseconds elapsed on the monotonic clock since start
+ */
+static long _msec_since(const struct timespec *start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return ((now.tv_sec - start->tv_sec) * 1000L) + ((now.tv_nsec - start->tv_nsec) / 1000000L);
+}
+
+/*
+ * Return the job queue entry for job_handle locked, or NULL if not found. The caller must
+ * release it with _unlock_job().
+ */
+static _job_queue_t *_lock_job_desc(wJob_t job_handle) {
+    unsigned long index = _DECODE_HANDLE(job_handle);
+    _job_queue_t *jq;
+
+    if ((job_handle == WPRINT_BAD_JOB_HANDLE) || (index >= _MAX_SPOOLED_JOBS)) {
+        return NULL;
+    }
+
+    pthread_mutex_lock(&_job_locks[index]);
+    jq = _get_job_desc(job_handle);
+    if (jq == NULL) {
+        pthread_mutex_unlock(&_job_locks[index]);
+    }
+    return jq;
+}
+
+/*
+ * Claim a free job queue entry and return its new handle. Entries are claimed with a
+ * compare-and-swap on _job_slots so no lock is needed to find one.
+ */
 static wJob_t _get_handle(void) {
-    static unsigned long _running_number = 0;
+    unsigned long start = atomic_load(&_running_number);
     wJob_t job_handle = WPRINT_BAD_JOB_HANDLE;
     int i, index, size;
     char *ptr;
 
     for (i = 0; i < _MAX_SPOOLED_JOBS; i++) {
-        index = (i + _running_number) % _MAX_SPOOLED_JOBS;
+        int expected = 0;
+        index = (i + start) % _MAX_SPOOLED_JOBS;
 
-        if (_job_queue[index].job_state == JOB_STATE_FREE) {
+        if (atomic_compare_exchange_strong(&_job_slots[index], &expected, 1)) {
             size = MAX_MIME_LENGTH + MAX_PRINTER_ADDR_LENGTH + MAX_PATHNAME_LENGTH + 4;
             ptr = malloc(size);
-            if (ptr) {
+            if (ptr == NULL) {
+                atomic_store(&_job_slots[index], 0);
+            } else {
+                // the previous owner may still hold the entry lock while releasing it
+                pthread_mutex_lock(&_job_locks[index]);
                 memset(&_job_queue[index], 0, sizeof(_job_queue_t));
                 memset(ptr, 0, size);
 
@@ -449,8 +586,12 @@ static wJob_t _get_handle(void) {
 
                 _job_queue[index].job_state = JOB_STATE_QUEUED;
                 _job_queue[index].job_handle = _ENCODE_HANDLE(index);
+                _job_queue[index].job_status_tid = pthread_self();
+                sem_init(&_job_queue[index].job_start_wait_sem, 0, 0);
+                sem_init(&_job_queue[index].job_end_wait_sem, 0, 0);
 
                 job_handle = _job_queue[index].job_handle;
+                pthread_mutex_unlock(&_job_locks[index]);
             }
             break;
         }
@@ -458,6 +599,9 @@ static wJob_t _get_handle(void) {
     return job_handle;
 }
 
+/*
+ * Free a finished job. Must be called with the job locked.
+ */
 static int _recycle_handle(wJob_t job_handle) {
     _job_queue_t *jq = _get_job_desc(job_handle);
 
@@ -495,6 +639,11 @@ static int _recycle_handle(wJob_t job_handle) {
             free(jq->certificate);
             jq->certificate = NULL;
         }
+        sem_destroy(&jq->job_start_wait_sem);
+        sem_destroy(&jq->job_end_wait_sem);
+
+        // hand the entry back to _get_handle()
+        atomic_store(&_job_slots[jq - _job_queue], 0);
         return OK;
     } else {
         return ERROR;
@@ -505,12 +654,12 @@ static int _recycle_handle(wJob_t job_handle) {
  * Stops the job status thread if it exists
  */
 static int _stop_status_thread(_job_queue_t *jq) {
-    if (!pthread_equal(_job_status_tid, pthread_self()) && (jq && jq->status_ifc)) {
+    if (jq && !pthread_equal(jq->job_status_tid, pthread_self()) && jq->status_ifc) {
         (jq->status_ifc->stop)(jq->status_ifc);
-        _unlock();
-        pthread_join(_job_status_tid, 0);
-        _lock();
-        _job_status_tid = pthread_self();
+        _unlock_job(jq);
+        pthread_join(jq->job_status_tid, 0);
+        _lock_job(jq);
+        jq->job_status_tid = pthread_self();
         return OK;
     } else {
         return ERROR;
@@ -528,6 +677,19 @@ static void _job_status_callback(const printer_state_dyn_t *new_status,
     unsigned int i, blocked_reasons;
     print_status_t statusnew, statusold;
 
+    _lock_job(jq);
+    if (jq->awaiting_ready) {
+        // _run_job() handles the state itself. The monitor's placeholder state is not news.
+        if (new_status->printer_reasons[0] != PRINT_STATUS_INITIALIZING) {
+            memcpy(&jq->ready_state, new_status, sizeof(printer_state_dyn_t));
+            jq->ready_state_new = true;
+            _signal_job(jq);
+        }
+        _unlock_job(jq);
+        return;
+    }
+    _unlock_job(jq);
+
     statusnew = new_status->printer_status & ~PRINTER_IDLE_BIT;
     statusold = old_status->printer_status & ~PRINTER_IDLE_BIT;
     cb_param.certificate = jq->certificate;
@@ -547,14 +709,14 @@ static void _job_status_callback(const printer_state_dyn_t *new_status,
         case PRINT_STATUS_UNKNOWN:
             if ((new_status->printer_reasons[0] == PRINT_STATUS_OFFLINE)
                     || (new_status->printer_reasons[0] == PRINT_STATUS_UNKNOWN)) {
-                sem_post(&_job_start_wait_sem);
-                sem_post(&_job_end_wait_sem);
-                _lock();
+                sem_post(&jq->job_start_wait_sem);
+                sem_post(&jq->job_end_wait_sem);
+                _lock_job(jq);
                 if ((new_status->printer_reasons[0] == PRINT_STATUS_OFFLINE)
                         && ((jq->print_ifc != NULL) && (jq->print_ifc->enable_timeout != NULL))) {
                     jq->print_ifc->enable_timeout(jq->print_ifc, 1);
                 }
-                _unlock();
+                _unlock_job(jq);
             }
             break;
 
@@ -564,37 +726,37 @@ static void _job_status_callback(const printer_state_dyn_t *new_status,
                 if (jq->is_dir && !jq->last_page_seen) {
                     wprintPage(jq->job_handle, jq->num_pages + 1, NULL, true, false, 0, 0, 0, 0);
                 }
-                sem_post(&_job_end_wait_sem);
+                sem_post(&jq->job_end_wait_sem);
             }
             break;
 
         case PRINT_STATUS_CANCELLED:
-            sem_post(&_job_start_wait_sem);
+            sem_post(&jq->job_start_wait_sem);
             if ((jq->print_ifc != NULL) && (jq->print_ifc->enable_timeout != NULL)) {
                 jq->print_ifc->enable_timeout(jq->print_ifc, 1);
             }
             if (statusold != PRINT_STATUS_CANCELLED) {
                 LOGI("status requested job cancel");
                 if (new_status->printer_reasons[0] == PRINT_STATUS_OFFLINE) {
-                    sem_post(&_job_start_wait_sem);
-                    sem_post(&_job_end_wait_sem);
+                    sem_post(&jq->job_start_wait_sem);
+                    sem_post(&jq->job_end_wait_sem);
                     if ((jq->print_ifc != NULL) && (jq->print_ifc->enable_timeout != NULL)) {
                         jq->print_ifc->enable_timeout(jq->print_ifc, 1);
                     }
                 }
-                _lock();
+                _lock_job(jq);
                 jq->job_params.cancelled = true;
-                _unlock();
+                _unlock_job(jq);
             }
             if (new_status->printer_reasons[0] == PRINT_STATUS_OFFLINE) {
-                sem_post(&_job_start_wait_sem);
-                sem_post(&_job_end_wait_sem);
+                sem_post(&jq->job_start_wait_sem);
+                sem_post(&jq->job_end_wait_sem);
             }
             break;
 
         case PRINT_STATUS_PRINTING:
-            sem_post(&_job_start_wait_sem);
-            _lock();
+            sem_post(&jq->job_start_wait_sem);
+            _lock_job(jq);
             if ((jq->job_state != JOB_STATE_RUNNING) || (jq->blocked_reasons != blocked_reasons)) {
                 jq->job_state = JOB_STATE_RUNNING;
                 jq->blocked_reasons = blocked_reasons;
@@ -606,12 +768,12 @@ static void _job_status_callback(const printer_state_dyn_t *new_status,
                     jq->cb_fn(jq->job_handle, (void *) &cb_param);
                 }
             }
-            _unlock();
+            _unlock_job(jq);
             break;
 
         case PRINT_STATUS_UNABLE_TO_CONNECT:
-            sem_post(&_job_start_wait_sem);
-            _lock();
+            sem_post(&jq->job_start_wait_sem);
+            _lock_job(jq);
             _stop_status_thread(jq);
 
             jq->blocked_reasons = blocked_reasons;
@@ -635,14 +797,14 @@ static void _job_status_callback(const printer_state_dyn_t *new_status,
                 jq->status_ifc = NULL;
             }
 
-            _unlock();
-            sem_post(&_job_end_wait_sem);
+            _unlock_job(jq);
+            sem_post(&jq->job_end_wait_sem);
             break;
 
         default:
             // an error has occurred, report it back to the client
-            sem_post(&_job_start_wait_sem);
-            _lock();
+            sem_post(&jq->job_start_wait_sem);
+            _lock_job(jq);
 
             if ((jq->job_state != JOB_STATE_BLOCKED) || (jq->blocked_reasons != blocked_reasons)) {
                 jq->job_state = JOB_STATE_BLOCKED;
@@ -655,7 +817,7 @@ static void _job_status_callback(const printer_state_dyn_t *new_status,
                     jq->cb_fn(jq->job_handle, (void *) &cb_param);
                 }
             }
-            _unlock();
+            _unlock_job(jq);
             break;
     }
 }
@@ -672,6 +834,14 @@ static void _print_job_state_callback(const job_state_dyn_t *new_state, void *pa
     cb_param.certificate = jq->certificate;
     cb_param.certificate_len = jq->certificate_len;
 
+    // nothing has been sent yet, so whatever job this is, it is not ours
+    _lock_job(jq);
+    if (jq->awaiting_ready) {
+        _unlock_job(jq);
+        return;
+    }
+    _unlock_job(jq);
+
     LOGI("_print_job_state_callback(): new state: %d", new_state->job_state);
     for (i = 0; i <= IPP_JOB_STATE_REASON_MAX_VALUE; i++) {
         if (new_state->job_state_reasons[i] == IPP_JOB_STATE_REASON_MAX_VALUE)
@@ -683,12 +853,12 @@ static void _print_job_state_callback(const job_state_dyn_t *new_state, void *pa
 
     switch (new_state->job_state) {
         case IPP_JOB_STATE_UNABLE_TO_CONNECT:
-            sem_post(&_job_start_wait_sem);
-            _lock();
+            sem_post(&jq->job_start_wait_sem);
+            _lock_job(jq);
             jq->job_state = JOB_STATE_ERROR;
             jq->blocked_reasons = blocked_reasons;
-            _unlock();
-            sem_post(&_job_end_wait_sem);
+            _unlock_job(jq);
+            sem_post(&jq->job_end_wait_sem);
             break;
 
         case IPP_JOB_STATE_UNKNOWN:
@@ -697,9 +867,9 @@ static void _print_job_state_callback(const job_state_dyn_t *new_state, void *pa
             break;
 
         case IPP_JOB_STATE_PROCESSING:
-            sem_post(&_job_start_wait_sem);
+            sem_post(&jq->job_start_wait_sem);
             // clear errors
-            _lock();
+            _lock_job(jq);
             if (jq->job_state != JOB_STATE_RUNNING) {
                 jq->job_state = JOB_STATE_RUNNING;
                 if (jq->cb_fn) {
@@ -709,7 +879,7 @@ static void _print_job_state_callback(const job_state_dyn_t *new_state, void *pa
                     jq->cb_fn(jq->job_handle, (void *) &cb_param);
                 }
             }
-            _unlock();
+            _unlock_job(jq);
             break;
 
         case IPP_JOB_STATE_PROCESSING_STOPPED:
@@ -726,28 +896,30 @@ static void _print_job_state_callback(const job_state_dyn_t *new_state, void *pa
             break;
 
         case IPP_JOB_STATE_CANCELED:
-            sem_post(&_job_start_wait_sem);
-            sem_post(&_job_end_wait_sem);
+            sem_post(&jq->job_start_wait_sem);
+            sem_post(&jq->job_end_wait_sem);
             if ((jq->print_ifc != NULL) && (jq->print_ifc->enable_timeout != NULL)) {
                 jq->print_ifc->enable_timeout(jq->print_ifc, 1);
             }
-            _lock();
+            _lock_job(jq);
             jq->job_params.cancelled = true;
             jq->blocked_reasons = blocked_reasons;
-            _unlock();
+            _unlock_job(jq);
             break;
 
         case IPP_JOB_STATE_ABORTED:
-            sem_post(&_job_start_wait_sem);
-            sem_post(&_job_end_wait_sem);
-            _lock();
+            sem_post(&jq->job_start_wait_sem);
+            sem_post(&jq->job_end_wait_sem);
+            _lock_job(jq);
             jq->job_state = JOB_STATE_ERROR;
             jq->blocked_reasons = blocked_reasons;
-            _unlock();
+            _unlock_job(jq);
             break;
 
         case IPP_JOB_STATE_COMPLETED:
-            sem_post(&_job_end_wait_sem);
+            // A job whose id only arrived after the upload may be seen first as completed
+            sem_post(&jq->job_start_wait_sem);
+            sem_post(&jq->job_end_wait_sem);
             break;
 
         default:
@@ -755,6 +927,29 @@ static void _print_job_state_callback(const job_state_dyn_t *new_state, void *pa
     }
 }
 
+/*
+ * Passes the printer's id for the job on to the status monitor once the print interface has it,
+ * so the monitor follows this job rather than searching the printer's queue for it
+ */
+static void _update_job_id(_job_queue_t *jq) {
+    int job_id;
+
+    if ((jq->print_ifc == NULL) || (jq->print_ifc->get_job_id == NULL)) {
+        return;
+    }
+
+    job_id = jq->print_ifc->get_job_id(jq->print_ifc);
+    if ((job_id == -1) || (job_id == jq->remote_job_id)) {
+        return;
+    }
+
+    LOGD("_update_job_id(): printer job id %d", job_id);
+    jq->remote_job_id = job_id;
+    if ((jq->status_ifc != NULL) && (jq->status_ifc->set_job_id != NULL)) {
+        jq->status_ifc->set_job_id(jq->status_ifc, job_id);
+    }
+}
+
 static void *_job_status_thread(void *param) {
     _job_queue_t *jq = (_job_queue_t *) param;
     (jq->status_ifc->start)(jq->status_ifc, _job_status_callback, _print_job_state_callback, param);
@@ -777,14 +972,14 @@ static int _start_status_thread(_job_queue_t *jq) {
     pthread_sigmask(SIG_SETMASK, &allsig, &oldsig);
 #endif // CHECK_PTHREAD_SIGMASK_STATUS
     if (result == OK) {
-        result = pthread_create(&_job_status_tid, 0, _job_status_thread, jq);
-        if ((result == ERROR) && (_job_status_tid != pthread_self())) {
+        result = pthread_create(&jq->job_status_tid, 0, _job_status_thread, jq);
+        if ((result == ERROR) && (jq->job_status_tid != pthread_self())) {
 #if USE_PTHREAD_CANCEL
-            pthread_cancel(_job_status_tid);
+            pthread_cancel(jq->job_status_tid);
 #else // else USE_PTHREAD_CANCEL
-            pthread_kill(_job_status_tid, SIGKILL);
+            pthread_kill(jq->job_status_tid, SIGKILL);
 #endif // USE_PTHREAD_CANCEL
-            _job_status_tid = pthread_self();
+            jq->job_status_tid = pthread_self();
         }
     }
 
@@ -878,10 +1073,8 @@ static void _initialize_status_ifc(_job_queue_t *jq) {
 /*
  * Runs a print job. Contains logic for what to do given different printer statuses.
  */
-static void *_job_thread(void *param) {
+static void _run_job(wJob_t job_handle) {
     wprint_job_callback_params_t cb_param = { 0 };
-    _msg_t msg;
-    wJob_t job_handle;
     _job_queue_t *jq;
     _page_t page;
     int i;
@@ -889,427 +1082,369 @@ static void *_job_thread(void *param) {
     int corrupted = 0;
     printer_capabilities_t printer_caps;
 
-    while (OK == msgQReceive(_msgQ, (char *) &msg, sizeof(msg), WAIT_FOREVER)) {
-        if (msg.id == MSG_RUN_JOB) {
-            LOGI("_job_thread(): Received message: MSG_RUN_JOB");
-        } else {
-            LOGI("_job_thread(): Received message: MSG_QUIT");
-        }
+    //  check if this is a valid job_handle that is still active
+    jq = _lock_job_desc(job_handle);
 
-        if (msg.id == MSG_QUIT) {
-            break;
+    //  set state to running and invoke the plugin, there is one
+    if (jq) {
+        if (jq->job_state != JOB_STATE_QUEUED) {
+            _unlock_job(jq);
+            return;
         }
+        corrupted = 0;
+        job_result = OK;
+        jq->job_params.plugin_data = NULL;
 
-        job_handle = msg.job_id;
-
-        //  check if this is a valid job_handle that is still active
-        _lock();
-
-        jq = _get_job_desc(job_handle);
+        // clear out the semaphore just in case
+        while (sem_trywait(&jq->job_start_wait_sem) == OK) {
+        }
+        while (sem_trywait(&jq->job_end_wait_sem) == OK) {
+        }
 
-        //  set state to running and invoke the plugin, there is one
-        if (jq) {
-            if (jq->job_state != JOB_STATE_QUEUED) {
-                _unlock();
-                continue;
+        // initialize the status ifc
+        if (jq->status_ifc != NULL) {
+            _initialize_status_ifc(jq);
+        }
+        // wait for the printer to be idle, as reported by the status thread
+        jq->job_status_tid = pthread_self();
+        if (jq->status_ifc != NULL) {
+            struct timespec wait_start;
+            bool idle = false;
+            bool bad_certificate = false;
+            printer_state_dyn_t printer_state;
+            long wait_msec;
+
+            printer_state.printer_status = PRINT_STATUS_UNKNOWN;
+            for (i = 0; i <= PRINT_STATUS_MAX_STATE; i++) {
+                printer_state.printer_reasons[i] = PRINT_STATUS_MAX_STATE;
             }
-            corrupted = 0;
-            job_result = OK;
-            jq->job_params.plugin_data = NULL;
+            printer_state.printer_reasons[0] = PRINT_STATUS_INITIALIZING;
+
+            jq->awaiting_ready = true;
+            jq->ready_state_new = false;
+            _start_status_thread(jq);
+            clock_gettime(CLOCK_MONOTONIC, &wait_start);
+            while (!idle && !stop_run) {
+                print_status_t status;
+
+                // returns early if the job is cancelled or wprint is stopping
+                while (!jq->ready_state_new && !stop_run && !jq->job_params.cancelled &&
+                        ((wait_msec = (MAX_IDLE_WAIT * 1000L) - _msec_since(&wait_start)) > 0)) {
+                    _wait_job_event(jq, (int) wait_msec);
+                }
+                if (jq->ready_state_new) {
+                    memcpy(&printer_state, &jq->ready_state, sizeof(printer_state_dyn_t));
+                    jq->ready_state_new = false;
+                }
+                status = printer_state.printer_status & ~PRINTER_IDLE_BIT;
 
-            // clear out the semaphore just in case
-            while (sem_trywait(&_job_start_wait_sem) == OK) {
-            }
-            while (sem_trywait(&_job_end_wait_sem) == OK) {
-            }
+                // Pass along any certificate received in future callbacks
+                cb_param.certificate = jq->certificate;
+                cb_param.certificate_len = jq->certificate_len;
 
-            // initialize the status ifc
-            if (jq->status_ifc != NULL) {
-                _initialize_status_ifc(jq);
-            }
-            // wait for the printer to be idle
-            if ((jq->status_ifc != NULL) && (jq->status_ifc->get_status != NULL)) {
-                int retry = 0;
-                bool idle = false;
-                bool bad_certificate = false;
-                printer_state_dyn_t printer_state;
-                while (!idle && !stop_run) {
-                    print_status_t status;
-                    jq->status_ifc->get_status(jq->status_ifc, &printer_state);
-                    status = printer_state.printer_status & ~PRINTER_IDLE_BIT;
-
-                    // Pass along any certificate received in future callbacks
-                    cb_param.certificate = jq->certificate;
-                    cb_param.certificate_len = jq->certificate_len;
-
-                    // Presume we found an idle state
-                    idle = true;
-                    if (status == PRINT_STATUS_IDLE) {
-                        printer_state.printer_status = PRINT_STATUS_IDLE;
-                        jq->blocked_reasons = 0;
-                    } else if (status == PRINT_STATUS_UNKNOWN
-                            && printer_state.printer_reasons[0] == PRINT_STATUS_UNKNOWN) {
-                        // no status available, break out and hope for the best
-                        printer_state.printer_status = PRINT_STATUS_IDLE;
-                    } else if ((status == PRINT_STATUS_UNKNOWN || status == PRINT_STATUS_SVC_REQUEST)
-                            && ((printer_state.printer_reasons[0] == PRINT_STATUS_UNABLE_TO_CONNECT)
-                                || (printer_state.printer_reasons[0] == PRINT_STATUS_OFFLINE))) {
-                        if (_is_certificate_allowed(jq)) {
-                            LOGD("%s: Received an Unable to Connect message", __func__);
-                            jq->blocked_reasons = BLOCKED_REASON_UNABLE_TO_CONNECT;
-                        } else {
-                            LOGD("%s: Bad certificate", __func__);
-                            bad_certificate = true;
-                        }
-                    } else if (printer_state.printer_status & PRINTER_IDLE_BIT) {
-                        LOGD("%s: printer blocked but appears to be in an idle state. "
-                                "Allowing job to proceed", __func__);
-                        printer_state.printer_status = PRINT_STATUS_IDLE;
-                    } else if (retry >= MAX_IDLE_WAIT) {
-                        jq->blocked_reasons |= BLOCKED_REASONS_PRINTER_BUSY;
-                    } else if (!jq->job_params.cancelled) {
-                        // Printer still appears busy, so stay in loop, notify, and poll again.
-                        idle = false;
-                        int blocked_reasons = 0;
-                        for (i = 0; i <= PRINT_STATUS_MAX_STATE; i++) {
-                            if (printer_state.printer_reasons[i] == PRINT_STATUS_MAX_STATE) {
-                                break;
-                            }
-                            blocked_reasons |= (1 << printer_state.printer_reasons[i]);
-                        }
-                        if (blocked_reasons == 0) {
-                            blocked_reasons |= BLOCKED_REASONS_PRINTER_BUSY;
+                // Presume we found an idle state
+                idle = true;
+                if (status == PRINT_STATUS_IDLE) {
+                    printer_state.printer_status = PRINT_STATUS_IDLE;
+                    jq->blocked_reasons = 0;
+                } else if (status == PRINT_STATUS_UNKNOWN
+                        && printer_state.printer_reasons[0] == PRINT_STATUS_UNKNOWN) {
+                    // no status available, break out and hope for the best
+                    printer_state.printer_status = PRINT_STATUS_IDLE;
+                } else if ((status == PRINT_STATUS_UNKNOWN || status == PRINT_STATUS_SVC_REQUEST)
+                        && ((printer_state.printer_reasons[0] == PRINT_STATUS_UNABLE_TO_CONNECT)
+                            || (printer_state.printer_reasons[0] == PRINT_STATUS_OFFLINE))) {
+                    if (_is_certificate_allowed(jq)) {
+                        LOGD("%s: Received an Unable to Connect message", __func__);
+                        jq->blocked_reasons = BLOCKED_REASON_UNABLE_TO_CONNECT;
+                    } else {
+                        LOGD("%s: Bad certificate", __func__);
+                        bad_certificate = true;
+                    }
+                } else if (printer_state.printer_status & PRINTER_IDLE_BIT) {
+                    LOGD("%s: printer blocked but appears to be in an idle state. "
+                            "Allowing job to proceed", __func__);
+                    printer_state.printer_status = PRINT_STATUS_IDLE;
+                } else if (_msec_since(&wait_start) >= (MAX_IDLE_WAIT * 1000L)) {
+                    jq->blocked_reasons |= BLOCKED_REASONS_PRINTER_BUSY;
+                } else if (!jq->job_params.cancelled) {
+                    // Printer still appears busy, so stay in loop, notify, and wait for news.
+                    idle = false;
+                    int blocked_reasons = 0;
+                    for (i = 0; i <= PRINT_STATUS_MAX_STATE; i++) {
+                        if (printer_state.printer_reasons[i] == PRINT_STATUS_MAX_STATE) {
+                            break;
                         }
+                        blocked_reasons |= (1 << printer_state.printer_reasons[i]);
+                    }
+                    if (blocked_reasons == 0) {
+                        blocked_reasons |= BLOCKED_REASONS_PRINTER_BUSY;
+                    }
 
-                        if ((jq->job_state != JOB_STATE_BLOCKED)
-                                || (jq->blocked_reasons != blocked_reasons)) {
-                            jq->job_state = JOB_STATE_BLOCKED;
-                            jq->blocked_reasons = blocked_reasons;
-                            if (jq->cb_fn) {
-                                cb_param.param.state = JOB_BLOCKED;
-                                cb_param.blocked_reasons = blocked_reasons;
-                                cb_param.job_done_result = OK;
+                    if ((jq->job_state != JOB_STATE_BLOCKED)
+                            || (jq->blocked_reasons != blocked_reasons)) {
+                        jq->job_state = JOB_STATE_BLOCKED;
+                        jq->blocked_reasons = blocked_reasons;
+                        if (jq->cb_fn) {
+                            cb_param.param.state = JOB_BLOCKED;
+                            cb_param.blocked_reasons = blocked_reasons;
+                            cb_param.job_done_result = OK;
 
-                                jq->cb_fn(jq->job_handle, (void *) &cb_param);
-                            }
+                            jq->cb_fn(jq->job_handle, (void *) &cb_param);
                         }
-                        _unlock();
-                        sleep(1);
-                        _lock();
-                        retry++;
                     }
                 }
+            }
+            jq->awaiting_ready = false;
 
-                if (jq->job_params.cancelled) {
-                    job_result = CANCELLED;
-                } else if (bad_certificate) {
-                    job_result = BAD_CERTIFICATE;
+            if (jq->job_params.cancelled) {
+                job_result = CANCELLED;
+            } else if (bad_certificate) {
+                job_result = BAD_CERTIFICATE;
+            } else {
+                if (stop_run) {
+                    jq->job_state = JOB_STATE_ERROR;
+                    job_result = ERROR;
                 } else {
-                    if (stop_run) {
-                        jq->job_state = JOB_STATE_ERROR;
-                        job_result = ERROR;
-                    } else {
-                        job_result = (((printer_state.printer_status & ~PRINTER_IDLE_BIT) ==
-                                       PRINT_STATUS_IDLE) ? OK : ERROR);
-                    }
+                    job_result = (((printer_state.printer_status & ~PRINTER_IDLE_BIT) ==
+                                   PRINT_STATUS_IDLE) ? OK : ERROR);
                 }
             }
+        }
 
-            _job_status_tid = pthread_self();
-            if (job_result == OK) {
-                if (jq->print_ifc) {
-                    job_result = jq->print_ifc->init(jq->print_ifc, jq->printer_addr,
-                            jq->port_num, jq->printer_uri, jq->use_secure_uri);
-                    if (job_result == ERROR) {
-                        jq->blocked_reasons = BLOCKED_REASON_UNABLE_TO_CONNECT;
-                    }
+        if (job_result == OK) {
+            if (jq->print_ifc) {
+                job_result = jq->print_ifc->init(jq->print_ifc, jq->printer_addr,
+                        jq->port_num, jq->printer_uri, jq->use_secure_uri);
+                if (job_result == ERROR) {
+                    jq->blocked_reasons = BLOCKED_REASON_UNABLE_TO_CONNECT;
                 }
             }
-            if (job_result == OK) {
-                _start_status_thread(jq);
-            }
+        }
 
-            /*  call the plugin's start_job method, if no other job is running
-             use callback to notify the client */
+        /*  call the plugin's start_job method, if no other job is running
+         use callback to notify the client */
 
-            if ((job_result == OK) && jq->cb_fn) {
-                cb_param.param.state = JOB_RUNNING;
-                cb_param.blocked_reasons = 0;
-                cb_param.job_done_result = OK;
+        if ((job_result == OK) && jq->cb_fn) {
+            cb_param.param.state = JOB_RUNNING;
+            cb_param.blocked_reasons = 0;
+            cb_param.job_done_result = OK;
 
-                jq->cb_fn(job_handle, (void *) &cb_param);
-            }
+            jq->cb_fn(job_handle, (void *) &cb_param);
+        }
 
-            memcpy(&printer_caps, &g_printer_caps, sizeof(printer_capabilities_t));
+        memcpy(&printer_caps, &jq->printer_caps, sizeof(printer_capabilities_t));
 
-            jq->job_params.page_num = -1;
-            if (job_result == OK) {
-                if (jq->print_ifc != NULL) {
-                    LOGD("_job_thread: Calling validate_job");
-                    if (jq->print_ifc->validate_job != NULL) {
-                        job_result = jq->print_ifc->validate_job(jq->print_ifc, &jq->job_params,
-                                &printer_caps);
-                    }
-                    if (!_is_certificate_allowed(jq)) {
-                        LOGD("_job_thread: bad certificate found at validate job");
-                        job_result = BAD_CERTIFICATE;
-                    }
-                    /* PDF format plugin's start_job and end_job are to be called for each copy,
-                     * inside the for-loop for num_copies.
-                     */
-
-                    // Do not call start_job unless validate_job returned OK
-                    if ((job_result == OK) && (jq->print_ifc->start_job != NULL) &&
-                            (strcmp(jq->job_params.print_format, PRINT_FORMAT_PDF) != 0)) {
-                        jq->print_ifc->start_job(jq->print_ifc, &jq->job_params, &printer_caps);
-                    }
+        jq->job_params.page_num = -1;
+        if (job_result == OK) {
+            if (jq->print_ifc != NULL) {
+                LOGD("_run_job: Calling validate_job");
+                if (jq->print_ifc->validate_job != NULL) {
+                    job_result = jq->print_ifc->validate_job(jq->print_ifc, &jq->job_params,
+                            &printer_caps);
                 }
+                if (!_is_certificate_allowed(jq)) {
+                    LOGD("_run_job: bad certificate found at validate job");
+                    job_result = BAD_CERTIFICATE;
+                }
+                /* PDF format plugin's start_job and end_job are to be called for each copy,
+                 * inside the for-loop for num_copies.
+                 */
 
                 // Do not call start_job unless validate_job returned OK
-                if (job_result == OK && jq->plugin->start_job != NULL) {
-                    job_result = jq->plugin->start_job(job_handle, (void *) &_wprint_ifc,
-                            (void *) jq->print_ifc, &(jq->job_params));
+                if ((job_result == OK) && (jq->print_ifc->start_job != NULL) &&
+                        (strcmp(jq->job_params.print_format, PRINT_FORMAT_PDF) != 0)) {
+                    jq->print_ifc->start_job(jq->print_ifc, &jq->job_params, &printer_caps);
+                    _update_job_id(jq);
                 }
             }
 
-            if (job_result == OK) {
-                jq->job_params.page_num = 0;
+            // Do not call start_job unless validate_job returned OK
+            if (job_result == OK && jq->plugin->start_job != NULL) {
+                job_result = jq->plugin->start_job(job_handle, (void *) &_wprint_ifc,
+                        (void *) jq->print_ifc, &(jq->job_params));
             }
+        }
 
-            // multi-page print job
-            if (jq->is_dir && (job_result == OK)) {
-                int per_copy_page_num;
-                for (i = 0; (i < jq->job_params.num_copies) &&
-                        ((job_result == OK) || (job_result == CORRUPT)) &&
-                        (!jq->job_params.cancelled); i++) {
-                    if ((i > 0) &&
-                            jq->job_params.copies_supported &&
-                            (strcmp(jq->job_params.print_format, PRINT_FORMAT_PDF) == 0)) {
-                        LOGD("_job_thread multi_page: breaking out copies supported");
-                        break;
-                    }
-                    bool pdf_printed = false;
-                    if (jq->print_ifc->start_job != NULL &&
-                            (strcmp(jq->job_params.print_format, PRINT_FORMAT_PDF) == 0)) {
-                        jq->print_ifc->start_job(jq->print_ifc, &jq->job_params, &printer_caps);
-                    }
-
-                    per_copy_page_num = 0;
-                    jq->job_state = JOB_STATE_RUNNING;
+        if (job_result == OK) {
+            jq->job_params.page_num = 0;
+        }
 
-                    // while there is a page to print
-                    _unlock();
+        // multi-page print job
+        if (jq->is_dir && (job_result == OK)) {
+            int per_copy_page_num;
+            for (i = 0; (i < jq->job_params.num_copies) &&
+                    ((job_result == OK) || (job_result == CORRUPT)) &&
+                    (!jq->job_params.cancelled); i++) {
+                if ((i > 0) &&
+                        jq->job_params.copies_supported &&
+                        (strcmp(jq->job_params.print_format, PRINT_FORMAT_PDF) == 0)) {
+                    LOGD("_run_job multi_page: breaking out copies supported");
+                    break;
+                }
+                bool pdf_printed = false;
+                if (jq->print_ifc->start_job != NULL &&
+                        (strcmp(jq->job_params.print_format, PRINT_FORMAT_PDF) == 0)) {
+                    jq->print_ifc->start_job(jq->print_ifc, &jq->job_params, &printer_caps);
+                    _update_job_id(jq);
+                }
 
-                    while (OK == msgQReceive(jq->pageQ, (char *) &page, sizeof(page),
-                            WAIT_FOREVER)) {
-                        _lock();
+                per_copy_page_num = 0;
+                jq->job_state = JOB_STATE_RUNNING;
 
-                        // check for any printing problems so far
-                        if (jq->print_ifc->check_status) {
-                            if (jq->print_ifc->check_status(jq->print_ifc) == ERROR) {
-                                job_result = ERROR;
-                                break;
-                            }
-                        }
+                // while there is a page to print
+                _unlock_job(jq);
 
-                        /* take empty filename as cue to break out of the loop
-                         * but we have to do last_page processing
-                         */
+                while (OK == msgQReceive(jq->pageQ, (char *) &page, sizeof(page),
+                        WAIT_FOREVER)) {
+                    _lock_job(jq);
 
-                        // all copies are clubbed together as a single print job
-                        if (page.last_page && ((i == jq->job_params.num_copies - 1) ||
-                                (jq->job_params.copies_supported &&
-                                        strcmp(jq->job_params.print_format,
-                                                PRINT_FORMAT_PDF) == 0))) {
-                            jq->job_params.last_page = page.last_page;
-                        } else {
-                            jq->job_params.last_page = false;
+                    // check for any printing problems so far
+                    if (jq->print_ifc->check_status) {
+                        if (jq->print_ifc->check_status(jq->print_ifc) == ERROR) {
+                            job_result = ERROR;
+                            break;
                         }
+                    }
+
+                    /* take empty filename as cue to break out of the loop
+                     * but we have to do last_page processing
+                     */
 
-                        bool printBlankPage = (strcmp(jq->job_params.print_format,
-                                PRINT_FORMAT_PCLM) == 0) ? wprintBlankPageForPclm(
-                                &jq->job_params, &printer_caps) : wprintBlankPageForPwg(
-                                &jq->job_params, &printer_caps);
+                    // all copies are clubbed together as a single print job
+                    if (page.last_page && ((i == jq->job_params.num_copies - 1) ||
+                            (jq->job_params.copies_supported &&
+                                    strcmp(jq->job_params.print_format,
+                                            PRINT_FORMAT_PDF) == 0))) {
+                        jq->job_params.last_page = page.last_page;
+                    } else {
+                        jq->job_params.last_page = false;
+                    }
 
-                        printBlankPage &= (jq->plugin->print_blank_page != NULL);
+                    bool printBlankPage = (strcmp(jq->job_params.print_format,
+                            PRINT_FORMAT_PCLM) == 0) ? wprintBlankPageForPclm(
+                            &jq->job_params, &printer_caps) : wprintBlankPageForPwg(
+                            &jq->job_params, &printer_caps);
 
-                        if (strlen(page.filename) > 0) {
-                            per_copy_page_num++;
-                            {
-                                jq->job_params.page_num++;
-                            }
-                            if (page.pdf_page) {
-                                jq->job_params.page_num = page.page_num;
-                            } else {
-                                jq->job_params.page_num = per_copy_page_num;
-                            }
+                    printBlankPage &= (jq->plugin->print_blank_page != NULL);
 
-                            // setup page margin information
-                            jq->job_params.print_top_margin += page.top_margin;
-                            jq->job_params.print_left_margin += page.left_margin;
-                            jq->job_params.print_right_margin += page.right_margin;
-                            jq->job_params.print_bottom_margin += page.bottom_margin;
-
-                            jq->job_params.copy_num = (i + 1);
-                            jq->job_params.copy_page_num = page.page_num;
-                            jq->job_params.page_backside = !(page.page_num & 0x1);
-                            jq->job_params.page_corrupted = (page.corrupted ? 1 : 0);
-                            jq->job_params.page_printing = true;
-                            _unlock();
-
-                            if (!page.corrupted) {
-                                LOGD("_job_thread(): page not corrupt, calling plugin's print_page"
-                                        " function for page #%d", page.page_num);
-
-                                // make sure we always print an even number of pages in duplex jobs
-                                if ((page.page_num == jq->job_params.job_pages_per_set) &&
-                                        !(jq->job_params.face_down_tray) && printBlankPage) {
-                                    jq->plugin->print_blank_page(job_handle, &(jq->job_params),
-                                            jq->mime_type, page.filename);
-                                }
-
-                                if (strcmp(jq->job_params.print_format, PRINT_FORMAT_PDF) != 0) {
-                                    job_result = jq->plugin->print_page(&(jq->job_params),
-                                            jq->mime_type,
-                                            page.filename);
-                                } else if (!pdf_printed) {
-                                    // for PDF plugin, print_page prints entire document,
-                                    // so need to be called only once
-                                    job_result = jq->plugin->print_page(&(jq->job_params),
-                                            jq->mime_type,
-                                            page.filename);
-                                    pdf_printed = true;
-                                }
-                            } else {
-                                LOGD("_job_thread(): page IS corrupt, printing blank page for "
-                                        "page #%d", page.page_num);
-                                job_result = CORRUPT;
-                                if ((jq->job_params.duplex != DUPLEX_MODE_NONE) &&
-                                        (jq->plugin->print_blank_page != NULL)) {
-                                    jq->plugin->print_blank_page(job_handle, &(jq->job_params),
-                                            jq->mime_type, page.filename);
-                                }
-                            }
-                            _lock();
-
-                            jq->job_params.print_top_margin -= page.top_margin;
-                            jq->job_params.print_left_margin -= page.left_margin;
-                            jq->job_params.print_right_margin -= page.right_margin;
-                            jq->job_params.print_bottom_margin -= page.bottom_margin;
-                            jq->job_params.page_printing = false;
-
-                            // make sure we only count corrupted pages once
-                            if (page.corrupted == false) {
-                                page.corrupted = ((job_result == CORRUPT) ? true : false);
-                                corrupted += (job_result == CORRUPT);
-                            }
+                    if (strlen(page.filename) > 0) {
+                        per_copy_page_num++;
+                        {
+                            jq->job_params.page_num++;
                         }
-
-                        // make sure we always print an even number of pages in duplex jobs
-                        if (page.last_page && (jq->job_params.face_down_tray) &&
-                                !(jq->job_params.page_backside) && printBlankPage) {
-                            _unlock();
-                            jq->plugin->print_blank_page(job_handle, &(jq->job_params),
-                                    jq->mime_type, page.filename);
-                            _lock();
+                        if (page.pdf_page) {
+                            jq->job_params.page_num = page.page_num;
+                        } else {
+                            jq->job_params.page_num = per_copy_page_num;
                         }
 
-                        // if multiple copies are requested, save the contents of the pageQ message
-                        if (jq->saveQ && !jq->job_params.cancelled && (job_result != ERROR)) {
-                            job_result = msgQSend(jq->saveQ, (char *) &page,
-                                    sizeof(page), NO_WAIT, MSG_Q_FIFO);
-
-                            // swap pageQ and saveQ
-                            if (page.last_page && !jq->job_params.last_page) {
-                                msg_q_id tmpQ = jq->pageQ;
-                                jq->pageQ = jq->saveQ;
-                                jq->saveQ = tmpQ;
-
-                                // defensive programming
-                                while (msgQNumMsgs(tmpQ) > 0) {
-                                    msgQReceive(tmpQ, (char *) &page, sizeof(page), NO_WAIT);
-                                    LOGE("pageQ inconsistencies, discarding page #%d, file %s",
-                                            page.page_num, page.filename);
-                                }
+                        // setup page margin information
+                        jq->job_params.print_top_margin += page.top_margin;
+                        jq->job_params.print_left_margin += page.left_margin;
+                        jq->job_params.print_right_margin += page.right_margin;
+                        jq->job_params.print_bottom_margin += page.bottom_margin;
+
+                        jq->job_params.copy_num = (i + 1);
+                        jq->job_params.copy_page_num = page.page_num;
+                        jq->job_params.page_backside = !(page.page_num & 0x1);
+                        jq->job_params.page_corrupted = (page.corrupted ? 1 : 0);
+                        jq->job_params.page_printing = true;
+                        _unlock_job(jq);
+
+                        if (!page.corrupted) {
+                            LOGD("_run_job(): page not corrupt, calling plugin's print_page"
+                                    " function for page #%d", page.page_num);
+
+                            // make sure we always print an even number of pages in duplex jobs
+                            if ((page.page_num == jq->job_params.job_pages_per_set) &&
+                                    !(jq->job_params.face_down_tray) && printBlankPage) {
+                                jq->plugin->print_blank_page(job_handle, &(jq->job_params),
+                                        jq->mime_type, page.filename);
                             }
-                        }
-
-                        if (page.last_page || jq->job_params.cancelled) {
-                            // Leave the sempahore locked
-                            break;
-                        }
 
-                        // unlock to go back to the top of the while loop
-                        _unlock();
-                    } // while there is another page
-
-                    if ((strcmp(jq->job_params.print_format, PRINT_FORMAT_PDF) == 0) &&
-                            (jq->print_ifc->end_job)) {
-                        int end_job_result = jq->print_ifc->end_job(jq->print_ifc);
-                        if (job_result == OK) {
-                            if (end_job_result == ERROR) {
-                                job_result = ERROR;
-                            } else if (end_job_result == CANCELLED) {
-                                job_result = CANCELLED;
+                            if (strcmp(jq->job_params.print_format, PRINT_FORMAT_PDF) != 0) {
+                                job_result = jq->plugin->print_page(&(jq->job_params),
+                                        jq->mime_type,
+                                        page.filename);
+                            } else if (!pdf_printed) {
+                                // for PDF plugin, print_page prints entire document,
+                                // so need to be called only once
+                                job_result = jq->plugin->print_page(&(jq->job_params),
+                                        jq->mime_type,
+                                        page.filename);
+                                pdf_printed = true;
+                            }
+                        } else {
+                            LOGD("_run_job(): page IS corrupt, printing blank page for "
+                                    "page #%d", page.page_num);
+                            job_result = CORRUPT;
+                            if ((jq->job_params.duplex != DUPLEX_MODE_NONE) &&
+                                    (jq->plugin->print_blank_page != NULL)) {
+                                jq->plugin->print_blank_page(job_handle, &(jq->job_params),
+                                        jq->mime_type, page.filename);
                             }
                         }
+                        _lock_job(jq);
+
+                        jq->job_params.print_top_margin -= page.top_margin;
+                        jq->job_params.print_left_margin -= page.left_margin;
+                        jq->job_params.print_right_margin -= page.right_margin;
+                        jq->job_params.print_bottom_margin -= page.bottom_margin;
+                        jq->job_params.page_printing = false;
+
+                        // make sure we only count corrupted pages once
+                        if (page.corrupted == false) {
+                            page.corrupted = ((job_result == CORRUPT) ? true : false);
+                            corrupted += (job_result == CORRUPT);
+                        }
                     }
-                } // for each copy of the job
-            } else if (job_result == OK) {
-                // single page job
-                for (i = 0; ((i < jq->job_params.num_copies) && (job_result == OK)); i++) {
-                    if ((i > 0) && jq->job_params.copies_supported &&
-                            (strcmp(jq->job_params.print_format, PRINT_FORMAT_PDF) == 0)) {
-                        LOGD("_job_thread single_page: breaking out copies supported");
-                        break;
+
+                    // make sure we always print an even number of pages in duplex jobs
+                    if (page.last_page && (jq->job_params.face_down_tray) &&
+                            !(jq->job_params.page_backside) && printBlankPage) {
+                        _unlock_job(jq);
+                        jq->plugin->print_blank_page(job_handle, &(jq->job_params),
+                                jq->mime_type, page.filename);
+                        _lock_job(jq);
                     }
 
-                    // check for any printing problems so far
-                    if ((jq->print_ifc != NULL) && (jq->print_ifc->check_status)) {
-                        if (jq->print_ifc->check_status(jq->print_ifc) == ERROR) {
-                            job_result = ERROR;
-                            break;
+                    // if multiple copies are requested, save the contents of the pageQ message
+                    if (jq->saveQ && !jq->job_params.cancelled && (job_result != ERROR)) {
+                        job_result = msgQSend(jq->saveQ, (char *) &page,
+                                sizeof(page), NO_WAIT, MSG_Q_FIFO);
+
+                        // swap pageQ and saveQ
+                        if (page.last_page && !jq->job_params.last_page) {
+                            msg_q_id tmpQ = jq->pageQ;
+                            jq->pageQ = jq->saveQ;
+                            jq->saveQ = tmpQ;
+
+                            // defensive programming
+                            while (msgQNumMsgs(tmpQ) > 0) {
+                                msgQReceive(tmpQ, (char *) &page, sizeof(page), NO_WAIT);
+                                LOGE("pageQ inconsistencies, discarding page #%d, file %s",
+                                        page.page_num, page.filename);
+                            }
                         }
                     }
 
-                    jq->job_state = JOB_STATE_RUNNING;
-                    jq->job_params.page_num++;
-                    jq->job_params.last_page = (i == (jq->job_params.num_copies - 1));
-                    jq->job_params.copy_num = (i + 1);
-                    jq->job_params.copy_page_num = 1;
-                    jq->job_params.page_corrupted = (job_result == CORRUPT);
-                    jq->job_params.page_printing = true;
-
-                    _unlock();
-                    job_result = jq->plugin->print_page(&(jq->job_params), jq->mime_type,
-                            jq->pathname);
-
-                    if ((jq->job_params.duplex != DUPLEX_MODE_NONE)
-                            && (jq->plugin->print_blank_page != NULL)) {
-                        jq->plugin->print_blank_page(job_handle,
-                                &(jq->job_params), jq->mime_type, page.filename);
+                    if (page.last_page || jq->job_params.cancelled) {
+                        // Leave the sempahore locked
+                        break;
                     }
 
-                    _lock();
-                    jq->job_params.page_printing = false;
-
-                    corrupted += (job_result == CORRUPT);
-                } // for each copy
-            }
+                    // unlock to go back to the top of the while loop
+                    _unlock_job(jq);
+                } // while there is another page
 
-            // if we started the job end it
-            if (jq->job_params.page_num >= 0) {
-                // if the job was cancelled without sending anything through, print a blank sheet
-                if ((jq->job_params.page_num == 0) && (jq->plugin->print_blank_page != NULL)) {
-                    jq->plugin->print_blank_page(job_handle, &(jq->job_params), jq->mime_type,
-                            page.filename);
-                }
-                if (jq->plugin->end_job != NULL) {
-                    jq->plugin->end_job(&(jq->job_params));
-                }
-                if ((jq->print_ifc != NULL) && (jq->print_ifc->end_job) &&
-                        (strcmp(jq->job_params.print_format, PRINT_FORMAT_PDF) != 0)) {
+                if ((strcmp(jq->job_params.print_format, PRINT_FORMAT_PDF) == 0) &&
+                        (jq->print_ifc->end_job)) {
+                    // unlocked as on the raster path, so a cancel can abort the transport
+                    _unlock_job(jq);
                     int end_job_result = jq->print_ifc->end_job(jq->print_ifc);
+                    _lock_job(jq);
+                    _update_job_id(jq);
                     if (job_result == OK) {
                         if (end_job_result == ERROR) {
                             job_result = ERROR;
@@ -1318,145 +1453,395 @@ static void *_job_thread(void *param) {
                         }
                     }
                 }
-            }
+            } // for each copy of the job
+        } else if (job_result == OK) {
+            // single page job
+            for (i = 0; ((i < jq->job_params.num_copies) && (job_result == OK)); i++) {
+                if ((i > 0) && jq->job_params.copies_supported &&
+                        (strcmp(jq->job_params.print_format, PRINT_FORMAT_PDF) == 0)) {
+                    LOGD("_run_job single_page: breaking out copies supported");
+                    break;
+                }
 
-            // if we started to print, wait for idle
-            if ((jq->job_params.page_num > 0) && (jq->status_ifc != NULL)) {
-                int retry, result;
-                _unlock();
+                // check for any printing problems so far
+                if ((jq->print_ifc != NULL) && (jq->print_ifc->check_status)) {
+                    if (jq->print_ifc->check_status(jq->print_ifc) == ERROR) {
+                        job_result = ERROR;
+                        break;
+                    }
+                }
 
-                for (retry = 0, result = ERROR; ((result == ERROR) && (retry <= MAX_START_WAIT));
-                        retry++) {
-                    if (retry != 0) {
-                        sleep(1);
+                jq->job_state = JOB_STATE_RUNNING;
+                jq->job_params.page_num++;
+                jq->job_params.last_page = (i == (jq->job_params.num_copies - 1));
+                jq->job_params.copy_num = (i + 1);
+                jq->job_params.copy_page_num = 1;
+                jq->job_params.page_corrupted = (job_result == CORRUPT);
+                jq->job_params.page_printing = true;
+
+                _unlock_job(jq);
+                job_result = jq->plugin->print_page(&(jq->job_params), jq->mime_type,
+                        jq->pathname);
+
+                if ((jq->job_params.duplex != DUPLEX_MODE_NONE)
+                        && (jq->plugin->print_blank_page != NULL)) {
+                    jq->plugin->print_blank_page(job_handle,
+                            &(jq->job_params), jq->mime_type, page.filename);
+                }
+
+                _lock_job(jq);
+                jq->job_params.page_printing = false;
+
+                corrupted += (job_result == CORRUPT);
+            } // for each copy
+        }
+
+        // if we started the job end it. The job stays unlocked meanwhile so a cancel can abort
+        // the transport while the plugin flushes.
+        _unlock_job(jq);
+        if (jq->job_params.page_num >= 0) {
+            // if the job was cancelled without sending anything through, print a blank sheet
+            if ((jq->job_params.page_num == 0) && (jq->plugin->print_blank_page != NULL)) {
+                jq->plugin->print_blank_page(job_handle, &(jq->job_params), jq->mime_type,
+                        page.filename);
+            }
+            if (jq->plugin->end_job != NULL) {
+                jq->plugin->end_job(&(jq->job_params));
+            }
+            if ((jq->print_ifc != NULL) && (jq->print_ifc->end_job) &&
+                    (strcmp(jq->job_params.print_format, PRINT_FORMAT_PDF) != 0)) {
+                int end_job_result = jq->print_ifc->end_job(jq->print_ifc);
+                _update_job_id(jq);
+                if (job_result == OK) {
+                    if (end_job_result == ERROR) {
+                        job_result = ERROR;
+                    } else if (end_job_result == CANCELLED) {
+                        job_result = CANCELLED;
                     }
-                    result = sem_trywait(&_job_start_wait_sem);
                 }
+            }
+        }
+        _lock_job(jq);
+
+        // if we started to print, wait for idle. An aborted job's data was cut short, so the
+        // printer never got it whole.
+        if ((jq->job_params.page_num > 0) && (jq->status_ifc != NULL) && !jq->job_params.aborted) {
+            int retry, result;
+            _unlock_job(jq);
+
+            for (retry = 0, result = ERROR; ((result == ERROR) && (retry <= MAX_START_WAIT));
+                    retry++) {
+                if (retry != 0) {
+                    sleep(1);
+                }
+                result = sem_trywait(&jq->job_start_wait_sem);
+            }
 
-                if (result == OK) {
-                    for (retry = 0, result = ERROR; ((result == ERROR) && (retry <= MAX_DONE_WAIT));
-                            retry++) {
-                        if (retry != 0) {
-                            _lock();
-                            if (jq->job_params.cancelled && !jq->cancel_ok) {
-                                /* The user tried to cancel and it either didn't go through
-                                 * or the printer doesn't support cancel through an OID.
-                                 * Either way it's pointless to sit here waiting for idle when
-                                 * may never come, so we'll bail out early
-                                 */
-                                retry = (MAX_DONE_WAIT + 1);
-                            }
-                            _unlock();
-                            sleep(1);
-                            if (retry == MAX_DONE_WAIT) {
-                                _lock();
-                                if (!jq->job_params.cancelled &&
-                                        (jq->blocked_reasons
-                                                & (BLOCKED_REASON_OUT_OF_PAPER
-                                                        | BLOCKED_REASON_JAMMED
-                                                        | BLOCKED_REASON_DOOR_OPEN))) {
-                                    retry = (MAX_DONE_WAIT - 1);
-                                }
-                                _unlock();
+            if (result == OK) {
+                for (retry = 0, result = ERROR; ((result == ERROR) && (retry <= MAX_DONE_WAIT));
+                        retry++) {
+                    if (retry != 0) {
+                        _lock_job(jq);
+                        if (jq->job_params.cancelled && !jq->cancel_ok) {
+                            /* The user tried to cancel and it either didn't go through
+                             * or the printer doesn't support cancel through an OID.
+                             * Either way it's pointless to sit here waiting for idle when
+                             * may never come, so we'll bail out early
+                             */
+                            retry = (MAX_DONE_WAIT + 1);
+                        }
+                        _unlock_job(jq);
+                        sleep(1);
+                        if (retry == MAX_DONE_WAIT) {
+                            _lock_job(jq);
+                            if (!jq->job_params.cancelled &&
+                                    (jq->blocked_reasons
+                                            & (BLOCKED_REASON_OUT_OF_PAPER
+                                                    | BLOCKED_REASON_JAMMED
+                                                    | BLOCKED_REASON_DOOR_OPEN))) {
+                                retry = (MAX_DONE_WAIT - 1);
                             }
+                            _unlock_job(jq);
                         }
-                        result = sem_trywait(&_job_end_wait_sem);
                     }
-                } else {
-                    LOGD("_job_thread(): the job never started");
+                    result = sem_trywait(&jq->job_end_wait_sem);
                 }
-                _lock();
+            } else {
+                LOGD("_run_job(): the job never started");
             }
+            _lock_job(jq);
+        }
 
-            // make sure page_num doesn't stay as a negative number
-            jq->job_params.page_num = MAX(0, jq->job_params.page_num);
-            _stop_status_thread(jq);
+        // make sure page_num doesn't stay as a negative number
+        jq->job_params.page_num = MAX(0, jq->job_params.page_num);
+        _stop_status_thread(jq);
 
-            if (corrupted != 0) {
-                job_result = CORRUPT;
-            }
+        if (corrupted != 0) {
+            job_result = CORRUPT;
+        }
 
-            LOGI("job_thread(): with job_state value: %d ", jq->job_state);
-            if ((jq->job_state == JOB_STATE_COMPLETED) || (jq->job_state == JOB_STATE_ERROR)
-                    || (jq->job_state == JOB_STATE_CANCELLED)
-                    || (jq->job_state == JOB_STATE_CORRUPTED)
-                    || (jq->job_state == JOB_STATE_FREE)) {
-                LOGI("_job_thread(): job finished early: do not send callback again");
-            } else {
-                switch (job_result) {
-                    case OK:
-                        if (!jq->job_params.cancelled) {
-                            jq->job_state = JOB_STATE_COMPLETED;
-                            jq->blocked_reasons = 0;
-                            break;
-                        } else {
-                            job_result = CANCELLED;
-                        }
-                    case CANCELLED:
-                        jq->job_state = JOB_STATE_CANCELLED;
-                        jq->blocked_reasons = BLOCKED_REASONS_CANCELLED;
-                        if (!jq->cancel_ok) {
-                            jq->blocked_reasons |= BLOCKED_REASON_PARTIAL_CANCEL;
-                        }
-                        break;
-                    case CORRUPT:
-                        LOGE("_job_thread(): %d file(s) in the job were corrupted", corrupted);
-                        jq->job_state = JOB_STATE_CORRUPTED;
-                        jq->blocked_reasons = 0;
-                        break;
-                    case BAD_CERTIFICATE:
-                        LOGD("_job_thread(): BAD_CERTIFICATE");
-                        jq->job_state = JOB_STATE_BAD_CERTIFICATE;
+        LOGI("_run_job(): with job_state value: %d ", jq->job_state);
+        if ((jq->job_state == JOB_STATE_COMPLETED) || (jq->job_state == JOB_STATE_ERROR)
+                || (jq->job_state == JOB_STATE_CANCELLED)
+                || (jq->job_state == JOB_STATE_CORRUPTED)
+                || (jq->job_state == JOB_STATE_FREE)) {
+            LOGI("_run_job(): job finished early: do not send callback again");
+        } else {
+            switch (job_result) {
+                case OK:
+                    if (!jq->job_params.cancelled) {
+                        jq->job_state = JOB_STATE_COMPLETED;
                         jq->blocked_reasons = 0;
                         break;
-                    case ERROR:
-                    default:
-                        LOGE("_job_thread(): ERROR plugin->start_job(%ld): %s => %s", job_handle,
-                                jq->mime_type, jq->job_params.print_format);
-                        job_result = ERROR;
-                        jq->job_state = JOB_STATE_ERROR;
-                        break;
-                } // job_result
+                    } else {
+                        job_result = CANCELLED;
+                    }
+                case CANCELLED:
+                    jq->job_state = JOB_STATE_CANCELLED;
+                    jq->blocked_reasons = BLOCKED_REASONS_CANCELLED;
+                    if (!jq->cancel_ok) {
+                        jq->blocked_reasons |= BLOCKED_REASON_PARTIAL_CANCEL;
+                    }
+                    break;
+                case CORRUPT:
+                    LOGE("_run_job(): %d file(s) in the job were corrupted", corrupted);
+                    jq->job_state = JOB_STATE_CORRUPTED;
+                    jq->blocked_reasons = 0;
+                    break;
+                case BAD_CERTIFICATE:
+                    LOGD("_run_job(): BAD_CERTIFICATE");
+                    jq->job_state = JOB_STATE_BAD_CERTIFICATE;
+                    jq->blocked_reasons = 0;
+                    break;
+                case ERROR:
+                default:
+                    LOGE("_run_job(): ERROR plugin->start_job(%ld): %s => %s", job_handle,
+                            jq->mime_type, jq->job_params.print_format);
+                    job_result = ERROR;
+                    jq->job_state = JOB_STATE_ERROR;
+                    break;
+            } // job_result
+
+            if (jq->job_params.cancelled && (jq->cancel_time.tv_sec != 0)) {
+                jq->job_params.cancel_latency_msec = (unsigned int) _msec_since(&jq->cancel_time);
+                LOGI("_run_job(): job %ld stopped %u ms after cancel%s", job_handle,
+                        jq->job_params.cancel_latency_msec,
+                        jq->job_params.aborted ? " (transport aborted)" : "");
+            }
 
-                // end of job callback
-                if (jq->cb_fn) {
-                    cb_param.param.state = JOB_DONE;
-                    cb_param.blocked_reasons = jq->blocked_reasons;
-                    cb_param.job_done_result = job_result;
+            // end of job callback
+            if (jq->cb_fn) {
+                cb_param.param.state = JOB_DONE;
+                cb_param.blocked_reasons = jq->blocked_reasons;
+                cb_param.job_done_result = job_result;
 
-                    jq->cb_fn(job_handle, (void *) &cb_param);
-                }
+                jq->cb_fn(job_handle, (void *) &cb_param);
+            }
 
-                if (jq->print_ifc != NULL) {
-                    jq->print_ifc->destroy(jq->print_ifc);
-                    jq->print_ifc = NULL;
-                }
+            if (jq->print_ifc != NULL) {
+                jq->print_ifc->destroy(jq->print_ifc);
+                jq->print_ifc = NULL;
+            }
 
-                if (jq->status_ifc != NULL) {
-                    jq->status_ifc->destroy(jq->status_ifc);
-                    jq->status_ifc = NULL;
-                }
+            if (jq->status_ifc != NULL) {
+                jq->status_ifc->destroy(jq->status_ifc);
+                jq->status_ifc = NULL;
             }
-        } else {
-            LOGI("_job_thread(): job %ld not in queue .. maybe cancelled", job_handle);
         }
+        _unlock_job(jq);
+    } else {
+        LOGI("_run_job(): job %ld not in queue .. maybe cancelled", job_handle);
+    }
+
+    LOGI("_run_job(): job finished: %ld", job_handle);
+}
+
+/*
+ * Hash the destination of a job, jobs with equal hashes are not run at the same time
+ */
+static unsigned long _printer_hash(const _job_queue_t *jq) {
+    unsigned long hash = 5381 + jq->port_num;
+    const char *c;
+
+    for (c = jq->printer_addr; *c; c++) {
+        hash = (hash * 33) ^ (unsigned char) *c;
+    }
+    for (c = jq->printer_uri; *c; c++) {
+        hash = (hash * 33) ^ (unsigned char) *c;
+    }
+    return hash;
+}
+
+/*
+ * Estimate the work in a job as pages x copies x resolution, for shortest-first ordering
+ */
+static uint64 _job_cost(const wprint_job_params_t *job_params) {
+    uint64 pages = MAX(job_params->job_pages_per_set, 1);
+    uint64 dpi = MAX(job_params->pixel_units, 1);
+    return pages * MAX(job_params->num_copies, 1) * dpi * dpi;
+}
+
+/*
+ * Priority of a waiting job including what it has gained by aging
+ */
+static int _effective_priority(const _job_sched_t *js) {
+    return js->priority + (int) (_msec_since(&js->queued) / _PRIORITY_AGING_MSEC);
+}
+
+/*
+ * Return true if job a should run before job b: higher effective priority first, then by the
+ * scheduling policy, then in start order
+ */
+static bool _runs_before(const _job_sched_t *a, int a_priority, const _job_sched_t *b,
+        int b_priority) {
+    if (a_priority != b_priority) {
+        return (a_priority > b_priority);
+    }
+    if ((_sched_policy == WPRINT_SCHED_SHORTEST_FIRST) && (a->cost != b->cost)) {
+        return (a->cost < b->cost);
+    }
+    return (a->run_seq < b->run_seq);
+}
+
+/*
+ * Return the runnable job that should go next and whose printer is not busy with another job,
+ * or NULL. Jobs for one printer run one at a time while different printers print side by side.
+ * Must be called with _q_lock held.
+ */
+static _job_sched_t *_next_runnable_job(void) {
+    _job_sched_t *next = NULL;
+    int next_priority = 0;
+    int i, j;
+
+    for (i = 0; i < _MAX_SPOOLED_JOBS; i++) {
+        _job_sched_t *js = &_job_sched[i];
+        int priority;
+        bool busy = false;
+
+        if (!js->run_pending) {
+            continue;
+        }
+        priority = _effective_priority(js);
+        if ((next != NULL) && !_runs_before(js, priority, next, next_priority)) {
+            continue;
+        }
+        for (j = 0; (j < _MAX_SPOOLED_JOBS) && !busy; j++) {
+            busy = (_job_sched[j].running && (_job_sched[j].printer_hash == js->printer_hash));
+        }
+        if (!busy) {
+            next = js;
+            next_priority = priority;
+        }
+    }
+    return next;
+}
 
+/*
+ * Job worker. Runs jobs chosen by _next_runnable_job() until wprint is stopped.
+ */
+static void *_job_worker_thread(void *param) {
+    _job_sched_t *js;
+    _job_queue_t *jq;
+    wJob_t job_handle;
+    unsigned int queue_wait_msec;
+
+    _lock();
+    while (!stop_run) {
+        js = _next_runnable_job();
+        if (js == NULL) {
+            pthread_cond_wait(&_run_cond, &_q_lock);
+            continue;
+        }
+
+        js->run_pending = false;
+        js->running = true;
+        job_handle = js->job_handle;
+        queue_wait_msec = (unsigned int) _msec_since(&js->queued);
         _unlock();
-        LOGI("_job_thread(): job finished: %ld", job_handle);
+
+        LOGI("_job_worker_thread(): job %ld waited %u ms in the spool", job_handle,
+                queue_wait_msec);
+        if ((jq = _lock_job_desc(job_handle)) != NULL) {
+            jq->job_params.queue_wait_msec = queue_wait_msec;
+            _unlock_job(jq);
+        }
+
+        // jobs cancelled while waiting are skipped by _run_job()
+        _run_job(job_handle);
+
+        _lock();
+        // the entry may already have been reused for a new job
+        if (js->job_handle == job_handle) {
+            js->running = false;
+        }
+        // the printer is free again, so its next job may be runnable now
+        pthread_cond_broadcast(&_run_cond);
     }
+    _unlock();
+    return NULL;
+}
+
+/*
+ * Takes started jobs off the message queue and hands them to the job workers
+ */
+static void *_job_thread(void *param) {
+    _msg_t msg;
+    _job_queue_t *jq;
+    unsigned long printer_hash;
+    int priority;
+    uint64 cost;
+
+    while (OK == msgQReceive(_msgQ, (char *) &msg, sizeof(msg), WAIT_FOREVER)) {
+        if (msg.id == MSG_RUN_JOB) {
+            LOGI("_job_thread(): Received message: MSG_RUN_JOB");
+        } else {
+            LOGI("_job_thread(): Received message: MSG_QUIT");
+        }
+
+        if (msg.id == MSG_QUIT) {
+            break;
+        }
 
-    sem_post(&_job_end_wait_sem);
+        jq = _lock_job_desc(msg.job_id);
+        if ((jq != NULL) && (jq->job_state != JOB_STATE_QUEUED)) {
+            _unlock_job(jq);
+            jq = NULL;
+        }
+        if (jq == NULL) {
+            LOGI("_job_thread(): job %ld not in queue .. maybe cancelled", msg.job_id);
+            continue;
+        }
+        printer_hash = _printer_hash(jq);
+        priority = jq->job_params.priority;
+        cost = _job_cost(&jq->job_params);
+        _unlock_job(jq);
+
+        _lock();
+        _job_sched[jq - _job_queue].job_handle = msg.job_id;
+        _job_sched[jq - _job_queue].printer_hash = printer_hash;
+        _job_sched[jq - _job_queue].run_seq = ++_run_seq;
+        _job_sched[jq - _job_queue].priority = priority;
+        _job_sched[jq - _job_queue].cost = cost;
+        clock_gettime(CLOCK_MONOTONIC, &_job_sched[jq - _job_queue].queued);
+        _job_sched[jq - _job_queue].run_pending = true;
+        _job_sched[jq - _job_queue].running = false;
+        pthread_cond_broadcast(&_run_cond);
+        _unlock();
+    }
     return NULL;
 }
 
 /*
- * Starts the wprint background job thread
+ * Starts the wprint background job thread and the job workers
  */
 static int _start_thread(void) {
     sigset_t allsig, oldsig;
-    int result;
+    int result, i, workers;
 
     _job_tid = pthread_self();
+    for (i = 0; i < _MAX_CONCURRENT_JOBS; i++) {
+        _worker_tids[i] = pthread_self();
+    }
 
     result = OK;
     stop_run = false;
@@ -1478,6 +1863,20 @@ static int _start_thread(void) {
         }
     }
 
+    if (result == OK) {
+        for (i = 0, workers = 0; i < _MAX_CONCURRENT_JOBS; i++) {
+            if (pthread_create(&_worker_tids[i], 0, _job_worker_thread, NULL) == 0) {
+                workers++;
+            } else {
+                LOGE("could not start job worker %d", i);
+                _worker_tids[i] = pthread_self();
+            }
+        }
+        if (workers == 0) {
+            result = ERROR;
+        }
+    }
+
     if (result == OK) {
         sched_yield();
 #if CHECK_PTHREAD_SIGMASK_STATUS
@@ -1491,10 +1890,30 @@ static int _start_thread(void) {
 }
 
 /*
- * Waits for the job thread to reach a stopped state
+ * Waits for the job thread and the job workers to reach a stopped state
  */
 static int _stop_thread(void) {
+    int i;
     stop_run = true;
+
+    // wake up idle workers and jobs waiting on their printer so they see stop_run
+    _lock();
+    pthread_cond_broadcast(&_run_cond);
+    _unlock();
+    for (i = 0; i < _MAX_SPOOLED_JOBS; i++) {
+        // a waiter checks stop_run under the entry's lock before it blocks, so taking the lock
+        // here means it either sees stop_run or gets the broadcast
+        pthread_mutex_lock(&_job_locks[i]);
+        pthread_cond_broadcast(&_job_events[i]);
+        pthread_mutex_unlock(&_job_locks[i]);
+    }
+    for (i = 0; i < _MAX_CONCURRENT_JOBS; i++) {
+        if (!pthread_equal(_worker_tids[i], pthread_self())) {
+            pthread_join(_worker_tids[i], 0);
+            _worker_tids[i] = pthread_self();
+        }
+    }
+
     if (!pthread_equal(_job_tid, pthread_self())) {
         pthread_join(_job_tid, 0);
         _job_tid = pthread_self();
@@ -1538,6 +1957,7 @@ bool wprintIsRunning() {
 
 int wprintInit(void) {
     int count = 0;
+    int i;
 
     _setup_print_plugins();
     _setup_io_plugins();
@@ -1549,12 +1969,18 @@ int wprintInit(void) {
         return ERROR;
     }
 
-    sem_init(&_job_end_wait_sem, 0, 0);
-    sem_init(&_job_start_wait_sem, 0, 0);
-
     signal(SIGPIPE, SIG_IGN); // avoid broken pipe process shutdowns
     pthread_mutexattr_settype(&_q_lock_attr, PTHREAD_MUTEX_RECURSIVE_NP);
     pthread_mutex_init(&_q_lock, &_q_lock_attr);
+    pthread_cond_init(&_run_cond, NULL);
+    pthread_condattr_t event_attr;
+    pthread_condattr_init(&event_attr);
+    pthread_condattr_setclock(&event_attr, CLOCK_MONOTONIC);
+    for (i = 0; i < _MAX_SPOOLED_JOBS; i++) {
+        pthread_mutex_init(&_job_locks[i], &_q_lock_attr);
+        pthread_cond_init(&_job_events[i], &event_attr);
+        atomic_init(&_job_slots[i], 0);
+    }
 
     if (_start_thread() != OK) {
         LOGE("could not start job thread");
@@ -1718,8 +2144,6 @@ status_t wprintGetCapabilities(const wprint_connect_info_t *connect_info,
             printer_cap->canPrintPWG);
 
     if (result == OK) {
-        memcpy(&g_printer_caps, printer_cap, sizeof(printer_capabilities_t));
-
         LOGD("\tmake: %s", printer_cap->make);
         LOGD("\thas color: %d", printer_cap->color);
         LOGD("\tcan duplex: %d", printer_cap->duplex);
@@ -1803,6 +2227,43 @@ status_t wprintGetDefaultJobParams(wprint_job_params_t *job_params) {
     return OK;
 }
 
+/*
+ * Size the job's decode memory budget, from device RAM unless one was requested, and derive
+ * the number of strip buffers in flight and (for PWG, which has no printer-preferred strip
+ * height) the strip height from it.
+ */
+static void _apply_memory_budget(wprint_job_params_t *job_params) {
+    unsigned int budget = job_params->memory_budget;
+    unsigned int factor;
+
+    if (budget == 0) {
+        // allow 1/256 of physical memory, so a 1GB device gets the default budget
+        long pages = sysconf(_SC_PHYS_PAGES);
+        long page_size = sysconf(_SC_PAGESIZE);
+        if ((pages > 0) && (page_size > 0)) {
+            budget = (unsigned int) MIN((uint64) pages * (uint64) page_size / 256,
+                    (uint64) MAX_MEMORY_BUDGET);
+        } else {
+            budget = DEFAULT_MEMORY_BUDGET;
+        }
+    }
+    budget = MAX(MIN(budget, MAX_MEMORY_BUDGET), MIN_MEMORY_BUDGET);
+    job_params->memory_budget = budget;
+
+    // buffers scale with the budget, keeping the default budget at BUFFERED_ROWS
+    job_params->send_buffers = (unsigned int) (((uint64) (BUFFERED_ROWS / STRIPE_HEIGHT) *
+            budget) / DEFAULT_MEMORY_BUDGET);
+    job_params->send_buffers = MAX(MIN(job_params->send_buffers, MAX_SEND_BUFFS), 2);
+
+    if (job_params->pcl_type == PCLPWG) {
+        factor = MAX(MIN(budget / DEFAULT_MEMORY_BUDGET, 4), 1);
+        job_params->strip_height *= factor;
+    }
+
+    LOGD("_apply_memory_budget(): budget=%u send_buffers=%u strip_height=%u", budget,
+            job_params->send_buffers, job_params->strip_height);
+}
+
 status_t wprintGetFinalJobParams(wprint_job_params_t *job_params,
         const printer_capabilities_t *printer_cap) {
     int i;
@@ -1854,6 +2315,9 @@ status_t wprintGetFinalJobParams(wprint_job_params_t *job_params,
     // set strip height
     job_params->strip_height = printer_cap->stripHeight;
 
+    // size memory use for this job
+    _apply_memory_budget(job_params);
+
     // make sure the number of copies is valid
     if (job_params->num_copies <= 0) {
         job_params->num_copies = 1;
@@ -1992,7 +2456,6 @@ wJob_t wprintStartJob(const char *printer_addr, port_t port_num,
     }
 
     plugin = plugin_search(mime_type, print_format);
-    _lock();
 
     if (plugin) {
         job_handle = _get_handle();
@@ -2008,12 +2471,9 @@ wJob_t wprintStartJob(const char *printer_addr, port_t port_num,
         print_ifc = (ifc_print_job_t *) _get_print_ifc(((port_num == 0) ? PORT_FILE : PORT_IPP));
 
         // fill out the job queue record
-        jq = _get_job_desc(job_handle);
+        jq = _lock_job_desc(job_handle);
         if (jq == NULL) {
-            _recycle_handle(job_handle);
-            job_handle = WPRINT_BAD_JOB_HANDLE;
-            _unlock();
-            return job_handle;
+            return WPRINT_BAD_JOB_HANDLE;
         }
 
         if (debugDir != NULL) {
@@ -2029,10 +2489,14 @@ wJob_t wprintStartJob(const char *printer_addr, port_t port_num,
         jq->cb_fn = cb_fn;
         jq->print_ifc = print_ifc;
         jq->cancel_ok = true; // assume cancel is ok
+        jq->remote_job_id = -1;
         jq->plugin = plugin;
         memcpy(jq->printer_uri, printer_cap->httpResource,
                 MIN(ARRAY_SIZE(printer_cap->httpResource), ARRAY_SIZE(jq->printer_uri)));
 
+        // the caller's caps belong to this job's printer; others may be queried before it runs
+        memcpy(&jq->printer_caps, printer_cap, sizeof(printer_capabilities_t));
+
         jq->status_ifc = _get_status_ifc(((port_num == 0) ? PORT_FILE : PORT_IPP));
 
         memcpy((char *) &(jq->job_params), job_params, sizeof(wprint_job_params_t));
@@ -2056,6 +2520,9 @@ wJob_t wprintStartJob(const char *printer_addr, port_t port_num,
         }
 
         jq->job_params.page_num = 0;
+        jq->job_params.aborted = false;
+        jq->job_params.cancel_latency_msec = 0;
+        jq->job_params.queue_wait_msec = 0;
         jq->job_params.print_format = print_format;
         if (strcmp(print_format, PRINT_FORMAT_PCLM) == 0) {
             if (printer_cap->canPrintPCLm || printer_cap->canPrintPDF) {
@@ -2113,8 +2580,8 @@ wJob_t wprintStartJob(const char *printer_addr, port_t port_num,
             _recycle_handle(job_handle);
             job_handle = WPRINT_BAD_JOB_HANDLE;
         }
+        _unlock_job(jq);
     }
-    _unlock();
     return job_handle;
 }
 
@@ -2123,8 +2590,7 @@ status_t wprintEndJob(wJob_t job_handle) {
     _job_queue_t *jq;
     status_t result = ERROR;
 
-    _lock();
-    jq = _get_job_desc(job_handle);
+    jq = _lock_job_desc(job_handle);
 
     if (jq) {
         // if the job is done and is to be freed, do it
@@ -2152,11 +2618,11 @@ status_t wprintEndJob(wJob_t job_handle) {
         } else {
             LOGE("job %ld cannot be ended from state %d", job_handle, jq->job_state);
         }
+        _unlock_job(jq);
     } else {
         LOGE("ERROR: wprintEndJob(%ld), job not found", job_handle);
     }
 
-    _unlock();
     return result;
 }
 
@@ -2168,23 +2634,20 @@ status_t wprintPage(wJob_t job_handle, int page_num, const char *filename, bool
     status_t result = ERROR;
     struct stat stat_buf;
 
-    _lock();
-    jq = _get_job_desc(job_handle);
-
     // use empty string to indicate EOJ for an empty job
     if (!filename) {
         filename = "";
         last_page = true;
     } else if (OK == stat(filename, &stat_buf)) {
         if (!S_ISREG(stat_buf.st_mode) || (stat_buf.st_size == 0)) {
-            _unlock();
             return result;
         }
     } else {
-        _unlock();
         return result;
     }
 
+    jq = _lock_job_desc(job_handle);
+
     // must be setup as a multi-page job, page_num must be valid, and filename must fit
     if (jq && jq->is_dir && !(jq->last_page_seen) && (((strlen(filename) < MAX_PATHNAME_LENGTH)) ||
             (jq && (strcmp(filename, "") == 0) && last_page))) {
@@ -2210,7 +2673,13 @@ status_t wprintPage(wJob_t job_handle, int page_num, const char *filename, bool
             jq->last_page_seen = true;
         }
 
-        result = msgQSend(jq->pageQ, (char *) &page, sizeof(page), NO_WAIT, MSG_Q_FIFO);
+        if (jq->job_params.cancelled) {
+            // the cancel wakeup must not queue behind pages that will be discarded
+            result = msgQSend(jq->pageQ, (char *) &page, sizeof(page), NO_WAIT, MSG_Q_URGENT);
+        } else {
+            result = msgQSend(jq->pageQ, (char *) &page, sizeof(page), _PAGE_SEND_TIMEOUT_MSEC,
+                    MSG_Q_FIFO);
+        }
     }
 
     if (result == OK) {
@@ -2222,7 +2691,9 @@ status_t wprintPage(wJob_t job_handle, int page_num, const char *filename, bool
         LOGE("wprintPage(%ld, %d, %s, %d)", job_handle, page_num, filename, last_page);
     }
 
-    _unlock();
+    if (jq) {
+        _unlock_job(jq);
+    }
     return result;
 }
 
@@ -2230,18 +2701,31 @@ status_t wprintCancelJob(wJob_t job_handle) {
     _job_queue_t *jq;
     status_t result;
 
-    _lock();
-
-    jq = _get_job_desc(job_handle);
+    jq = _lock_job_desc(job_handle);
 
     if (jq) {
         LOGI("received cancel request");
-        // send an empty page in case we're waiting on the msgQ page receive
-        if ((jq->job_state == JOB_STATE_RUNNING) || (jq->job_state == JOB_STATE_BLOCKED)) {
+        if (jq->awaiting_ready) {
+            // _run_job has claimed the job and is waiting for the printer with the job unlocked.
+            // Nothing is sent yet, so let it wake up and tear the job down itself.
+            jq->cancel_ok = true;
+            jq->job_params.cancelled = true;
+            clock_gettime(CLOCK_MONOTONIC, &jq->cancel_time);
+            jq->job_state = JOB_STATE_CANCEL_REQUEST;
+            errno = OK;
+            result = OK;
+        } else if ((jq->job_state == JOB_STATE_RUNNING) || (jq->job_state == JOB_STATE_BLOCKED)) {
+            // send an empty page in case we're waiting on the msgQ page receive
             bool enableTimeout = true;
             jq->cancel_ok = true;
             jq->job_params.cancelled = true;
+            clock_gettime(CLOCK_MONOTONIC, &jq->cancel_time);
             wprintPage(job_handle, jq->num_pages + 1, NULL, true, false, 0, 0, 0, 0);
+            if ((jq->print_ifc != NULL) && (jq->print_ifc->abort != NULL)) {
+                // stop any send in flight now instead of when its socket times out. A job whose
+                // data is all out is left to the printer and followed to its end.
+                jq->job_params.aborted = jq->print_ifc->abort(jq->print_ifc);
+            }
             if (jq->status_ifc) {
                 // are we blocked waiting for the job to start
                 if ((jq->job_state != JOB_STATE_BLOCKED) || (jq->job_params.page_num != 0)) {
@@ -2291,19 +2775,22 @@ status_t wprintCancelJob(wJob_t job_handle) {
             result = ERROR;
             errno = EBADRQC;
         }
+        if (jq->job_params.cancelled) {
+            _signal_job(jq);
+        }
+        _unlock_job(jq);
     } else {
         LOGE("could not find job");
         result = ERROR;
         errno = EBADR;
     }
 
-    _unlock();
-
     return result;
 }
 
 status_t wprintExit(void) {
     _msg_t msg;
+    int i;
 
     if (_msgQ) {
         //  toss the remaining messages in the msgQ
@@ -2312,15 +2799,11 @@ status_t wprintExit(void) {
 
         // send a quit message
         msg.id = MSG_QUIT;
-        msgQSend(_msgQ, (char *) &msg, sizeof(msg), NO_WAIT, MSG_Q_FIFO);
+        msgQSend(_msgQ, (char *) &msg, sizeof(msg), NO_WAIT, MSG_Q_URGENT);
 
         // stop the job thread
         _stop_thread();
 
-        // empty out the semaphore
-        while (sem_trywait(&_job_end_wait_sem) == OK);
-        while (sem_trywait(&_job_start_wait_sem) == OK);
-
         // receive any messages just in case
         while ((msgQNumMsgs(_msgQ) > 0)
                 && (OK == msgQReceive(_msgQ, (char *) &msg, sizeof(msg), NO_WAIT))) {}
@@ -2329,10 +2812,14 @@ status_t wprintExit(void) {
         msgQDelete(_msgQ);
         _msgQ = NULL;
 
-        sem_destroy(&_job_end_wait_sem);
-        sem_destroy(&_job_start_wait_sem);
+        pthread_cond_destroy(&_run_cond);
         pthread_mutex_destroy(&_q_lock);
+        for (i = 0; i < _MAX_SPOOLED_JOBS; i++) {
+            pthread_cond_destroy(&_job_events[i]);
+            pthread_mutex_destroy(&_job_locks[i]);
+        }
     }
+    ipp_http_pool_flush();
 
     return OK;
 }
@@ -2353,6 +2840,31 @@ void wprintSetSourceInfo(const char *appName, const char *appVersion, const char
     LOGI("App Name: '%s', Version: '%s', OS: '%s'", g_appName, g_appVersion, g_osName);
 }
 
+void wprintSetSchedulingPolicy(wprint_sched_policy_t policy) {
+    _lock();
+    _sched_policy = policy;
+    // a different policy may pick a different job next
+    pthread_cond_broadcast(&_run_cond);
+    _unlock();
+    LOGI("wprintSetSchedulingPolicy(): %s", (policy == WPRINT_SCHED_SHORTEST_FIRST) ?
+            "shortest first" : "fifo");
+}
+
+status_t wprintGetJobQueueWait(wJob_t job_handle, unsigned int *queue_wait_msec) {
+    _job_queue_t *jq;
+
+    if (queue_wait_msec == NULL) {
+        return ERROR;
+    }
+    jq = _lock_job_desc(job_handle);
+    if (jq == NULL) {
+        return ERROR;
+    }
+    *queue_wait_msec = jq->job_params.queue_wait_msec;
+    _unlock_job(jq);
+    return OK;
+}
+
 bool wprintBlankPageForPclm(const wprint_job_params_t *job_params,
         const printer_capabilities_t *printer_cap) {
     return ((job_params->job_pages_per_set % 2) &&
@@ -21,58 +21,127 @@
 #include <sys/stat.h>
 #include <unistd.h>
 #include <errno.h>
+#include <poll.h>
 #include <sys/socket.h>
+#include <sys/sendfile.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <arpa/inet.h>
 #include <fcntl.h>
 #include <netdb.h>
+#include <stdatomic.h>
+#include <pthread.h>
 
 #include "ifc_print_job.h"
 #include "wprint_debug.h"
+#include "wprint_send_queue.h"
 
 #define TAG "printer"
 
 #define DEFAULT_TIMEOUT (5000)
 
+// How long a write waits for the socket to drain before it counts as timed out
+#define WRITE_TIMEOUT_MSEC (20 * 1000)
+
+// Size and number of segments the send queue's thread writes out while the job encodes
+#ifndef PRINTER_SEND_BUFFER_SIZE
+#define PRINTER_SEND_BUFFER_SIZE (64 * 1024)
+#endif
+
+#ifndef PRINTER_SEND_QUEUE_DEPTH
+#define PRINTER_SEND_QUEUE_DEPTH 3
+#endif
+
+// Socket send buffer for raw connections, 0 to leave it to the kernel's autotuning
+#ifndef PRINTER_SNDBUF_SIZE
+#define PRINTER_SNDBUF_SIZE 0
+#endif
+
+// Keep-alive: idle seconds before the first probe, seconds between probes, and unanswered
+// probes before the connection is dropped
+#ifndef PRINTER_KEEPALIVE_IDLE_SEC
+#define PRINTER_KEEPALIVE_IDLE_SEC 30
+#endif
+
+#ifndef PRINTER_KEEPALIVE_INTERVAL_SEC
+#define PRINTER_KEEPALIVE_INTERVAL_SEC 10
+#endif
+
+#ifndef PRINTER_KEEPALIVE_COUNT
+#define PRINTER_KEEPALIVE_COUNT 3
+#endif
+
+// Progress of the job's data, see _abort()
+typedef enum {
+    SEND_OPEN, // still going out
+    SEND_DONE, // all of it written
+    SEND_ABORTED, // cut short by _abort()
+} send_state_t;
+
 typedef struct {
     ifc_print_job_t ifc;
     int port_num;
+    // psock is opened and closed on the job thread; sock_lock keeps _abort() from shutting down
+    // a descriptor that was closed and reused meanwhile
     int psock;
+    pthread_mutex_t sock_lock;
     wJob_t job_id;
-    status_t job_status;
+    volatile status_t job_status;
     int timeout_enabled;
+    atomic_int send_state;
+    send_queue_t *send_queue;
 } _print_job_t;
 
+static bool _aborted(_print_job_t *print_job) {
+    return (atomic_load(&print_job->send_state) == SEND_ABORTED);
+}
+
 static long int _wprint_timeout_msec = DEFAULT_TIMEOUT;
 
+static status_t _write_segment(void *param, const char *buffer, size_t length);
+
 static status_t _init(const ifc_print_job_t *this_p, const char *printer_addr, int port,
         const char *printer_uri, bool use_secure_uri) {
     _print_job_t *print_job = IMPL(_print_job_t, ifc, this_p);
+    int psock;
 
     if (!print_job) return ERROR;
 
     // if a print-to-file is requested, open a file
 
     if (print_job->port_num == PORT_FILE) {
-        print_job->psock = open(printer_addr, O_CREAT | O_WRONLY | O_TRUNC,
+        psock = open(printer_addr, O_CREAT | O_WRONLY | O_TRUNC,
                 S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
 
-        if (print_job->psock == ERROR) {
+        if (psock == ERROR) {
             LOGE("cannot create output file : %s, %s", printer_addr, strerror(errno));
         } else {
             LOGI("opened %s for writing", printer_addr);
         }
     } else {
         // open a socket to the printer:port
-        print_job->psock = wConnect(printer_addr, print_job->port_num, _wprint_timeout_msec);
+        psock = wConnect(printer_addr, print_job->port_num, _wprint_timeout_msec);
     }
+    pthread_mutex_lock(&print_job->sock_lock);
+    print_job->psock = psock;
+    pthread_mutex_unlock(&print_job->sock_lock);
 
     print_job->job_status = ((print_job->psock != -1) ? OK : ERROR);
+    if ((print_job->job_status == OK) && (print_job->send_queue == NULL)) {
+        print_job->send_queue = send_queue_create(PRINTER_SEND_QUEUE_DEPTH,
+                PRINTER_SEND_BUFFER_SIZE, _write_segment, print_job);
+        if (print_job->send_queue == NULL) {
+            LOGE("_init(): no send queue, writing synchronously");
+        }
+    }
     return print_job->job_status;
 }
 
 static void _destroy(const ifc_print_job_t *this_p) {
     _print_job_t *print_job = IMPL(_print_job_t, ifc, this_p);
     if (print_job) {
+        send_queue_destroy(print_job->send_queue);
+        pthread_mutex_destroy(&print_job->sock_lock);
         free(print_job);
     }
 }
@@ -82,78 +151,224 @@ static int _start_job(const ifc_print_job_t *this_p, const wprint_job_params_t *
     _print_job_t *print_job = IMPL(_print_job_t, ifc, this_p);
 
     if (print_job) {
+        // another copy sends its data afresh, but an aborted job stays aborted
+        int done = SEND_DONE;
+        atomic_compare_exchange_strong(&print_job->send_state, &done, SEND_OPEN);
         return OK;
     } else {
         return ERROR;
     }
 }
 
-static int _send_data(const ifc_print_job_t *this_p, const char *buffer, size_t length) {
+/*
+ * Waits until the non-blocking socket takes more data. A timeout only fails the write when
+ * timeouts are enabled; keep-alive still catches a printer that has gone away.
+ */
+static status_t _wait_writable(_print_job_t *print_job) {
+    struct pollfd pfd;
+    int result;
+
+    pfd.fd = print_job->psock;
+    pfd.events = POLLOUT;
+    pfd.revents = 0;
+    result = poll(&pfd, 1, WRITE_TIMEOUT_MSEC);
+    if (result < 0) {
+        if (errno == EINTR) {
+            return OK;
+        }
+        LOGE("poll returned an error (%d)", errno);
+        return ERROR;
+    } else if (result == 0) {
+        if (print_job->timeout_enabled) {
+            LOGE("poll timed out");
+            return ERROR;
+        }
+        return OK;
+    } else if (pfd.revents & (POLLERR | POLLHUP | POLLNVAL)) {
+        LOGE("connection lost (revents 0x%x)", pfd.revents);
+        return ERROR;
+    }
+    return OK;
+}
+
+/*
+ * Corks the socket while a segment is written so it leaves in full frames, and uncorks it
+ * afterwards so the tail is not held back
+ */
+static void _set_cork(_print_job_t *print_job, int on) {
+#ifdef TCP_CORK
+    if (print_job->port_num != PORT_FILE) {
+        setsockopt(print_job->psock, IPPROTO_TCP, TCP_CORK, &on, sizeof(on));
+    }
+#endif
+}
+
+/*
+ * Writes all of buffer to the socket or file, returning OK or ERROR
+ */
+static status_t _write_all(_print_job_t *print_job, const char *buffer, size_t length) {
     status_t retval = OK;
-    size_t length_in = length;
     ssize_t bytes_written;
+
+    _set_cork(print_job, 1);
+    while ((length > 0) && (retval == OK) && !_aborted(print_job)) {
+        if (print_job->port_num == PORT_FILE) {
+            bytes_written = write(print_job->psock, buffer, length);
+        } else {
+            bytes_written = send(print_job->psock, buffer, length, MSG_NOSIGNAL);
+        }
+
+        if (bytes_written >= 0) {
+            length -= bytes_written;
+            buffer += bytes_written;
+        } else if ((errno == EAGAIN) || (errno == EWOULDBLOCK)) {
+            retval = _wait_writable(print_job);
+        } else if (errno != EINTR) {
+            LOGE("unable to transmit %zu bytes of data (errno %d)", length, errno);
+            retval = ERROR;
+        }
+    }
+    _set_cork(print_job, 0);
+
+    if (_aborted(print_job)) {
+        LOGD("send aborted with %zu bytes left", length);
+        retval = ERROR;
+    }
+    return retval;
+}
+
+/*
+ * Send queue callback, run on the queue's sender thread
+ */
+static status_t _write_segment(void *param, const char *buffer, size_t length) {
+    // job_status belongs to the job thread; a failure reaches it through the queue
+    return _write_all((_print_job_t *) param, buffer, length);
+}
+
+/*
+ * Copies the data into the send queue so the job can go on encoding while the queue's thread
+ * writes it out. Without a queue the data is written here.
+ */
+static int _send_data(const ifc_print_job_t *this_p, const char *buffer, size_t length) {
+    status_t retval = OK;
     _print_job_t *print_job = IMPL(_print_job_t, ifc, this_p);
 
     if (this_p && buffer && (print_job->job_status == OK)) {
-        if (print_job->port_num == PORT_FILE) {
-            while ((length > 0) && (retval != -1)) {
-                bytes_written = write(print_job->psock, buffer, length);
-                if (bytes_written < 0) {
-                    retval = ERROR;
-                } else {
-                    length -= bytes_written;
-                    buffer += bytes_written;
-                }
+        if (print_job->send_queue != NULL) {
+            retval = send_queue_write(print_job->send_queue, buffer, length);
+            if (retval != OK) {
+                print_job->job_status = retval;
             }
         } else {
-            fd_set w_fds;
-            int selreturn;
-            struct timeval timeout;
-
-            while ((length > 0) && (retval == OK)) {
-                FD_ZERO(&w_fds);
-                FD_SET(print_job->psock, &w_fds);
-                timeout.tv_sec = 20;
-                timeout.tv_usec = 0;
-                selreturn = select(print_job->psock + 1, NULL, &w_fds, NULL, &timeout);
-                if (selreturn < 0) {
-                    LOGE("select returned an errnor (%d)", errno);
-                    retval = ERROR;
-                } else if (selreturn > 0) {
-                    if (FD_ISSET(print_job->psock, &w_fds)) {
-                        bytes_written = write(print_job->psock, buffer, length);
-                        if (bytes_written < 0) {
-                            LOGE("unable to transmit %zu bytes of data (errno %d)", length, errno);
-                            retval = ERROR;
-                        } else {
-                            length -= bytes_written;
-                            buffer += bytes_written;
-                        }
-                    } else {
-                        LOGE("select returned OK, but fd is not set");
-                        retval = ERROR;
-                    }
-                } else {
-                    retval = (print_job->timeout_enabled ? ERROR : OK);
-                    if (retval == ERROR) {
-                        LOGE("select timed out");
-                    }
-                }
-            }
+            retval = _write_all(print_job, buffer, length);
+            print_job->job_status = retval;
         }
-
-        print_job->job_status = retval;
     } else {
         retval = ERROR;
     }
-    return ((retval == OK) ? length_in : (int)ERROR);
+    return ((retval == OK) ? length : (int)ERROR);
+}
+
+/*
+ * Hands the partly filled segment to the sender at the end of a page
+ */
+static status_t _flush(const ifc_print_job_t *this_p) {
+    _print_job_t *print_job = IMPL(_print_job_t, ifc, this_p);
+    if (print_job && (print_job->send_queue != NULL) && (print_job->job_status == OK)) {
+        print_job->job_status = send_queue_flush(print_job->send_queue, NULL);
+    }
+    return (print_job ? print_job->job_status : ERROR);
+}
+
+/*
+ * Copies the rest of the file through send_data, where sendfile() cannot be used
+ */
+static int _copy_file(const ifc_print_job_t *this_p, int fd) {
+    char buffer[4096];
+    ssize_t rbytes;
+    int nbytes = 0;
+
+    while ((rbytes = read(fd, buffer, sizeof(buffer))) > 0) {
+        if (_send_data(this_p, buffer, rbytes) != rbytes) {
+            return ERROR;
+        }
+        nbytes += rbytes;
+    }
+    return ((rbytes < 0) ? (int) ERROR : nbytes);
+}
+
+/*
+ * Sends the rest of an open file. Queued data goes out first, then the file goes from the page
+ * cache straight to the socket or output file with sendfile().
+ */
+static int _send_file(const ifc_print_job_t *this_p, int fd) {
+    _print_job_t *print_job = IMPL(_print_job_t, ifc, this_p);
+    struct stat file_stat;
+    off_t start, offset;
+    ssize_t sent;
+    status_t retval = OK;
+
+    if (!this_p || (fd < 0) || (print_job->job_status != OK)) {
+        return ERROR;
+    }
+
+    if ((print_job->send_queue != NULL) && (send_queue_drain(print_job->send_queue) != OK)) {
+        print_job->job_status = ERROR;
+        return ERROR;
+    }
+
+    if ((fstat(fd, &file_stat) < 0) || ((start = lseek(fd, 0, SEEK_CUR)) < 0)) {
+        return _copy_file(this_p, fd);
+    }
+
+    offset = start;
+    _set_cork(print_job, 1);
+    while ((offset < file_stat.st_size) && (retval == OK) && !_aborted(print_job)) {
+        sent = sendfile(print_job->psock, fd, &offset, file_stat.st_size - offset);
+        if (sent == 0) {
+            // the file got shorter
+            break;
+        } else if (sent > 0) {
+            continue;
+        } else if ((errno == EAGAIN) || (errno == EWOULDBLOCK)) {
+            retval = _wait_writable(print_job);
+        } else if (((errno == EINVAL) || (errno == ENOSYS)) && (offset == start)) {
+            // this pair of descriptors cannot do sendfile()
+            _set_cork(print_job, 0);
+            return _copy_file(this_p, fd);
+        } else if (errno != EINTR) {
+            LOGE("sendfile failed after %lld bytes (errno %d)", (long long) (offset - start),
+                    errno);
+            retval = ERROR;
+        }
+    }
+    _set_cork(print_job, 0);
+    lseek(fd, offset, SEEK_SET);
+
+    if (_aborted(print_job)) {
+        retval = ERROR;
+    }
+    if (retval != OK) {
+        print_job->job_status = retval;
+        return ERROR;
+    }
+    return (int) (offset - start);
 }
 
 static int _end_job(const ifc_print_job_t *this_p) {
     _print_job_t *print_job = IMPL(_print_job_t, ifc, this_p);
     if (print_job) {
+        // everything queued has to reach the printer before the connection closes
+        if ((print_job->send_queue != NULL) && (send_queue_drain(print_job->send_queue) != OK)) {
+            print_job->job_status = ERROR;
+        } else {
+            int open = SEND_OPEN;
+            atomic_compare_exchange_strong(&print_job->send_state, &open, SEND_DONE);
+        }
+        pthread_mutex_lock(&print_job->sock_lock);
         close(print_job->psock);
         print_job->psock = -1;
+        pthread_mutex_unlock(&print_job->sock_lock);
         return print_job->job_status;
     }
     return ERROR;
@@ -166,6 +381,28 @@ static void _enable_timeout(const ifc_print_job_t *this_p, int enable) {
     }
 }
 
+static bool _abort(const ifc_print_job_t *this_p) {
+    _print_job_t *print_job = IMPL(_print_job_t, ifc, this_p);
+    if (print_job) {
+        int open = SEND_OPEN;
+        if (!atomic_compare_exchange_strong(&print_job->send_state, &open, SEND_ABORTED)) {
+            // either all the data is out already, or it was cut short before
+            return (open == SEND_ABORTED);
+        }
+        if (print_job->send_queue != NULL) {
+            send_queue_abort(print_job->send_queue);
+        }
+        // wakes a writer blocked in select() or write()
+        pthread_mutex_lock(&print_job->sock_lock);
+        if ((print_job->port_num != PORT_FILE) && (print_job->psock != -1)) {
+            shutdown(print_job->psock, SHUT_RDWR);
+        }
+        pthread_mutex_unlock(&print_job->sock_lock);
+        return true;
+    }
+    return false;
+}
+
 static int _check_status(const ifc_print_job_t *this_p) {
     _print_job_t *print_job = IMPL(_print_job_t, ifc, this_p);
 
@@ -174,12 +411,38 @@ static int _check_status(const ifc_print_job_t *this_p) {
     return ERROR;
 }
 
+/*
+ * Sets the options the print data stream wants on a connected printer socket
+ */
+static void _set_socket_options(int psock) {
+    int on = 1;
+
+    // data goes out in whole segments, so Nagle would only hold back the tail of each one
+    setsockopt(psock, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+
+    // notice a printer that went away mid-job rather than waiting on it forever
+    setsockopt(psock, SOL_SOCKET, SO_KEEPALIVE, &on, sizeof(on));
+#ifdef TCP_KEEPIDLE
+    int keepalive_idle = PRINTER_KEEPALIVE_IDLE_SEC;
+    int keepalive_interval = PRINTER_KEEPALIVE_INTERVAL_SEC;
+    int keepalive_count = PRINTER_KEEPALIVE_COUNT;
+    setsockopt(psock, IPPROTO_TCP, TCP_KEEPIDLE, &keepalive_idle, sizeof(keepalive_idle));
+    setsockopt(psock, IPPROTO_TCP, TCP_KEEPINTVL, &keepalive_interval,
+            sizeof(keepalive_interval));
+    setsockopt(psock, IPPROTO_TCP, TCP_KEEPCNT, &keepalive_count, sizeof(keepalive_count));
+#endif
+
+    if (PRINTER_SNDBUF_SIZE > 0) {
+        int sndbuf = PRINTER_SNDBUF_SIZE;
+        setsockopt(psock, SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf));
+    }
+}
+
 int wConnect(const char *printer_addr, int port_num, long int timeout_msec) {
     struct sockaddr_in sin;
     struct hostent *h_info;
-    fd_set fdset;
-    struct timeval tv;
-    int psock;
+    struct pollfd pfd;
+    int psock, result;
 
     psock = socket(PF_INET, SOCK_STREAM, 0);
     if (psock == ERROR) return ERROR;
@@ -203,51 +466,49 @@ int wConnect(const char *printer_addr, int port_num, long int timeout_msec) {
         }
     }
 
-    // temporarily set the socket to NONBLOCK'ing mode to catch timeout
-    fcntl(psock, F_SETFL, O_NONBLOCK);
+    // the socket stays non-blocking: connect and writes wait in poll() so they can time out
+    fcntl(psock, F_SETFL, fcntl(psock, F_GETFL) | O_NONBLOCK);
 
     // open a TCP connection to the printer:port
-    int socketConnect = connect(psock, (const struct sockaddr *) &sin, sizeof(sin));
-    if (socketConnect == 0) {
-        FD_ZERO(&fdset);
-        FD_SET(psock, &fdset);
-
-        tv.tv_sec = (timeout_msec / 1000);
-        tv.tv_usec = (timeout_msec % 1000) * 1000;
-
-        /*  check if the socket is connected and available for write within
-         *  the specified timeout period
-         */
-        if (select(psock + 1, NULL, &fdset, NULL, &tv) == 1) {
-            int so_error, flags;
-            socklen_t len = sizeof so_error;
+    result = connect(psock, (const struct sockaddr *) &sin, sizeof(sin));
+    if ((result < 0) && (errno == EINPROGRESS)) {
+        pfd.fd = psock;
+        pfd.events = POLLOUT;
+        pfd.revents = 0;
+        do {
+            result = poll(&pfd, 1, (int) timeout_msec);
+        } while ((result < 0) && (errno == EINTR));
+
+        if (result == 1) {
+            int so_error = 0;
+            socklen_t len = sizeof(so_error);
 
             getsockopt(psock, SOL_SOCKET, SO_ERROR, &so_error, &len);
-            if (so_error == 0) {
-                // restore the socket back to normal blocking mode
-
-                flags = fcntl(psock, F_GETFL);
-                fcntl(psock, F_SETFL, flags & ~O_NONBLOCK);
-
-                LOGI("connected to %s:%d", printer_addr, port_num);
-            } else {
-                close(psock);
-                psock = ERROR;
-                LOGE("cannot connect on %s:%d, %s", printer_addr, port_num, strerror(errno));
-            }
+            result = ((so_error == 0) ? 0 : -1);
+            errno = so_error;
         } else {
             LOGE("connecting to %s:%d .. timed out after %ld milliseconds", printer_addr,
                     port_num, timeout_msec);
             close(psock);
-            psock = ERROR;
+            return ERROR;
         }
     }
+
+    if (result != 0) {
+        LOGE("cannot connect on %s:%d, %s", printer_addr, port_num, strerror(errno));
+        close(psock);
+        return ERROR;
+    }
+
+    _set_socket_options(psock);
+    LOGI("connected to %s:%d", printer_addr, port_num);
     return psock;
 }
 
 static const ifc_print_job_t _print_job_ifc = {.init = _init, .validate_job = NULL,
         .start_job = _start_job, .send_data = _send_data, .end_job = _end_job, .destroy = _destroy,
-        .enable_timeout = _enable_timeout, .check_status = _check_status,};
+        .enable_timeout = _enable_timeout, .check_status = _check_status, .abort = _abort,
+        .flush = _flush, .send_file = _send_file,};
 
 const ifc_print_job_t *printer_connect(int port_num) {
     _print_job_t *print_job;
@@ -256,9 +517,12 @@ const ifc_print_job_t *printer_connect(int port_num) {
     if (print_job) {
         print_job->port_num = port_num;
         print_job->psock = -1;
+        pthread_mutex_init(&print_job->sock_lock, NULL);
         print_job->job_id = WPRINT_BAD_JOB_HANDLE;
         print_job->job_status = ERROR;
         print_job->timeout_enabled = 0;
+        atomic_init(&print_job->send_state, SEND_OPEN);
+        print_job->send_queue = NULL;
         memcpy(&print_job->ifc, &_print_job_ifc, sizeof(ifc_print_job_t));
 
         return &print_job->ifc;
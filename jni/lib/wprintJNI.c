@@ -67,6 +67,7 @@ static jfieldID _LocalJobParamsField__source_width;
 static jfieldID _LocalJobParamsField__source_height;
 static jfieldID _LocalJobParamsField__shared_photo;
 static jfieldID _LocalJobParamsField__preserve_scaling;
+static jfieldID _LocalJobParamsField__memory_budget;
 
 static jclass _LocalPrinterCapabilitiesClass;
 static jfieldID _LocalPrinterCapabilitiesField__name;
@@ -94,6 +95,7 @@ static jfieldID _JobCallbackParamsField__jobState;
 static jfieldID _JobCallbackParamsField__jobDoneResult;
 static jfieldID _JobCallbackParamsField__blockedReasons;
 static jfieldID _JobCallbackParamsField__certificate;
+static jfieldID _JobCallbackParamsField__queueWaitMsec;
 
 static jclass _PrintServiceStringsClass;
 static jfieldID _PrintServiceStringsField__JOB_STATE_QUEUED;
@@ -536,6 +538,8 @@ static void _initJNI(JNIEnv *env, jobject callbackReceiver, jstring fakeDir) {
                                                             "source_width", "F");
     _LocalJobParamsField__source_height = (*env)->GetFieldID(env, _LocalJobParamsClass,
                                                              "source_height", "F");
+    _LocalJobParamsField__memory_budget = (*env)->GetFieldID(env, _LocalJobParamsClass,
+            "memory_budget", "I");
 
     // fill out static accessors for LocalPrinterCapabilities
     _LocalPrinterCapabilitiesClass = (jclass) (*env)->NewGlobalRef(env, (*env)->FindClass(
@@ -581,6 +585,8 @@ static void _initJNI(JNIEnv *env, jobject callbackReceiver, jstring fakeDir) {
             env, _JobCallbackParamsClass, "blockedReasons", "[Ljava/lang/String;");
     _JobCallbackParamsField__certificate = (*env)->GetFieldID(
             env, _JobCallbackParamsClass, "certificate", "[B");
+    _JobCallbackParamsField__queueWaitMsec = (*env)->GetFieldID(
+            env, _JobCallbackParamsClass, "queueWaitMsec", "I");
 
     if (callbackReceiver) {
         _callbackReceiver = (jobject) (*env)->NewGlobalRef(env, callbackReceiver);
@@ -975,6 +981,9 @@ static int _convertJobParams_to_C(JNIEnv *env, jobject javaJobParams,
             env, javaJobParams, _LocalJobParamsField__source_width);
     wprintJobParams->preserve_scaling = (bool) (*env)->GetBooleanField(env, javaJobParams,
             _LocalJobParamsField__preserve_scaling);
+    jint memoryBudget = (*env)->GetIntField(env, javaJobParams,
+            _LocalJobParamsField__memory_budget);
+    wprintJobParams->memory_budget = (memoryBudget > 0) ? (unsigned int) memoryBudget : 0;
 
     if ((*env)->GetBooleanField(env, javaJobParams, _LocalJobParamsField__portrait_mode)) {
         wprintJobParams->render_flags |= RENDER_FLAG_PORTRAIT_MODE;
@@ -1116,6 +1125,8 @@ static int _covertJobParams_to_Java(JNIEnv *env, jobject javaJobParams,
             (int) wprintJobParams->render_flags);
     (*env)->SetIntField(env, javaJobParams, _LocalJobParamsField__pdf_render_resolution,
             wprintJobParams->pdf_render_resolution);
+    (*env)->SetIntField(env, javaJobParams, _LocalJobParamsField__memory_budget,
+            (int) wprintJobParams->memory_budget);
     (*env)->SetBooleanField(env, javaJobParams, _LocalJobParamsField__fit_to_page,
             (jboolean) ((wprintJobParams->render_flags & AUTO_FIT_RENDER_FLAGS) ==
                     AUTO_FIT_RENDER_FLAGS));
@@ -1628,6 +1639,12 @@ static void _wprint_callback_fn(wJob_t job_handle, void *param) {
         (*env)->SetIntField(env, callbackParams, _JobCallbackParamsField__jobId,
                 (jint) job_handle);
 
+        unsigned int queue_wait_msec;
+        if (wprintGetJobQueueWait(job_handle, &queue_wait_msec) == OK) {
+            (*env)->SetIntField(env, callbackParams, _JobCallbackParamsField__queueWaitMsec,
+                    (jint) queue_wait_msec);
+        }
+
         if (cb_param->certificate) {
             LOGI("_wprint_callback_fn: copying certificate len=%d", cb_param->certificate_len);
             jbyteArray certificate = (*env)->NewByteArray(env, cb_param->certificate_len);
@@ -2037,6 +2054,16 @@ JNIEXPORT jint JNICALL Java_com_android_bips_ipp_Backend_nativeExit(JNIEnv *env,
     return wprintExit();
 }
 
+/*
+ * JNI call to wprint to select how spooled jobs of equal priority are ordered
+ */
+JNIEXPORT void JNICALL Java_com_android_bips_ipp_Backend_nativeSetSchedulingPolicy(
+        JNIEnv *env, jobject obj, jint policy) {
+    LOGI("nativeSetSchedulingPolicy, JNIenv is %p", env);
+    wprintSetSchedulingPolicy((policy == WPRINT_SCHED_SHORTEST_FIRST) ?
+            WPRINT_SCHED_SHORTEST_FIRST : WPRINT_SCHED_FIFO);
+}
+
 /*
  * Sets app name/version and os name
  */
@@ -22,35 +22,62 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <errno.h>
+#include <time.h>
 #include <pthread.h>
-#include <semaphore.h>
 
 #include "wprint_msgq.h"
 #include "wprint_debug.h"
 
 #define TAG "wprint_msgq"
 
-#define _SEM_NAME_LENGTH    16
+// Extra slots past max_msgs that only MSG_Q_URGENT messages may use, so a full queue can
+// still take a cancel or quit request
+#define _URGENT_RESERVE     2
 
 typedef struct {
     msg_q_id msgq_id;
-    char name[_SEM_NAME_LENGTH];
     int max_msgs;
     int max_msg_length;
+    int num_slots;
     int num_msgs;
-    sem_t sem_count;
-    sem_t *sem_ptr;
     pthread_mutex_t mutex;
     pthread_mutexattr_t mutexattr;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
     unsigned long read_offset;
     unsigned long write_offset;
 } _msgq_hdr_t;
 
+/*
+ * Waits on cond until signalled or the timeout expires. timeout is NO_WAIT, WAIT_FOREVER or a
+ * number of milliseconds measured from deadline_base. Returns 0 or ETIMEDOUT.
+ */
+static int _wait(_msgq_hdr_t *msgq, pthread_cond_t *cond, int timeout,
+        const struct timespec *deadline_base) {
+    struct timespec deadline;
+
+    if (timeout == NO_WAIT) {
+        return ETIMEDOUT;
+    } else if (timeout == WAIT_FOREVER) {
+        return pthread_cond_wait(cond, &msgq->mutex);
+    }
+
+    deadline.tv_sec = deadline_base->tv_sec + (timeout / 1000);
+    deadline.tv_nsec = deadline_base->tv_nsec + ((timeout % 1000) * 1000000L);
+    if (deadline.tv_nsec >= 1000000000L) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+    return pthread_cond_timedwait(cond, &msgq->mutex, &deadline);
+}
+
 msg_q_id msgQCreate(int max_msgs, int max_msg_length) {
     _msgq_hdr_t *msgq;
     int msgq_size;
+    pthread_condattr_t condattr;
 
-    msgq_size = sizeof(_msgq_hdr_t) + max_msgs * max_msg_length;
+    msgq_size = sizeof(_msgq_hdr_t) + (max_msgs + _URGENT_RESERVE) * max_msg_length;
     msgq = (_msgq_hdr_t *) malloc((size_t)msgq_size);
 
     if (msgq) {
@@ -58,6 +85,7 @@ msg_q_id msgQCreate(int max_msgs, int max_msg_length) {
         msgq->msgq_id = (msg_q_id) msgq;
         msgq->max_msgs = max_msgs;
         msgq->max_msg_length = max_msg_length;
+        msgq->num_slots = max_msgs + _URGENT_RESERVE;
         msgq->num_msgs = 0;
 
         // create a mutex to protect access to this structure
@@ -65,9 +93,12 @@ msg_q_id msgQCreate(int max_msgs, int max_msg_length) {
         pthread_mutexattr_settype(&(msgq->mutexattr), PTHREAD_MUTEX_RECURSIVE_NP);
         pthread_mutex_init(&msgq->mutex, &msgq->mutexattr);
 
-        // create a counting semaphore
-        msgq->sem_ptr = &msgq->sem_count;
-        sem_init(msgq->sem_ptr, 0, 0); // PRIVATE, EMPTY
+        // timed waits are measured on the monotonic clock
+        pthread_condattr_init(&condattr);
+        pthread_condattr_setclock(&condattr, CLOCK_MONOTONIC);
+        pthread_cond_init(&msgq->not_empty, &condattr);
+        pthread_cond_init(&msgq->not_full, &condattr);
+        pthread_condattr_destroy(&condattr);
 
         msgq->read_offset = 0;
         msgq->write_offset = 0;
@@ -84,7 +115,8 @@ status_t msgQDelete(msg_q_id msgQ) {
             LOGE("Warning msgQDelete() called on queue with %d messages", msgq->num_msgs);
         }
 
-        sem_destroy(&(msgq->sem_count));
+        pthread_cond_destroy(&(msgq->not_empty));
+        pthread_cond_destroy(&(msgq->not_full));
         pthread_mutex_unlock(&(msgq->mutex));
         pthread_mutex_destroy(&(msgq->mutex));
         free((void *) msgq);
@@ -96,21 +128,44 @@ status_t msgQSend(msg_q_id msgQ, const char *buffer, unsigned long nbytes, int t
         int priority) {
     _msgq_hdr_t *msgq = (msg_q_id) msgQ;
     char *msg_loc;
+    struct timespec start;
+    int limit;
+    int wait_result = 0;
     status_t result = ERROR;
 
     // validate function arguments
-    if (msgq && (timeout == NO_WAIT) && (priority == MSG_Q_FIFO)) {
+    if (msgq && ((timeout >= 0) || (timeout == WAIT_FOREVER))
+            && ((priority == MSG_Q_FIFO) || (priority == MSG_Q_URGENT))) {
+        if (nbytes > msgq->max_msg_length) {
+            return ERROR;
+        }
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        limit = ((priority == MSG_Q_URGENT) ? msgq->num_slots : msgq->max_msgs);
+
         pthread_mutex_lock(&(msgq->mutex));
 
-        // ensure the message conforms to size limits and there is room in the msgQ
-        if ((nbytes <= msgq->max_msg_length) && (msgq->num_msgs < msgq->max_msgs)) {
-            msg_loc = (char *) msgq + sizeof(_msgq_hdr_t) +
-                    (msgq->write_offset * msgq->max_msg_length);
+        // block for room in the msgQ, up to the timeout
+        while ((msgq->num_msgs >= limit) && (wait_result == 0)) {
+            wait_result = _wait(msgq, &msgq->not_full, timeout, &start);
+        }
+
+        if (msgq->num_msgs < limit) {
+            if (priority == MSG_Q_URGENT) {
+                // jump ahead of everything already queued
+                msgq->read_offset = (msgq->read_offset + msgq->num_slots - 1) % msgq->num_slots;
+                msg_loc = (char *) msgq + sizeof(_msgq_hdr_t) +
+                        (msgq->read_offset * msgq->max_msg_length);
+            } else {
+                msg_loc = (char *) msgq + sizeof(_msgq_hdr_t) +
+                        (msgq->write_offset * msgq->max_msg_length);
+                msgq->write_offset = (msgq->write_offset + 1) % msgq->num_slots;
+            }
             memcpy(msg_loc, buffer, nbytes);
-            msgq->write_offset = (msgq->write_offset + 1) % msgq->max_msgs;
             msgq->num_msgs++;
-            sem_post(msgq->sem_ptr);
+            pthread_cond_signal(&msgq->not_empty);
             result = OK;
+        } else {
+            errno = ETIMEDOUT;
         }
 
         pthread_mutex_unlock(&(msgq->mutex));
@@ -121,26 +176,30 @@ status_t msgQSend(msg_q_id msgQ, const char *buffer, unsigned long nbytes, int t
 status_t msgQReceive(msg_q_id msgQ, char *buffer, unsigned long max_nbytes, int timeout) {
     _msgq_hdr_t *msgq = (msg_q_id) msgQ;
     char *msg_loc;
+    struct timespec start;
+    int wait_result = 0;
     status_t result = ERROR;
 
-    if (msgq && buffer && ((timeout == WAIT_FOREVER) || (timeout == NO_WAIT))) {
-        if (timeout == WAIT_FOREVER) {
-            result = (status_t) sem_wait(msgq->sem_ptr);
-        } else {
-            /* timeout is NO_WAIT */
-            result = (status_t) sem_trywait(msgq->sem_ptr);
-        }
+    if (msgq && buffer && ((timeout >= 0) || (timeout == WAIT_FOREVER))) {
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        pthread_mutex_lock(&(msgq->mutex));
 
-        if (result == 0) {
-            pthread_mutex_lock(&(msgq->mutex));
+        while ((msgq->num_msgs == 0) && (wait_result == 0)) {
+            wait_result = _wait(msgq, &msgq->not_empty, timeout, &start);
+        }
 
+        if (msgq->num_msgs > 0) {
             msg_loc = (char *) msgq + sizeof(_msgq_hdr_t) +
                     (msgq->read_offset * msgq->max_msg_length);
-            memcpy(buffer, msg_loc, max_nbytes);
-            msgq->read_offset = (msgq->read_offset + 1) % msgq->max_msgs;
+            memcpy(buffer, msg_loc, MIN(max_nbytes, msgq->max_msg_length));
+            msgq->read_offset = (msgq->read_offset + 1) % msgq->num_slots;
             msgq->num_msgs--;
-            pthread_mutex_unlock(&(msgq->mutex));
+            pthread_cond_broadcast(&msgq->not_full);
+            result = OK;
+        } else {
+            errno = ETIMEDOUT;
         }
+        pthread_mutex_unlock(&(msgq->mutex));
     }
     return result;
 }
@@ -0,0 +1,305 @@
+/*
+ * Copyright (C) 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "wprint_send_queue.h"
+#include "wprint_debug.h"
+
+#define TAG "wprint_send_queue"
+
+typedef struct {
+    char *data;
+    size_t length;
+} _segment_t;
+
+/*
+ * Segments are used round robin. The writer fills segments[head % depth] while fewer than depth
+ * segments are queued; the sender writes segments[tail % depth].
+ */
+struct send_queue_st {
+    pthread_t tid;
+    pthread_mutex_t lock;
+    pthread_cond_t queued_cond; // a segment was queued or the queue is stopping
+    pthread_cond_t written_cond; // a segment was written or dropped
+
+    send_queue_write_t write_fn;
+    void *param;
+
+    unsigned int depth;
+    size_t segment_size;
+    unsigned int head;
+    unsigned int tail;
+    unsigned int flushed_head;
+    bool filling;
+    bool failed;
+    bool aborted;
+    bool stopping;
+
+    // Metrics since the last drain
+    unsigned int segments;
+    unsigned long long bytes;
+    unsigned long long occupancy_sum;
+    unsigned int occupancy_max;
+    unsigned long long writer_wait_ms;
+    unsigned long long sender_idle_ms;
+
+    _segment_t segments_buf[];
+};
+
+static unsigned long long _now_ms(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (unsigned long long) now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+static void *_sender_thread(void *param) {
+    send_queue_t *queue = (send_queue_t *) param;
+
+    pthread_mutex_lock(&queue->lock);
+    for (;;) {
+        _segment_t *segment;
+        status_t result = OK;
+
+        if ((queue->head == queue->tail) && !queue->stopping) {
+            unsigned long long idle_start = _now_ms();
+            while ((queue->head == queue->tail) && !queue->stopping) {
+                pthread_cond_wait(&queue->queued_cond, &queue->lock);
+            }
+            queue->sender_idle_ms += _now_ms() - idle_start;
+        }
+        if (queue->head == queue->tail) {
+            break;
+        }
+
+        segment = &queue->segments_buf[queue->tail % queue->depth];
+        if (!queue->failed && !queue->aborted) {
+            pthread_mutex_unlock(&queue->lock);
+            result = queue->write_fn(queue->param, segment->data, segment->length);
+            pthread_mutex_lock(&queue->lock);
+        }
+
+        if (result != OK) {
+            LOGE("_sender_thread(): write of %zu bytes failed, dropping the rest",
+                    segment->length);
+            queue->failed = true;
+        }
+        queue->tail++;
+        pthread_cond_broadcast(&queue->written_cond);
+    }
+    pthread_mutex_unlock(&queue->lock);
+    return NULL;
+}
+
+send_queue_t *send_queue_create(unsigned int depth, size_t segment_size,
+        send_queue_write_t write_fn, void *param) {
+    send_queue_t *queue;
+    unsigned int i;
+
+    if ((depth == 0) || (segment_size == 0) || (write_fn == NULL)) {
+        return NULL;
+    }
+
+    queue = (send_queue_t *) calloc(1, sizeof(send_queue_t) + depth * sizeof(_segment_t));
+    if (queue == NULL) {
+        return NULL;
+    }
+
+    queue->depth = depth;
+    queue->segment_size = segment_size;
+    queue->write_fn = write_fn;
+    queue->param = param;
+    for (i = 0; i < depth; i++) {
+        queue->segments_buf[i].data = (char *) malloc(segment_size);
+        if (queue->segments_buf[i].data == NULL) {
+            break;
+        }
+    }
+
+    pthread_mutex_init(&queue->lock, NULL);
+    pthread_cond_init(&queue->queued_cond, NULL);
+    pthread_cond_init(&queue->written_cond, NULL);
+
+    if ((i < depth) || (pthread_create(&queue->tid, NULL, _sender_thread, queue) != 0)) {
+        LOGE("send_queue_create(): cannot set up %u segments of %zu bytes", depth,
+                segment_size);
+        while (i-- > 0) {
+            free(queue->segments_buf[i].data);
+        }
+        pthread_cond_destroy(&queue->written_cond);
+        pthread_cond_destroy(&queue->queued_cond);
+        pthread_mutex_destroy(&queue->lock);
+        free(queue);
+        return NULL;
+    }
+    return queue;
+}
+
+void send_queue_destroy(send_queue_t *queue) {
+    unsigned int i;
+
+    if (queue == NULL) {
+        return;
+    }
+
+    pthread_mutex_lock(&queue->lock);
+    queue->aborted = true;
+    queue->stopping = true;
+    pthread_cond_broadcast(&queue->queued_cond);
+    pthread_mutex_unlock(&queue->lock);
+    pthread_join(queue->tid, NULL);
+
+    for (i = 0; i < queue->depth; i++) {
+        free(queue->segments_buf[i].data);
+    }
+    pthread_cond_destroy(&queue->written_cond);
+    pthread_cond_destroy(&queue->queued_cond);
+    pthread_mutex_destroy(&queue->lock);
+    free(queue);
+}
+
+/*
+ * Hands the segment being filled to the sender. Called with the lock held.
+ */
+static void _queue_segment(send_queue_t *queue) {
+    unsigned int occupancy;
+
+    queue->head++;
+    queue->filling = false;
+
+    occupancy = queue->head - queue->tail;
+    queue->segments++;
+    queue->occupancy_sum += occupancy;
+    if (occupancy > queue->occupancy_max) {
+        queue->occupancy_max = occupancy;
+    }
+    pthread_cond_signal(&queue->queued_cond);
+}
+
+status_t send_queue_write(send_queue_t *queue, const char *buffer, size_t length) {
+    status_t result;
+
+    pthread_mutex_lock(&queue->lock);
+    result = ((queue->failed || queue->aborted) ? ERROR : OK);
+    while ((length > 0) && (result == OK)) {
+        _segment_t *segment;
+        size_t count;
+
+        if (!queue->filling && !queue->failed && !queue->aborted &&
+                ((queue->head - queue->tail) >= queue->depth)) {
+            // every segment is queued, so the link is the bottleneck
+            unsigned long long wait_start = _now_ms();
+            while (((queue->head - queue->tail) >= queue->depth) && !queue->failed &&
+                    !queue->aborted) {
+                pthread_cond_wait(&queue->written_cond, &queue->lock);
+            }
+            queue->writer_wait_ms += _now_ms() - wait_start;
+        }
+        if (queue->failed || queue->aborted) {
+            result = ERROR;
+            break;
+        }
+
+        segment = &queue->segments_buf[queue->head % queue->depth];
+        if (!queue->filling) {
+            segment->length = 0;
+            queue->filling = true;
+        }
+
+        // the sender never touches the segment being filled, so copy without the lock
+        count = MIN(length, queue->segment_size - segment->length);
+        pthread_mutex_unlock(&queue->lock);
+        memcpy(segment->data + segment->length, buffer, count);
+        pthread_mutex_lock(&queue->lock);
+
+        segment->length += count;
+        queue->bytes += count;
+        buffer += count;
+        length -= count;
+        if (segment->length == queue->segment_size) {
+            _queue_segment(queue);
+        }
+    }
+    pthread_mutex_unlock(&queue->lock);
+    return result;
+}
+
+status_t send_queue_flush(send_queue_t *queue, unsigned int *segments) {
+    status_t result;
+
+    pthread_mutex_lock(&queue->lock);
+    if (queue->filling && (queue->segments_buf[queue->head % queue->depth].length > 0)) {
+        _queue_segment(queue);
+    }
+    if (segments != NULL) {
+        *segments = queue->head - queue->flushed_head;
+    }
+    queue->flushed_head = queue->head;
+    result = ((queue->failed || queue->aborted) ? ERROR : OK);
+    pthread_mutex_unlock(&queue->lock);
+    return result;
+}
+
+status_t send_queue_drain(send_queue_t *queue) {
+    status_t result;
+
+    pthread_mutex_lock(&queue->lock);
+    if (queue->filling && (queue->segments_buf[queue->head % queue->depth].length > 0)) {
+        _queue_segment(queue);
+    }
+    while (queue->head != queue->tail) {
+        pthread_cond_wait(&queue->written_cond, &queue->lock);
+    }
+    result = ((queue->failed || queue->aborted) ? ERROR : OK);
+
+    if (queue->segments > 0) {
+        LOGI("send_queue_drain(): %u segments, %llu bytes, occupancy %llu.%02llu avg %u max of "
+                "%u, writer waited %llu ms, sender idle %llu ms", queue->segments, queue->bytes,
+                queue->occupancy_sum / queue->segments,
+                (queue->occupancy_sum * 100 / queue->segments) % 100, queue->occupancy_max,
+                queue->depth, queue->writer_wait_ms, queue->sender_idle_ms);
+    }
+    queue->segments = 0;
+    queue->bytes = 0;
+    queue->occupancy_sum = 0;
+    queue->occupancy_max = 0;
+    queue->writer_wait_ms = 0;
+    queue->sender_idle_ms = 0;
+    pthread_mutex_unlock(&queue->lock);
+    return result;
+}
+
+void send_queue_reset(send_queue_t *queue) {
+    pthread_mutex_lock(&queue->lock);
+    while (queue->head != queue->tail) {
+        pthread_cond_wait(&queue->written_cond, &queue->lock);
+    }
+    queue->filling = false;
+    queue->failed = false;
+    queue->flushed_head = queue->head;
+    pthread_mutex_unlock(&queue->lock);
+}
+
+void send_queue_abort(send_queue_t *queue) {
+    pthread_mutex_lock(&queue->lock);
+    queue->aborted = true;
+    pthread_cond_broadcast(&queue->written_cond);
+    pthread_cond_broadcast(&queue->queued_cond);
+    pthread_mutex_unlock(&queue->lock);
+}
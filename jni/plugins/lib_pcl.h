@@ -19,6 +19,7 @@
 #ifndef __LIB_PCL_H__
 #define __LIB_PCL_H__
 
+#include <cups/raster.h>
 #include "ifc_print_job.h"
 #include "ifc_wprint.h"
 #include "lib_wprint.h"
@@ -86,6 +87,13 @@
     JOB_INFO->print_ifc->send_data(JOB_INFO->print_ifc, BUFF, LEN); \
 }
 
+#define _FLUSH(JOB_INFO) \
+{ \
+    if (JOB_INFO->print_ifc->flush != NULL) { \
+        JOB_INFO->print_ifc->flush(JOB_INFO->print_ifc); \
+    } \
+}
+
 /*
  * PCL/PWG job definition
  */
@@ -115,6 +123,11 @@ typedef struct {
     PCLmPageSetup pclm_page_info;
     uint8 *pclm_output_buffer;
     const char *useragent;
+
+    // PWG raster stream and the page header it writes
+    cups_raster_t *pwg_raster;
+    cups_page_header2_t *pwg_header;
+    size_t pwg_skip_bytes;
 } pcl_job_info_t;
 
 /*
@@ -162,6 +175,20 @@ typedef struct ifc_pcl_st {
      * Return true if this interface can cancel a job partway through a page
      */
     bool (*canCancelMidPage)(void);
+
+    /*
+     * Sets up job_info, a copy of a started job's job_info given its own print_ifc, to encode
+     * whole pages apart from the job's stream so they can be encoded in parallel and sent in
+     * order later. Each page is then encoded with start_page(), print_swath() and end_page().
+     * The page settings are copied from job_info, so they must not change meanwhile.
+     * Returns OK or ERROR. NULL if the format's pages depend on the rest of the job stream.
+     */
+    status_t (*start_page_encoder)(pcl_job_info_t *job_info);
+
+    /*
+     * Releases what start_page_encoder() set up
+     */
+    void (*end_page_encoder)(pcl_job_info_t *job_info);
 } ifc_pcl_t;
 
 /*
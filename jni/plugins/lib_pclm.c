@@ -229,7 +229,8 @@ static int _print_swath(pcl_job_info_t *job_info, char *rgb_pixels, int start_ro
     int outBuffSize = 0;
     _PAGE_DATA(job_info, (const unsigned char *) rgb_pixels, (num_rows * bytes_per_row));
 
-    if (job_info->monochrome) {
+    // single component data was already converted to gray while decoding
+    if (job_info->monochrome && (job_info->num_components == 3)) {
         unsigned char *buff = (unsigned char *) rgb_pixels;
         int nbytes = (num_rows * bytes_per_row);
         int readIndex, writeIndex;
@@ -308,7 +309,9 @@ static bool _canCancelMidPage(void) {
 }
 
 static const ifc_pcl_t _pcl_ifc = {
-    _start_job, _end_job, _start_page, _end_page, _print_swath, _canCancelMidPage
+    _start_job, _end_job, _start_page, _end_page, _print_swath, _canCancelMidPage,
+    // PCLm pages are objects of a single PDF stream and cannot be encoded on their own
+    NULL, NULL
 };
 
 ifc_pcl_t *pclm_connect(void) {
@@ -29,8 +29,8 @@
 
 #define TAG "lib_pwg"
 
-cups_raster_t *ras_out = NULL;
-cups_page_header2_t header_pwg;
+// Length of the sync word cupsRasterOpenIO() writes at the start of a raster stream
+#define PWG_SYNC_WORD_SIZE 4
 
 /*
  * Write the PWG header
@@ -135,7 +135,13 @@ static void _get_pwg_media_size(pcl_job_info_t *job_info, media_size_t media_siz
  */
 static ssize_t _pwg_io_write(void *ctx, unsigned char *buf, size_t bytes) {
     pcl_job_info_t *pwg_job_info = (pcl_job_info_t *) ctx;
-    _WRITE(pwg_job_info, (const char *) buf, bytes);
+    size_t skip = MIN(bytes, pwg_job_info->pwg_skip_bytes);
+
+    // page encoders leave out the stream header, the job stream already carries it
+    pwg_job_info->pwg_skip_bytes -= skip;
+    if (bytes > skip) {
+        _WRITE(pwg_job_info, (const char *) (buf + skip), bytes - skip);
+    }
     return bytes;
 }
 
@@ -166,8 +172,17 @@ static wJob_t _start_job(wJob_t job_handle, pcl_job_info_t *job_info, media_size
 
     _START_JOB(job_info, "pwg");
 
-    header_pwg.HWResolution[0] = resolution;
-    header_pwg.HWResolution[1] = resolution;
+    job_info->pwg_raster = NULL;
+    job_info->pwg_skip_bytes = 0;
+    job_info->pwg_header = (cups_page_header2_t *) calloc(1, sizeof(cups_page_header2_t));
+    if (job_info->pwg_header == NULL) {
+        LOGE("_start_job(): cannot allocate page header");
+        return _WJOBH_NONE;
+    }
+    cups_page_header2_t *header_pwg = job_info->pwg_header;
+
+    header_pwg->HWResolution[0] = resolution;
+    header_pwg->HWResolution[1] = resolution;
 
     job_info->resolution = resolution;
     job_info->media_size = media_size;
@@ -189,20 +204,20 @@ static wJob_t _start_job(wJob_t job_handle, pcl_job_info_t *job_info, media_size
         job_info->pclm_page_info.mediaHeightOffset = top_margin;
     }
 
-    header_pwg.cupsMediaType = media_size;
+    header_pwg->cupsMediaType = media_size;
 
     job_info->pclm_page_info.pageOrigin = top_left;    // REVISIT
     job_info->monochrome = (color_space == COLOR_SPACE_MONO);
     job_info->pclm_page_info.dstColorSpaceSpefication = deviceRGB;
     if (color_space == COLOR_SPACE_MONO) {
-        header_pwg.cupsColorSpace = CUPS_CSPACE_SW;
+        header_pwg->cupsColorSpace = CUPS_CSPACE_SW;
         job_info->pclm_page_info.dstColorSpaceSpefication = deviceRGB;
     } else if (color_space == COLOR_SPACE_COLOR) {
         job_info->pclm_page_info.dstColorSpaceSpefication = deviceRGB;
-        header_pwg.cupsColorSpace = CUPS_CSPACE_SRGB;
+        header_pwg->cupsColorSpace = CUPS_CSPACE_SRGB;
     } else if (color_space == COLOR_SPACE_ADOBE_RGB) {
         job_info->pclm_page_info.dstColorSpaceSpefication = adobeRGB;
-        header_pwg.cupsColorSpace = CUPS_CSPACE_SRGB;
+        header_pwg->cupsColorSpace = CUPS_CSPACE_SRGB;
     }
 
     job_info->pclm_page_info.stripHeight = job_info->strip_height;
@@ -217,27 +232,29 @@ static wJob_t _start_job(wJob_t job_handle, pcl_job_info_t *job_info, media_size
 
     if (duplex == DUPLEX_MODE_BOOK) {
         job_info->pclm_page_info.duplexDisposition = duplex_longEdge;
-        header_pwg.Duplex = CUPS_TRUE;
-        header_pwg.Tumble = CUPS_FALSE;
+        header_pwg->Duplex = CUPS_TRUE;
+        header_pwg->Tumble = CUPS_FALSE;
     } else if (duplex == DUPLEX_MODE_TABLET) {
         job_info->pclm_page_info.duplexDisposition = duplex_shortEdge;
-        header_pwg.Duplex = CUPS_TRUE;
-        header_pwg.Tumble = CUPS_TRUE;
+        header_pwg->Duplex = CUPS_TRUE;
+        header_pwg->Tumble = CUPS_TRUE;
     } else {
         job_info->pclm_page_info.duplexDisposition = simplex;
-        header_pwg.Duplex = CUPS_FALSE;
-        header_pwg.Tumble = CUPS_FALSE;
+        header_pwg->Duplex = CUPS_FALSE;
+        header_pwg->Tumble = CUPS_FALSE;
     }
 
     job_info->pclm_page_info.mirrorBackside = false;
-    header_pwg.OutputFaceUp = CUPS_FALSE;
-    header_pwg.cupsBitsPerColor = BITS_PER_CHANNEL;
-    ras_out = cupsRasterOpenIO(_pwg_io_write, (void *) job_info, CUPS_RASTER_WRITE_PWG);
+    header_pwg->OutputFaceUp = CUPS_FALSE;
+    header_pwg->cupsBitsPerColor = BITS_PER_CHANNEL;
+    job_info->pwg_raster = cupsRasterOpenIO(_pwg_io_write, (void *) job_info,
+            CUPS_RASTER_WRITE_PWG);
     return job_info->job_handle;
 }
 
 static int _start_page(pcl_job_info_t *job_info, int pixel_width, int pixel_height) {
     PCLmPageSetup *page_info = &job_info->pclm_page_info;
+    cups_page_header2_t *header_pwg = job_info->pwg_header;
     _START_PAGE(job_info, pixel_width, pixel_height);
 
     page_info->sourceHeight = (float) pixel_height / job_info->standard_scale;
@@ -260,22 +277,25 @@ static int _start_page(pcl_job_info_t *job_info, int pixel_width, int pixel_heig
     // much worse than JPEG or FLATE
     page_info->compTypeRequested = compressDCT;
 
-    job_info->scan_line_width = BYTES_PER_PIXEL(pixel_width);
+    job_info->scan_line_width = pixel_width * job_info->num_components;
 
     // Fill up the pwg header
-    _write_header_pwg(pixel_width, pixel_height, &header_pwg, job_info->monochrome);
-
-    LOGI("cupsWidth = %d", header_pwg.cupsWidth);
-    LOGI("cupsHeight = %d", header_pwg.cupsHeight);
-    LOGI("cupsPageWidth = %f", header_pwg.cupsPageSize[0]);
-    LOGI("cupsPageHeight = %f", header_pwg.cupsPageSize[1]);
-    LOGI("cupsBitsPerColor = %d", header_pwg.cupsBitsPerColor);
-    LOGI("cupsBitsPerPixel = %d", header_pwg.cupsBitsPerPixel);
-    LOGI("cupsBytesPerLine = %d", header_pwg.cupsBytesPerLine);
-    LOGI("cupsColorOrder = %d", header_pwg.cupsColorOrder);
-    LOGI("cupsColorSpace = %d", header_pwg.cupsColorSpace);
-
-    cupsRasterWriteHeader2(ras_out, &header_pwg);
+    if (header_pwg == NULL) {
+        return ERROR;
+    }
+    _write_header_pwg(pixel_width, pixel_height, header_pwg, job_info->monochrome);
+
+    LOGI("cupsWidth = %d", header_pwg->cupsWidth);
+    LOGI("cupsHeight = %d", header_pwg->cupsHeight);
+    LOGI("cupsPageWidth = %f", header_pwg->cupsPageSize[0]);
+    LOGI("cupsPageHeight = %f", header_pwg->cupsPageSize[1]);
+    LOGI("cupsBitsPerColor = %d", header_pwg->cupsBitsPerColor);
+    LOGI("cupsBitsPerPixel = %d", header_pwg->cupsBitsPerPixel);
+    LOGI("cupsBytesPerLine = %d", header_pwg->cupsBytesPerLine);
+    LOGI("cupsColorOrder = %d", header_pwg->cupsColorOrder);
+    LOGI("cupsColorSpace = %d", header_pwg->cupsColorSpace);
+
+    cupsRasterWriteHeader2(job_info->pwg_raster, header_pwg);
     job_info->page_number++;
     return job_info->page_number;
 }
@@ -285,7 +305,8 @@ static int _print_swath(pcl_job_info_t *job_info, char *rgb_pixels, int start_ro
     int outBuffSize;
     _PAGE_DATA(job_info, (const unsigned char *) rgb_pixels, (num_rows * bytes_per_row));
 
-    if (job_info->monochrome) {
+    // single component data was already converted to gray while decoding
+    if (job_info->monochrome && (job_info->num_components == 3)) {
         unsigned char *buff = (unsigned char *) rgb_pixels;
         int nbytes = (num_rows * bytes_per_row);
         int readIndex, writeIndex;
@@ -306,8 +327,9 @@ static int _print_swath(pcl_job_info_t *job_info, char *rgb_pixels, int start_ro
      * image_info->printable_width*num_components*strip_height. it is currently pixel_width
      * (from _start_page()) * num_components * strip_height
      */
-    if (ras_out != NULL) {
-        unsigned result = cupsRasterWritePixels(ras_out, (unsigned char *) rgb_pixels, outBuffSize);
+    if (job_info->pwg_raster != NULL) {
+        unsigned result = cupsRasterWritePixels(job_info->pwg_raster, (unsigned char *) rgb_pixels,
+                outBuffSize);
         LOGD("cupsRasterWritePixels return %d", result);
     } else {
         LOGD("cupsRasterWritePixels raster is null");
@@ -392,7 +414,12 @@ static int _end_page(pcl_job_info_t *job_info, int page_number) {
 static int _end_job(pcl_job_info_t *job_info) {
     LOGI("_end_job()");
     _END_JOB(job_info);
-    cupsRasterClose(ras_out);
+    if (job_info->pwg_raster != NULL) {
+        cupsRasterClose(job_info->pwg_raster);
+        job_info->pwg_raster = NULL;
+    }
+    free(job_info->pwg_header);
+    job_info->pwg_header = NULL;
     return OK;
 }
 
@@ -400,8 +427,46 @@ static bool _canCancelMidPage(void) {
     return false;
 }
 
+/*
+ * Gives job_info a raster stream and page header of its own. Each page's header carries all
+ * of its settings, so pages written to separate streams can be joined after one sync word.
+ */
+static status_t _start_page_encoder(pcl_job_info_t *job_info) {
+    cups_page_header2_t *job_header = job_info->pwg_header;
+
+    job_info->pwg_raster = NULL;
+    if (job_header == NULL) {
+        return ERROR;
+    }
+    job_info->pwg_header = (cups_page_header2_t *) malloc(sizeof(cups_page_header2_t));
+    if (job_info->pwg_header == NULL) {
+        return ERROR;
+    }
+    memcpy(job_info->pwg_header, job_header, sizeof(cups_page_header2_t));
+
+    job_info->pwg_skip_bytes = PWG_SYNC_WORD_SIZE;
+    job_info->pwg_raster = cupsRasterOpenIO(_pwg_io_write, (void *) job_info,
+            CUPS_RASTER_WRITE_PWG);
+    if (job_info->pwg_raster == NULL) {
+        free(job_info->pwg_header);
+        job_info->pwg_header = NULL;
+        return ERROR;
+    }
+    return OK;
+}
+
+static void _end_page_encoder(pcl_job_info_t *job_info) {
+    if (job_info->pwg_raster != NULL) {
+        cupsRasterClose(job_info->pwg_raster);
+        job_info->pwg_raster = NULL;
+    }
+    free(job_info->pwg_header);
+    job_info->pwg_header = NULL;
+}
+
 static const ifc_pcl_t _pcl_ifc = {
-        _start_job, _end_job, _start_page, _end_page, _print_swath, _canCancelMidPage
+        _start_job, _end_job, _start_page, _end_page, _print_swath, _canCancelMidPage,
+        _start_page_encoder, _end_page_encoder
 };
 
 ifc_pcl_t *pwg_connect(void) {
@@ -73,9 +73,9 @@ static int getPageAttributes(pdf_render_ifc_t *obj, int page, double *width, dou
     return OK;
 }
 
-static int renderPageStripe(pdf_render_ifc_t *obj, int page, int width, int height, float zoom,
-        char *buffer) {
-    LOGD("renderPageStripe %p %d", obj, page);
+static int renderPageStripe(pdf_render_ifc_t *obj, int page, int y, int width, int height,
+        float zoom, int rotation, char *buffer) {
+    LOGD("renderPageStripe %p %d y=%d rotation=%d", obj, page, y, rotation);
     if (!gPdfRenderClass) return ERROR;
 
     pdf_render_st_t *self = (pdf_render_st_t *) obj;
@@ -84,7 +84,7 @@ static int renderPageStripe(pdf_render_ifc_t *obj, int page, int width, int heig
     jobject byteBuffer = (*self->env)->NewDirectByteBuffer(self->env, buffer, bufferSize);
 
     if (!(*self->env)->CallBooleanMethod(self->env, self->obj, gPdfRenderRenderPageStripe, page,
-            0, width, height, (double) zoom, byteBuffer)) {
+            y, width, height, (double) zoom, rotation, byteBuffer)) {
         return ERROR;
     }
 
@@ -116,7 +116,7 @@ void pdf_render_init(JNIEnv *env) {
     gPdfRenderGetPageSize = (*env)->GetMethodID(env, gPdfRenderClass, "getPageSize",
             "(I)Lcom/android/bips/jni/SizeD;");
     gPdfRenderRenderPageStripe = (*env)->GetMethodID(env, gPdfRenderClass, "renderPageStripe",
-            "(IIIIDLjava/nio/ByteBuffer;)Z");
+            "(IIIIDILjava/nio/ByteBuffer;)Z");
 
     gSizeDClass = (*env)->NewGlobalRef(env, (*env)->FindClass(env, "com/android/bips/jni/SizeD"));
     gSizeDGetWidth = (*env)->GetMethodID(env, gSizeDClass, "getWidth", "()D");
@@ -16,12 +16,14 @@
  * limitations under the License.
  */
 
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include "ifc_print_job.h"
 #include "lib_pcl.h"
 #include "wprint_image.h"
+#include "wprint_strip_ring.h"
 
 #ifndef _GNU_SOURCE
 #define _GNU_SOURCE
@@ -31,10 +33,23 @@
 #endif
 
 #include <pthread.h>
-#include <semaphore.h>
 #include <string.h>
+#include <time.h>
 
-#define MAX_SEND_BUFFS (BUFFERED_ROWS / STRIPE_HEIGHT)
+#define DEFAULT_SEND_BUFFS (BUFFERED_ROWS / STRIPE_HEIGHT)
+
+// Fewest strip buffers kept in flight, so decode and send can always overlap
+#define MIN_PIPELINE_DEPTH 2
+
+// Largest strip height the tuner will pick for PWG, which has no printer-imposed height
+#define MAX_PWG_STRIP_HEIGHT (STRIPE_HEIGHT * 16)
+
+// A side that spends more than this share of a page waiting on the other is considered stalled
+#define STALL_PERCENT 5
+
+// Most page workers per job. The renderer runs one stripe at a time, so workers only overlap
+// scaling and encoding with rendering and more of them gain little.
+#define MAX_PAGE_WORKERS 4
 
 #define TAG "plugin_pcl"
 
@@ -44,8 +59,35 @@ typedef enum {
     MSG_SEND,
     MSG_END_JOB,
     MSG_END_PAGE,
+    MSG_SEND_PAGE,
 } msg_id_t;
 
+/*
+ * A page encoded on its own by a page worker, then sent by the send thread in print order
+ */
+typedef struct page_task_st {
+    // print interface that collects the encoded page into data
+    ifc_print_job_t sink;
+    struct page_task_st *next;
+
+    // the job's parameters and page as of the print_page() call
+    wprint_job_params_t job_params;
+    const char *mime_type;
+    char pathname[MAX_PATHNAME_LENGTH + 1];
+    pcl_job_info_t job_info;
+
+    char *data;
+    size_t size;
+    size_t capacity;
+    // the part of capacity and of the page's decode memory already counted against the job
+    size_t counted;
+    size_t decode_counted;
+    int width;
+    int height;
+    status_t result;
+    bool done;
+} page_task_t;
+
 typedef struct {
     msg_id_t id;
 
@@ -63,20 +105,62 @@ typedef struct {
         } send;
         struct {
             int page;
-            char *buffers[MAX_SEND_BUFFS];
-            int count;
         } end_page;
+        struct {
+            page_task_t *task;
+        } send_page;
     } param;
 } msgQ_msg_t;
 
 typedef struct {
     wJob_t job_handle;
-    msg_q_id msgQ;
+    strip_ring_t *ring;
     pthread_t send_tid;
     pcl_job_info_t job_info;
     wprint_job_params_t *job_params;
-    sem_t buffs_sem;
+    int num_buffs;
     ifc_pcl_t *pcl_ifc;
+
+    // strip buffers kept for the life of the job and reused page after page
+    char *buff_pool[MAX_SEND_BUFFS];
+    int buff_size;
+    int buff_index;
+
+    // pipeline tuning, see _tune_pipeline(). depth is the number of strip buffers in use and
+    // never exceeds num_buffs; depth * strip_height never exceeds num_buffs * base strip height.
+    int depth;
+    unsigned int min_strip_height;
+    unsigned int max_strip_height;
+    unsigned int row_budget;
+    uint64 page_start_ns;
+    uint64 page_ns;
+    uint64 produce_wait_ns;
+    atomic_ullong consume_wait_ns;
+
+    // page parallel encoding, see _queue_page(). Workers take pages in print order and the send
+    // thread emits each one, in that same order, once it is encoded. num_workers is 0 when the
+    // job encodes strip by strip instead. task_cond is signalled on any change to the tasks.
+    // Half the memory budget is shared by the workers' decoding and the other half,
+    // encoded_budget, holds encoded pages; the byte counts are kept under task_lock.
+    int num_workers;
+    pthread_t workers[MAX_PAGE_WORKERS];
+    pthread_mutex_t task_lock;
+    pthread_cond_t task_cond;
+    page_task_t *task_head;
+    page_task_t *task_tail;
+    int tasks_encoding;
+    int tasks_in_flight;
+    size_t encoded_bytes;
+    size_t encoded_budget;
+    size_t decode_bytes;
+    status_t page_result;
+    bool workers_stopping;
+    bool page_job_info_ready;
+    pcl_job_info_t page_job_info;
+    // the send thread rewrites the job's PWG header for blank pages, so pages are encoded from
+    // this snapshot of it instead
+    cups_page_header2_t page_header;
+    ifc_wprint_t worker_wprint_ifc;
 } plugin_data_t;
 
 static const char *_mime_types[] = {
@@ -97,25 +181,216 @@ static const char **_get_print_formats(void) {
     return _print_formats;
 }
 
+/*
+ * Returns the monotonic clock in nanoseconds
+ */
+static uint64 _now_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return ((uint64) now.tv_sec * 1000000000ULL) + (uint64) now.tv_nsec;
+}
+
+/*
+ * Frees the job's strip buffers. None of them may still be pending in the ring.
+ */
+static void _free_buff_pool(plugin_data_t *priv) {
+    int i;
+    for (i = 0; i < MAX_SEND_BUFFS; i++) {
+        free(priv->buff_pool[i]);
+        priv->buff_pool[i] = NULL;
+    }
+    priv->buff_size = 0;
+    priv->buff_index = 0;
+}
+
+/*
+ * Makes sure the first priv->depth strip buffers exist and hold at least buff_size bytes, and
+ * frees any beyond depth. The pool is only reallocated when a page needs larger strips than any
+ * page before it; buffers are rounded to whole pages and page aligned. Returns OK or ERROR.
+ */
+static status_t _size_buff_pool(plugin_data_t *priv, int buff_size) {
+    long page_size = sysconf(_SC_PAGESIZE);
+    int i;
+
+    if (page_size <= 0) {
+        page_size = 4096;
+    }
+    if (buff_size > priv->buff_size) {
+        // the send thread may still be working through strips of the previous page
+        strip_ring_wait_space(priv->ring, 1);
+        _free_buff_pool(priv);
+        priv->buff_size = (int) (((buff_size + page_size - 1) / page_size) * page_size);
+    }
+
+    // _tune_pipeline() drains the ring before changing depth, so extra buffers are idle
+    for (i = priv->depth; i < MAX_SEND_BUFFS; i++) {
+        free(priv->buff_pool[i]);
+        priv->buff_pool[i] = NULL;
+    }
+    for (i = 0; i < priv->depth; i++) {
+        if (priv->buff_pool[i] != NULL) {
+            continue;
+        }
+        if (posix_memalign((void **) &priv->buff_pool[i], (size_t) page_size,
+                (size_t) priv->buff_size) != 0) {
+            priv->buff_pool[i] = NULL;
+            _free_buff_pool(priv);
+            return ERROR;
+        }
+        memset(priv->buff_pool[i], 0xff, priv->buff_size);
+    }
+    return OK;
+}
+
+/*
+ * Picks the pipeline depth and strip height for the next page from how the last page went.
+ * Time the decoder spent waiting for a free buffer means the link drains slower than pages
+ * are encoded; time the send thread spent waiting for a strip means the link is starved.
+ *   - both sides stalled: rates are close but bursty, so add depth to absorb the jitter
+ *   - only the decoder stalled: strips in flight only hold memory, so shrink depth and strips
+ *   - only the send thread stalled: use taller strips to cut per strip overhead
+ * Strip height only moves for PWG; PCLm keeps the height the printer asked for.
+ */
+static void _tune_pipeline(plugin_data_t *priv) {
+    wprint_job_params_t *job_params = priv->job_params;
+    uint64 page_ns = priv->page_ns, consume_wait_ns;
+    bool producer_stalled, consumer_stalled;
+    int depth = priv->depth;
+    unsigned int strip_height = job_params->strip_height;
+
+    if (page_ns == 0) {
+        return;
+    }
+    consume_wait_ns = atomic_exchange(&priv->consume_wait_ns, 0);
+    producer_stalled = ((priv->produce_wait_ns * 100) > (page_ns * STALL_PERCENT));
+    consumer_stalled = ((consume_wait_ns * 100) > (page_ns * STALL_PERCENT));
+
+    if (producer_stalled && consumer_stalled) {
+        depth = MIN(depth * 2, priv->num_buffs);
+    } else if (producer_stalled) {
+        depth = MAX(depth / 2, MIN_PIPELINE_DEPTH);
+        strip_height = MAX(strip_height / 2, priv->min_strip_height);
+    } else if (consumer_stalled) {
+        strip_height = MIN(strip_height * 2, priv->max_strip_height);
+    }
+
+    // stay inside the memory the job's budget allowed for strips
+    if (depth * strip_height > priv->row_budget) {
+        depth = MAX(priv->row_budget / strip_height, MIN_PIPELINE_DEPTH);
+    }
+
+    LOGD("_tune_pipeline(): page took %llu ms, decode waited %llu ms, send waited %llu ms, "
+            "depth %d -> %d, strip height %u -> %u", page_ns / 1000000ULL,
+            priv->produce_wait_ns / 1000000ULL, consume_wait_ns / 1000000ULL, priv->depth, depth,
+            job_params->strip_height, strip_height);
+
+    if (depth != priv->depth) {
+        // restart the buffer rotation from an empty ring
+        strip_ring_wait_space(priv->ring, 1);
+        priv->buff_index = 0;
+        priv->depth = depth;
+    }
+    job_params->strip_height = strip_height;
+    priv->job_info.strip_height = strip_height;
+    priv->page_ns = 0;
+}
+
 static void _cleanup_plugin_data(plugin_data_t *priv) {
     if (priv != NULL) {
-        if (priv->msgQ != MSG_Q_INVALID_ID) {
-            priv->job_info.wprint_ifc->msgQDelete(priv->msgQ);
+        if (priv->ring != NULL) {
+            strip_ring_destroy(priv->ring);
         }
-        sem_destroy(&priv->buffs_sem);
+        _free_buff_pool(priv);
+        pthread_cond_destroy(&priv->task_cond);
+        pthread_mutex_destroy(&priv->task_lock);
         free(priv);
     }
 }
 
 /*
- * Waits to receive message from the msgQ. Handles messages and sends commands to handle jobs
+ * Page workers encode apart from the job's stream, so they must not feed its debug stream
+ */
+static const ifc_wprint_debug_stream_t *_no_debug_stream(wJob_t id) {
+    return NULL;
+}
+
+/*
+ * Appends encoded page data to the task's buffer
+ */
+static int _page_sink_send(const ifc_print_job_t *this_p, const char *buffer, size_t length) {
+    page_task_t *task = (page_task_t *) ((const char *) this_p - offsetof(page_task_t, sink));
+
+    if (task->size + length > task->capacity) {
+        size_t capacity = MAX(task->capacity * 2, task->size + length);
+        char *data = (char *) realloc(task->data, capacity);
+        if (data == NULL) {
+            LOGE("_page_sink_send(): cannot grow page %d to %zu bytes",
+                    task->job_params.page_num, capacity);
+            task->result = ERROR;
+            return -1;
+        }
+        task->data = data;
+        task->capacity = capacity;
+    }
+    memcpy(task->data + task->size, buffer, length);
+    task->size += length;
+    return (int) length;
+}
+
+static void _free_task(page_task_t *task) {
+    if (task != NULL) {
+        free(task->data);
+        free(task);
+    }
+}
+
+/*
+ * Sends a page once its worker has encoded it. Runs on the send thread, which takes pages in
+ * the order print_page() was called, so the job's page order is kept whatever order the
+ * workers finish in.
+ */
+static void _emit_page(plugin_data_t *priv, page_task_t *task) {
+    pcl_job_info_t *job_info = &priv->job_info;
+
+    pthread_mutex_lock(&priv->task_lock);
+    while (!task->done) {
+        pthread_cond_wait(&priv->task_cond, &priv->task_lock);
+    }
+    pthread_mutex_unlock(&priv->task_lock);
+
+    // a page cut short by a cancel is dropped rather than sent incomplete
+    if ((task->result != CANCELLED) && !priv->job_params->aborted && (task->size > 0)) {
+        _START_PAGE(job_info, task->width, task->height);
+        _WRITE(job_info, task->data, task->size);
+        _END_PAGE(job_info);
+        _FLUSH(job_info);
+        job_info->page_number++;
+    }
+
+    pthread_mutex_lock(&priv->task_lock);
+    priv->tasks_in_flight--;
+    priv->encoded_bytes -= task->counted;
+    pthread_cond_broadcast(&priv->task_cond);
+    pthread_mutex_unlock(&priv->task_lock);
+    _free_task(task);
+}
+
+/*
+ * Waits to receive message from the ring. Handles messages and sends commands to handle jobs.
+ * Each message is released only once handled, which hands its strip buffer back to
+ * _print_page().
  */
 static void *_send_thread(void *param) {
     msgQ_msg_t msg;
     plugin_data_t *priv = (plugin_data_t *) param;
 
-    while (priv->job_info.wprint_ifc->msgQReceive(priv->msgQ, (char *) &msg, sizeof(msgQ_msg_t),
-            WAIT_FOREVER) == OK) {
+    for (;;) {
+        uint64 wait_start = _now_ns();
+        strip_ring_peek(priv->ring, &msg);
+        if ((msg.id == MSG_SEND) || (msg.id == MSG_END_PAGE)) {
+            // time starved mid page, as opposed to idle between pages
+            atomic_fetch_add(&priv->consume_wait_ns, _now_ns() - wait_start);
+        }
         if (msg.id == MSG_START_JOB) {
             priv->pcl_ifc->start_job(priv->job_handle, &priv->job_info,
                     priv->job_params->media_size, priv->job_params->media_type,
@@ -127,22 +402,23 @@ static void *_send_thread(void *param) {
             priv->pcl_ifc->start_page(&priv->job_info, msg.param.start_page.width,
                     msg.param.start_page.height);
         } else if (msg.id == MSG_SEND) {
-            if (!priv->pcl_ifc->canCancelMidPage() || !priv->job_params->cancelled) {
+            if (!priv->job_params->cancelled || (!priv->pcl_ifc->canCancelMidPage()
+                    && !priv->job_params->aborted)) {
                 priv->pcl_ifc->print_swath(&priv->job_info, msg.param.send.buffer,
                         msg.param.send.start_row, msg.param.send.num_rows,
                         msg.param.send.bytes_per_row);
             }
-            sem_post(&priv->buffs_sem);
         } else if (msg.id == MSG_END_PAGE) {
-            int i;
             priv->pcl_ifc->end_page(&priv->job_info, msg.param.end_page.page);
-            for (i = 0; i < msg.param.end_page.count; i++) {
-                if (msg.param.end_page.buffers[i] != NULL) {
-                    free(msg.param.end_page.buffers[i]);
-                }
-            }
+            // hand the finished page over now rather than when the send buffer fills
+            _FLUSH((&priv->job_info));
+        } else if (msg.id == MSG_SEND_PAGE) {
+            _emit_page(priv, msg.param.send_page.task);
         } else if (msg.id == MSG_END_JOB) {
             priv->pcl_ifc->end_job(&priv->job_info);
+        }
+        strip_ring_release(priv->ring);
+        if (msg.id == MSG_END_JOB) {
             break;
         }
     }
@@ -192,6 +468,60 @@ static status_t _start_thread(plugin_data_t *param) {
     return result;
 }
 
+/*
+ * Stops the page workers, which must have no page left to encode
+ */
+static void _stop_workers(plugin_data_t *priv) {
+    int i;
+
+    pthread_mutex_lock(&priv->task_lock);
+    priv->workers_stopping = true;
+    pthread_cond_broadcast(&priv->task_cond);
+    pthread_mutex_unlock(&priv->task_lock);
+    for (i = 0; i < priv->num_workers; i++) {
+        pthread_join(priv->workers[i], 0);
+    }
+    priv->num_workers = 0;
+}
+
+static void *_page_worker(void *param);
+
+/*
+ * Starts page workers when there are spare cores to encode pages on and each worker can be
+ * given a useful share of the job's memory budget. Otherwise leaves num_workers at 0 and the
+ * job is encoded strip by strip.
+ */
+static void _start_workers(plugin_data_t *priv) {
+    sigset_t allsig, oldsig;
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    int wanted = (int) MIN(MAX(cores, 1), MAX_PAGE_WORKERS);
+
+    wanted = MIN(wanted, (int) (priv->job_params->memory_budget / 2 / MIN_MEMORY_BUDGET));
+    if (wanted < 2) {
+        return;
+    }
+
+    sigfillset(&allsig);
+    pthread_sigmask(SIG_SETMASK, &allsig, &oldsig);
+    while (priv->num_workers < wanted) {
+        if (pthread_create(&priv->workers[priv->num_workers], 0, _page_worker,
+                (void *) priv) != 0) {
+            break;
+        }
+        priv->num_workers++;
+    }
+    pthread_sigmask(SIG_SETMASK, &oldsig, 0);
+
+    // a single worker would only add a copy of every page
+    if (priv->num_workers < 2) {
+        _stop_workers(priv);
+    }
+    priv->encoded_budget = priv->job_params->memory_budget -
+            (priv->job_params->memory_budget / 2);
+    LOGD("_start_workers(): %d page workers, %zu bytes for encoded pages", priv->num_workers,
+            priv->encoded_budget);
+}
+
 /*
  * Stops pcl thread
  */
@@ -204,12 +534,13 @@ static status_t _stop_thread(plugin_data_t *priv) {
         msgQ_msg_t msg;
         msg.id = MSG_END_JOB;
 
-        priv->job_info.wprint_ifc->msgQSend(
-                priv->msgQ, (char *) &msg, sizeof(msgQ_msg_t), NO_WAIT, MSG_Q_FIFO);
+        strip_ring_push(priv->ring, &msg);
         pthread_join(priv->send_tid, 0);
         priv->send_tid = pthread_self();
         result = OK;
     }
+    // the send thread has emitted every queued page, so the workers are idle
+    _stop_workers(priv);
     _cleanup_plugin_data(priv);
     return result;
 }
@@ -229,6 +560,8 @@ static int _start_job(wJob_t job_handle, const ifc_wprint_t *wprint_ifc_p,
         if (priv == NULL) continue;
 
         memset(priv, 0, sizeof(plugin_data_t));
+        pthread_mutex_init(&priv->task_lock, NULL);
+        pthread_cond_init(&priv->task_cond, NULL);
 
         priv->job_handle = job_handle;
         priv->job_params = job_params;
@@ -238,8 +571,24 @@ static int _start_job(wJob_t job_handle, const ifc_wprint_t *wprint_ifc_p,
         priv->job_info.wprint_ifc = (ifc_wprint_t *) wprint_ifc_p;
         priv->job_info.strip_height = job_params->strip_height;
         priv->job_info.useragent = job_params->useragent;
+        priv->worker_wprint_ifc = *wprint_ifc_p;
+        priv->worker_wprint_ifc.get_debug_stream_ifc = _no_debug_stream;
+        priv->num_buffs = (job_params->send_buffers != 0) ?
+                MIN(job_params->send_buffers, MAX_SEND_BUFFS) : DEFAULT_SEND_BUFFS;
+        priv->num_buffs = MAX(priv->num_buffs, MIN_PIPELINE_DEPTH);
+        job_params->peak_memory_used = 0;
+
+        // start from the budgeted configuration and let _tune_pipeline() adjust per page
+        priv->depth = priv->num_buffs;
+        priv->row_budget = priv->num_buffs * job_params->strip_height;
+        priv->min_strip_height = priv->max_strip_height = job_params->strip_height;
+        if (job_params->pcl_type == PCLPWG) {
+            priv->min_strip_height = MIN(STRIPE_HEIGHT, job_params->strip_height);
+            priv->max_strip_height = MAX(MIN(priv->row_budget / MIN_PIPELINE_DEPTH,
+                    MAX_PWG_STRIP_HEIGHT), job_params->strip_height);
+        }
+        atomic_init(&priv->consume_wait_ns, 0);
 
-        sem_init(&priv->buffs_sem, 0, MAX_SEND_BUFFS);
         switch (job_params->pcl_type) {
             case PCLm:
                 priv->pcl_ifc = pclm_connect();
@@ -256,16 +605,17 @@ static int _start_job(wJob_t job_handle, const ifc_wprint_t *wprint_ifc_p,
             continue;
         }
 
-        priv->msgQ = priv->job_info.wprint_ifc->msgQCreate(
-                (MAX_SEND_BUFFS * 2), sizeof(msgQ_msg_t));
-        if (priv->msgQ == MSG_Q_INVALID_ID) continue;
+        priv->ring = strip_ring_create((priv->num_buffs * 2), sizeof(msgQ_msg_t));
+        if (priv->ring == NULL) continue;
 
         if (_start_thread(priv) == ERROR) continue;
+        if (priv->pcl_ifc->start_page_encoder != NULL) {
+            _start_workers(priv);
+        }
 
         job_params->plugin_data = (void *) priv;
         msg.id = MSG_START_JOB;
-        priv->job_info.wprint_ifc->msgQSend(
-                priv->msgQ, (char *) &msg, sizeof(msgQ_msg_t), NO_WAIT, MSG_Q_FIFO);
+        strip_ring_push(priv->ring, &msg);
 
         return OK;
     } while (0);
@@ -301,7 +651,8 @@ static status_t _setup_image_info(wprint_job_params_t *job_params, wprint_image_
 
     LOGD("_setup_image_info(): fopen succeeded on %s", pathname);
     wprint_image_setup(image_info, mime_type, priv->job_info.wprint_ifc,
-            job_params->pixel_units, job_params->pdf_render_resolution);
+            job_params->pixel_units, job_params->pdf_render_resolution,
+            job_params->memory_budget);
     wprint_image_init(image_info, pathname, job_params->page_num);
 
     // get the image_info of the input file of specified MIME type
@@ -349,8 +700,8 @@ static status_t _setup_image_info(wprint_job_params_t *job_params, wprint_image_
                 job_params->printable_area_width, job_params->printable_area_height,
                 job_params->print_top_margin, job_params->print_left_margin,
                 job_params->print_right_margin, job_params->print_bottom_margin,
-                job_params->render_flags, job_params->strip_height, MAX_SEND_BUFFS,
-                image_padding);
+                job_params->render_flags, job_params->strip_height, priv->depth,
+                image_padding, (job_params->color_space == COLOR_SPACE_MONO) ? 1 : 3);
     } else {
         LOGE("_setup_image_info(): file does not appear to be valid");
         result = CORRUPT;
@@ -359,6 +710,227 @@ static status_t _setup_image_info(wprint_job_params_t *job_params, wprint_image_
     return result;
 }
 
+/*
+ * Brings the job's count of memory held by page workers up to date with the task's encoded data
+ * and decode_mem, the memory its page is being decoded with, and records the job's peak
+ */
+static void _count_task_memory(plugin_data_t *priv, page_task_t *task, size_t decode_mem) {
+    if ((task->capacity == task->counted) && (decode_mem == task->decode_counted)) {
+        return;
+    }
+    pthread_mutex_lock(&priv->task_lock);
+    priv->encoded_bytes += task->capacity - task->counted;
+    priv->decode_bytes = priv->decode_bytes + decode_mem - task->decode_counted;
+    task->counted = task->capacity;
+    task->decode_counted = decode_mem;
+    priv->job_params->peak_memory_used = MAX(priv->job_params->peak_memory_used,
+            (unsigned int) (priv->encoded_bytes + priv->decode_bytes));
+    pthread_mutex_unlock(&priv->task_lock);
+}
+
+/*
+ * Renders, scales and encodes one page into its task, whose encoder _queue_page() started. Runs
+ * on a page worker. As when printing strip by strip, a page that cannot be set up is replaced by
+ * a blank page.
+ */
+static status_t _encode_page(plugin_data_t *priv, page_task_t *task) {
+    wprint_job_params_t *job_params = &task->job_params;
+    pcl_job_info_t *job_info = &task->job_info;
+    wprint_image_info_t *image_info;
+    int num_rows, height, image_row, nbytes, bytes_per_row;
+    unsigned int mem_used;
+    char *buff;
+    status_t result;
+
+    image_info = malloc(sizeof(wprint_image_info_t));
+    if (image_info == NULL) {
+        priv->pcl_ifc->end_page_encoder(job_info);
+        return ERROR;
+    }
+
+    if ((result = _setup_image_info(job_params, image_info, task->mime_type,
+            task->pathname)) != OK) {
+        LOGE("_encode_page(): _setup_image_info() is failed");
+        priv->pcl_ifc->end_page(job_info, -1);
+        free(image_info);
+        _count_task_memory(priv, task, 0);
+        priv->pcl_ifc->end_page_encoder(job_info);
+        return ERROR;
+    }
+
+    if ((buff = malloc(wprint_image_get_output_buff_size(image_info))) == NULL) {
+        LOGE("_encode_page(): cannot allocate memory for image stripe");
+        priv->pcl_ifc->end_page(job_info, -1);
+        result = ERROR;
+    } else {
+        task->width = wprint_image_get_width(image_info);
+        task->height = wprint_image_get_height(image_info);
+        bytes_per_row = BYTES_PER_OUTPUT_PIXEL(image_info, task->width);
+        job_info->num_components = image_info->num_components;
+        priv->pcl_ifc->start_page(job_info, task->width, task->height);
+
+        num_rows = task->height;
+        image_row = 0;
+        while (num_rows > 0) {
+            // the snapshot of the job's parameters never sees a cancel, the live ones do
+            if (priv->job_params->cancelled) {
+                result = CANCELLED;
+                break;
+            }
+            height = MIN(num_rows, job_params->strip_height);
+            nbytes = wprint_image_decode_stripe(image_info, image_row, &height,
+                    (unsigned char *) buff);
+            if (nbytes <= 0) {
+                if (nbytes < 0) {
+                    LOGE("_encode_page(): ERROR: file appears to be corrupted");
+                    result = CORRUPT;
+                }
+                break;
+            }
+            priv->pcl_ifc->print_swath(job_info, buff, image_row, height, bytes_per_row);
+            image_row += height;
+            num_rows -= height;
+            _count_task_memory(priv, task, wprint_image_get_memory_used(image_info) +
+                    wprint_image_get_output_buff_size(image_info));
+        }
+        priv->pcl_ifc->end_page(job_info, job_params->page_num);
+
+        mem_used = wprint_image_get_memory_used(image_info) +
+                wprint_image_get_output_buff_size(image_info);
+        _count_task_memory(priv, task, mem_used);
+        LOGI("_encode_page(): page %d encoded to %zu bytes, decoded with %u bytes of %u budget, "
+                "result %d", job_params->page_num, task->size, mem_used,
+                job_params->memory_budget, result);
+        free(buff);
+    }
+
+    wprint_image_cleanup(image_info);
+    free(image_info);
+    _count_task_memory(priv, task, 0);
+    priv->pcl_ifc->end_page_encoder(job_info);
+    return result;
+}
+
+/*
+ * Page worker: encodes queued pages until the job ends
+ */
+static void *_page_worker(void *param) {
+    plugin_data_t *priv = (plugin_data_t *) param;
+    page_task_t *task;
+    status_t result;
+
+    pthread_mutex_lock(&priv->task_lock);
+    for (;;) {
+        while (!priv->workers_stopping && (priv->task_head == NULL)) {
+            pthread_cond_wait(&priv->task_cond, &priv->task_lock);
+        }
+        if ((task = priv->task_head) == NULL) {
+            break;
+        }
+        priv->task_head = task->next;
+        if (priv->task_head == NULL) {
+            priv->task_tail = NULL;
+        }
+        pthread_mutex_unlock(&priv->task_lock);
+
+        result = _encode_page(priv, task);
+
+        pthread_mutex_lock(&priv->task_lock);
+        if (task->result == OK) {
+            task->result = result;
+        }
+        if (priv->page_result == OK) {
+            priv->page_result = task->result;
+        }
+        task->done = true;
+        priv->tasks_encoding--;
+        pthread_cond_broadcast(&priv->task_cond);
+    }
+    pthread_mutex_unlock(&priv->task_lock);
+    return NULL;
+}
+
+/*
+ * Hands a page to the page workers and queues it to be sent in turn. Returns the result of
+ * pages that finished encoding since the last call; the last page of the job waits for every
+ * page to be encoded, so no result goes unreported.
+ */
+static status_t _queue_page(plugin_data_t *priv, wprint_job_params_t *job_params,
+        const char *mime_type, const char *pathname) {
+    page_task_t *task;
+    msgQ_msg_t msg;
+    status_t result;
+
+    if (!priv->page_job_info_ready) {
+        // pages are encoded with the job settings the send thread applied in start_job(). The
+        // ring is drained, so the send thread is not touching them now.
+        strip_ring_wait_space(priv->ring, 1);
+        priv->page_job_info = priv->job_info;
+        priv->page_job_info.wprint_ifc = &priv->worker_wprint_ifc;
+        if (priv->job_info.pwg_header != NULL) {
+            priv->page_header = *priv->job_info.pwg_header;
+            priv->page_job_info.pwg_header = &priv->page_header;
+        }
+        priv->page_job_info_ready = true;
+    }
+
+    task = (page_task_t *) calloc(1, sizeof(page_task_t));
+    if (task == NULL) return ERROR;
+
+    task->sink.send_data = _page_sink_send;
+    task->job_params = *job_params;
+    task->job_params.memory_budget = job_params->memory_budget / 2 / priv->num_workers;
+    task->mime_type = mime_type;
+    if (pathname != NULL) {
+        strncpy(task->pathname, pathname, MAX_PATHNAME_LENGTH);
+    }
+    task->job_info = priv->page_job_info;
+    task->job_info.print_ifc = &task->sink;
+    task->result = OK;
+
+    // the task takes its own copy of the page settings now, in queue order
+    if (priv->pcl_ifc->start_page_encoder(&task->job_info) != OK) {
+        LOGE("_queue_page(): cannot start encoder for page %d", job_params->page_num);
+        _free_task(task);
+        return ERROR;
+    }
+
+    pthread_mutex_lock(&priv->task_lock);
+    // bound the pages and encoded bytes held in memory ahead of the send thread. A page is
+    // always let through when none is in flight, so a page larger than the budget still prints.
+    while ((priv->tasks_in_flight >= (priv->num_workers * 2)) || ((priv->tasks_in_flight > 0)
+            && (priv->encoded_bytes >= priv->encoded_budget))) {
+        pthread_cond_wait(&priv->task_cond, &priv->task_lock);
+    }
+    priv->tasks_in_flight++;
+    priv->tasks_encoding++;
+    if (priv->task_tail == NULL) {
+        priv->task_head = task;
+    } else {
+        priv->task_tail->next = task;
+    }
+    priv->task_tail = task;
+    pthread_cond_broadcast(&priv->task_cond);
+    pthread_mutex_unlock(&priv->task_lock);
+
+    msg.id = MSG_SEND_PAGE;
+    msg.param.send_page.task = task;
+    strip_ring_push(priv->ring, &msg);
+
+    pthread_mutex_lock(&priv->task_lock);
+    while (job_params->last_page && (priv->tasks_encoding > 0)) {
+        pthread_cond_wait(&priv->task_cond, &priv->task_lock);
+    }
+    result = priv->page_result;
+    priv->page_result = OK;
+    pthread_mutex_unlock(&priv->task_lock);
+
+    if ((result == OK) && job_params->cancelled) {
+        result = CANCELLED;
+    }
+    return result;
+}
+
 static status_t _print_page(wprint_job_params_t *job_params, const char *mime_type,
         const char *pathname) {
     wprint_image_info_t *image_info;
@@ -366,8 +938,8 @@ static status_t _print_page(wprint_job_params_t *job_params, const char *mime_ty
     int num_rows, height, image_row;
     int blank_data;
     char *buff;
-    int i, buff_index, buff_size;
-    char *buff_pool[MAX_SEND_BUFFS];
+    int num_buffs;
+    unsigned int mem_used;
 
     int nbytes;
     plugin_data_t *priv;
@@ -378,54 +950,51 @@ static status_t _print_page(wprint_job_params_t *job_params, const char *mime_ty
     priv = (plugin_data_t *) job_params->plugin_data;
 
     if (priv == NULL) return ERROR;
+    if (priv->num_workers > 0) {
+        return _queue_page(priv, job_params, mime_type, pathname);
+    }
+    _tune_pipeline(priv);
+    num_buffs = priv->depth;
 
     image_info = malloc(sizeof(wprint_image_info_t));
 
     if (image_info == NULL) return ERROR;
 
     if ((result = _setup_image_info(job_params, image_info, mime_type, pathname)) == OK) {
-        // allocate memory for a stripe of data
-        for (i = 0; i < MAX_SEND_BUFFS; i++) {
-            buff_pool[i] = NULL;
-        }
-
-        blank_data = MAX_SEND_BUFFS;
-        buff_size = wprint_image_get_output_buff_size(image_info);
-        for (i = 0; i < MAX_SEND_BUFFS; i++) {
-            buff_pool[i] = malloc(buff_size);
-            if (buff_pool[i] == NULL) {
-                break;
-            }
-            memset(buff_pool[i], 0xff, buff_size);
-        }
-
-        if (i == MAX_SEND_BUFFS) {
+        blank_data = num_buffs;
+        if (_size_buff_pool(priv, wprint_image_get_output_buff_size(image_info)) == OK) {
             msg.id = MSG_START_PAGE;
             msg.param.start_page.extra_margin = ((job_params->duplex != DUPLEX_MODE_NONE) &&
                     ((job_params->page_num & 0x1) == 0)) ? job_params->page_bottom_margin : 0.0f;
             msg.param.start_page.width = wprint_image_get_width(image_info);
             msg.param.start_page.height = wprint_image_get_height(image_info);
             priv->job_info.num_components = image_info->num_components;
-            priv->job_info.wprint_ifc->msgQSend(priv->msgQ, (char *) &msg, sizeof(msgQ_msg_t),
-                    NO_WAIT, MSG_Q_FIFO);
+            strip_ring_push(priv->ring, &msg);
+            priv->page_start_ns = _now_ns();
+            priv->produce_wait_ns = 0;
 
             msg.id = MSG_SEND;
-            msg.param.send.bytes_per_row = BYTES_PER_PIXEL(wprint_image_get_width(image_info));
+            msg.param.send.bytes_per_row = BYTES_PER_OUTPUT_PIXEL(image_info,
+                    wprint_image_get_width(image_info));
 
             // send blank rows for any offset
-            buff_index = 0;
             num_rows = wprint_image_get_height(image_info);
             image_row = 0;
 
             // decode and render each stripe into PCL3 raster format
             while ((result != ERROR) && (num_rows > 0)) {
-                if (priv->pcl_ifc->canCancelMidPage() && job_params->cancelled) {
+                // once the transport is aborted the page need not be completed either
+                if (job_params->cancelled && (priv->pcl_ifc->canCancelMidPage()
+                        || job_params->aborted)) {
                     break;
                 }
-                sem_wait(&priv->buffs_sem);
+                /* buffers are sent in turn, so the one about to be filled is free once fewer
+                 * than num_buffs messages are still pending */
+                uint64 wait_start = _now_ns();
+                strip_ring_wait_space(priv->ring, num_buffs);
+                priv->produce_wait_ns += _now_ns() - wait_start;
 
-                buff = buff_pool[buff_index];
-                buff_index = ((buff_index + 1) % MAX_SEND_BUFFS);
+                buff = priv->buff_pool[priv->buff_index];
 
                 height = MIN(num_rows, job_params->strip_height);
                 if (!job_params->cancelled) {
@@ -435,9 +1004,9 @@ static status_t _print_page(wprint_job_params_t *job_params, const char *mime_ty
                     if (blank_data > 0) {
                         blank_data--;
                     }
-                } else if (blank_data < MAX_SEND_BUFFS) {
-                    nbytes = buff_size;
-                    memset(buff, 0xff, buff_size);
+                } else if (blank_data < num_buffs) {
+                    nbytes = priv->buff_size;
+                    memset(buff, 0xff, priv->buff_size);
                     blank_data++;
                 }
 
@@ -446,16 +1015,12 @@ static status_t _print_page(wprint_job_params_t *job_params, const char *mime_ty
                     msg.param.send.start_row = image_row;
                     msg.param.send.num_rows = height;
 
-                    result = priv->job_info.wprint_ifc->msgQSend(priv->msgQ, (char *) &msg,
-                            sizeof(msgQ_msg_t), NO_WAIT, MSG_Q_FIFO);
-                    if (result < 0) {
-                        sem_post(&priv->buffs_sem);
-                    }
+                    strip_ring_push(priv->ring, &msg);
+                    priv->buff_index = ((priv->buff_index + 1) % num_buffs);
 
                     image_row += height;
                     num_rows -= height;
                 } else {
-                    sem_post(&priv->buffs_sem);
                     if (nbytes < 0) {
                         LOGE("_print_page(): ERROR: file appears to be corrupted");
                         result = CORRUPT;
@@ -468,9 +1033,16 @@ static status_t _print_page(wprint_job_params_t *job_params, const char *mime_ty
                 result = CANCELLED;
             }
 
+            // report the memory this page needed against the job's budget
+            mem_used = wprint_image_get_memory_used(image_info) + (num_buffs * priv->buff_size);
+            job_params->peak_memory_used = MAX(job_params->peak_memory_used, mem_used);
+            LOGI("_print_page(): page %d used %u bytes (peak %u, budget %u)",
+                    job_params->page_num, mem_used, job_params->peak_memory_used,
+                    job_params->memory_budget);
+
             LOGI("_print_page(): sends done, result: %d", result);
 
-            // free the buffer and eject the page
+            // eject the page
             msg.param.end_page.page = job_params->page_num;
             LOGI("_print_page(): processed %d out of"
                  " %d rows of page # %d from %s to printer %s %s {%s}",
@@ -483,24 +1055,22 @@ static status_t _print_page(wprint_job_params_t *job_params, const char *mime_ty
             result = ERROR;
             LOGE("_print_page(): plugin_pcl cannot allocate memory for image stripe");
         }
-        for (i = 0; i < MAX_SEND_BUFFS; i++) {
-            msg.param.end_page.buffers[i] = buff_pool[i];
-        }
-        msg.param.end_page.count = MAX_SEND_BUFFS;
 
         // send the end page message
         wprint_image_cleanup(image_info);
     } else {
         LOGE("_print_page(): _setup_image_info() is failed");
         msg.param.end_page.page = -1;
-        msg.param.end_page.count = 0;
         result = ERROR;
     }
     free(image_info);
 
     msg.id = MSG_END_PAGE;
-    priv->job_info.wprint_ifc->msgQSend(priv->msgQ, (char *) &msg, sizeof(msgQ_msg_t), NO_WAIT,
-            MSG_Q_FIFO);
+    strip_ring_push(priv->ring, &msg);
+    if (priv->page_start_ns != 0) {
+        priv->page_ns = _now_ns() - priv->page_start_ns;
+        priv->page_start_ns = 0;
+    }
     return result;
 }
 
@@ -535,15 +1105,16 @@ static int _print_blank_page(wJob_t job_handle, wprint_job_params_t *job_params,
 
     msg.id = MSG_END_PAGE;
     msg.param.end_page.page = -1;
-    msg.param.end_page.count = 0;
-    priv->job_info.wprint_ifc->msgQSend(priv->msgQ, (char *) &msg, sizeof(msgQ_msg_t), NO_WAIT,
-            MSG_Q_FIFO);
+    strip_ring_push(priv->ring, &msg);
     return OK;
 }
 
 static int _end_job(wprint_job_params_t *job_params) {
     if (job_params != NULL) {
+        // stopped first, so no page worker is still counting memory
         _stop_thread((plugin_data_t *) job_params->plugin_data);
+        LOGI("_end_job(): peak memory used %u bytes of %u budget",
+                job_params->peak_memory_used, job_params->memory_budget);
     }
     return OK;
 }
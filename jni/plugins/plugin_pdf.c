@@ -89,7 +89,17 @@ static int _print_page(wprint_job_params_t *job_params, const char *mime_type,
         }
 
         fd = open(pathname, O_RDONLY);
-        if (fd != ERROR) {
+        if ((fd != ERROR) && (priv->print_ifc->send_file != NULL)) {
+            // the transport can send the file without copying it through here
+            nbytes = priv->print_ifc->send_file(priv->print_ifc, fd);
+            if (nbytes < 0) {
+                LOGE("ERROR: sending %s failed", pathname);
+                result = ERROR;
+                nbytes = 0;
+            }
+            LOGI("dumped %d bytes of %s to printer", nbytes, pathname);
+            close(fd);
+        } else if (fd != ERROR) {
             rbytes = read(fd, buff, BUFF_SIZE);
 
             while ((rbytes > 0) && !job_params->cancelled) {
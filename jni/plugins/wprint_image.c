@@ -22,12 +22,12 @@
 #include "lib_wprint.h"
 
 #define TAG "wprint_image"
-#define MIN_DECODE_MEM (1 * 1024 * 1024)
-#define MAX_DECODE_MEM (4 * 1024 * 1024)
+// Row caching always gets at least this fraction of the memory budget
+#define MIN_DECODE_MEM_DIVISOR 4
 
 void wprint_image_setup(wprint_image_info_t *image_info, const char *mime_type,
         const ifc_wprint_t *wprint_ifc, unsigned int output_resolution,
-        int pdf_render_resolution) {
+        int pdf_render_resolution, unsigned int memory_budget) {
     if (image_info != NULL) {
         LOGD("image_setup");
         memset(image_info, 0, sizeof(wprint_image_info_t));
@@ -35,6 +35,8 @@ void wprint_image_setup(wprint_image_info_t *image_info, const char *mime_type,
         image_info->mime_type = mime_type;
         image_info->print_resolution = output_resolution;
         image_info->pdf_render_resolution = pdf_render_resolution;
+        image_info->memory_budget = ((memory_budget != 0) ? memory_budget :
+                DEFAULT_MEMORY_BUDGET);
     }
 }
 
@@ -51,6 +53,7 @@ status_t wprint_image_get_info(FILE *imgfile, wprint_image_info_t *image_info) {
 
     image_info->stripe_height = 0;
     image_info->unscaled_rows = NULL;
+    image_info->unscaled_row_table = NULL;
     image_info->unscaled_rows_needed = 0;
     image_info->mixed_memory = NULL;
     image_info->mixed_memory_needed = 0;
@@ -59,6 +62,9 @@ status_t wprint_image_get_info(FILE *imgfile, wprint_image_info_t *image_info) {
     image_info->unscaled_start_row = -1;
     image_info->unscaled_end_row = -1;
     image_info->scaling_needed = FALSE;
+    image_info->render_transform = FALSE;
+    image_info->render_width = 0;
+    image_info->render_height = 0;
 
     image_info->output_padding_top = 0;
     image_info->output_padding_left = 0;
@@ -81,11 +87,46 @@ status_t wprint_image_get_info(FILE *imgfile, wprint_image_info_t *image_info) {
     return ERROR;
 }
 
+/*
+ * Ask the decoder to supply rows already rotated and sized to output_width x output_height
+ * so that neither the rotation nor the fine-scaler has to run. Returns OK if the decoder
+ * accepted the transform.
+ */
+static status_t _setup_render_transform(wprint_image_info_t *image_info,
+        unsigned int output_width, unsigned int output_height) {
+    const image_decode_ifc_t *decode_ifc = image_info->decode_ifc;
+    if ((decode_ifc == NULL) || (decode_ifc->supports_transform == NULL) ||
+            (image_info->scaled_sample_size != 1)) {
+        return ERROR;
+    }
+
+    image_info->render_width = output_width;
+    image_info->render_height = output_height;
+    if (decode_ifc->supports_transform(image_info) != OK) {
+        image_info->render_width = 0;
+        image_info->render_height = 0;
+        return ERROR;
+    }
+
+    image_info->render_transform = TRUE;
+    LOGD("_setup_render_transform(): decoder renders %dx%d at rotation %d", output_width,
+            output_height, image_info->rotation);
+    return OK;
+}
+
+/*
+ * Return the rotation that still has to be applied to rows supplied by the decoder
+ */
+static wprint_rotation_t _decode_rotation(wprint_image_info_t *image_info) {
+    return (image_info->render_transform ? ROT_0 : image_info->rotation);
+}
+
 status_t wprint_image_set_output_properties(wprint_image_info_t *image_info,
         wprint_rotation_t rotation, unsigned int printable_width, unsigned int printable_height,
         unsigned int top_margin, unsigned int left_margin, unsigned int right_margin,
         unsigned int bottom_margin, unsigned int render_flags, unsigned int max_decode_stripe,
-        unsigned int concurrent_stripes, unsigned int padding_options) {
+        unsigned int concurrent_stripes, unsigned int padding_options,
+        unsigned int output_components) {
     // validate rotation
     switch (rotation) {
         default:
@@ -127,11 +168,15 @@ status_t wprint_image_set_output_properties(wprint_image_info_t *image_info,
     image_info->output_rows = max_decode_stripe;
     image_info->stripe_height = max_decode_stripe;
     image_info->concurrent_stripes = concurrent_stripes;
+    image_info->num_components = ((output_components == 1) ? 1 : 3);
 
     // free data just in case
     if (image_info->unscaled_rows != NULL) {
         free(image_info->unscaled_rows);
     }
+    if (image_info->unscaled_row_table != NULL) {
+        free(image_info->unscaled_row_table);
+    }
 
     // free data just in case
     if (image_info->mixed_memory != NULL) {
@@ -146,9 +191,13 @@ status_t wprint_image_set_output_properties(wprint_image_info_t *image_info,
     image_info->unscaled_start_row = -1;
     image_info->unscaled_end_row = -1;
     image_info->unscaled_rows = NULL;
+    image_info->unscaled_row_table = NULL;
     image_info->unscaled_rows_needed = 0;
     image_info->mixed_memory = NULL;
     image_info->mixed_memory_needed = 0;
+    image_info->render_transform = FALSE;
+    image_info->render_width = 0;
+    image_info->render_height = 0;
     image_info->rotation = rotation;
 
     unsigned int image_output_width;
@@ -305,7 +354,6 @@ status_t wprint_image_set_output_properties(wprint_image_info_t *image_info,
     if ((image_info->render_flags & (RENDER_FLAG_AUTO_SCALE | RENDER_FLAG_AUTO_FIT))
             || (native_scaling != 1.0f)) {
         LOGD("calculating fine-scaling");
-        int i;
         float targetHeight, targetWidth;
         float sourceHeight, sourceWidth;
         float rw;
@@ -338,23 +386,47 @@ status_t wprint_image_set_output_properties(wprint_image_info_t *image_info,
             image_info->scaled_height = native_image_output_height;
             image_info->scaled_width = native_image_output_width;
         }
+    }
+
+    if (((image_info->render_flags & (RENDER_FLAG_AUTO_SCALE | RENDER_FLAG_AUTO_FIT)) ||
+            ((native_scaling != 1.0f) &&
+                    (image_info->scaled_width <= image_info->printable_width) &&
+                    (image_info->scaled_height <= image_info->printable_height))) &&
+            (_setup_render_transform(image_info, image_info->scaled_width,
+                    image_info->scaled_height) == OK)) {
+        // the decoder delivers the final size, so the fine-scaler is not needed
+        LOGD("skipping fine-scaling, decoder renders at output size");
+        if (image_info->render_flags & RENDER_FLAG_AUTO_SCALE) {
+            // the fine-scaler crops overflow evenly from both sides, so keep doing that
+            image_info->render_flags |= (RENDER_FLAG_CENTER_HORIZONTAL |
+                    RENDER_FLAG_CENTER_VERTICAL);
+        }
+        image_info->render_flags &= ~(RENDER_FLAG_AUTO_SCALE | RENDER_FLAG_AUTO_FIT);
+        image_output_width = image_info->scaled_width;
+        image_output_height = image_info->scaled_height;
+    } else if ((image_info->render_flags & (RENDER_FLAG_AUTO_SCALE | RENDER_FLAG_AUTO_FIT))
+            || (native_scaling != 1.0f)) {
+        int i;
         image_info->scaling_needed = TRUE;
 
         /*
          * setup the fine-scaler
          * we use rotated image_output_width rather than the pre-rotated sampled_width
          */
-        scaler_make_image_scaler_tables(image_output_width, BYTES_PER_PIXEL(image_output_width),
-                image_info->scaled_width, BYTES_PER_PIXEL(image_info->scaled_width),
-                image_output_height, image_info->scaled_height, &image_info->scaler_config);
+        scaler_make_image_scaler_tables(image_output_width,
+                BYTES_PER_OUTPUT_PIXEL(image_info, image_output_width),
+                image_info->scaled_width,
+                BYTES_PER_OUTPUT_PIXEL(image_info, image_info->scaled_width),
+                image_output_height, image_info->scaled_height, image_info->num_components,
+                &image_info->scaler_config);
 
         image_info->unscaled_rows_needed = 0;
         image_info->mixed_memory_needed = 0;
 
         // calculate memory requirements
         for (i = 0; i < image_info->printable_height; i += max_decode_stripe) {
-            uint16 row;
-            uint16 row_start, row_end, gen_rows, row_offset;
+            uint32 row;
+            uint32 row_start, row_end, gen_rows, row_offset;
             uint32 mixed;
             row = i;
             if (row >= image_info->scaled_height) {
@@ -372,11 +444,17 @@ status_t wprint_image_set_output_properties(wprint_image_info_t *image_info,
                     ((row_end - row_start) + 3));
             image_info->mixed_memory_needed = MAX(image_info->mixed_memory_needed, mixed);
         }
-        int unscaled_size = BYTES_PER_PIXEL(
-                (MAX(image_output_width, image_output_height) * image_info->unscaled_rows_needed));
+        /*
+         * unscaled rows are kept in a ring of unscaled_rows_needed row slots, the scaler reads
+         * them through unscaled_row_table so rows shared by consecutive stripes stay in place
+         */
+        int unscaled_size = BYTES_PER_OUTPUT_PIXEL(image_info,
+                image_output_width * image_info->unscaled_rows_needed);
 
         // allocate memory required for scaling
         image_info->unscaled_rows = malloc(unscaled_size);
+        image_info->unscaled_row_table = malloc(
+                image_info->unscaled_rows_needed * sizeof(unsigned char *));
 
         if (image_info->unscaled_rows != NULL) {
             memset(image_info->unscaled_rows, 0xff, unscaled_size);
@@ -386,6 +464,17 @@ status_t wprint_image_set_output_properties(wprint_image_info_t *image_info,
     } else {
         image_info->scaled_height = image_output_height;
         image_info->scaled_width = image_output_width;
+
+        // let the decoder rotate if it can, saving the transpose through the output cache
+        if (image_info->rotation != ROT_0) {
+            _setup_render_transform(image_info, image_output_width, image_output_height);
+        }
+    }
+
+    if (image_info->render_transform) {
+        // decoded rows are now in output orientation and size
+        image_info->sampled_width = image_info->render_width;
+        image_info->sampled_height = image_info->render_height;
     }
 
     // final calculations
@@ -612,7 +701,7 @@ int wprint_image_get_output_buff_size(wprint_image_info_t *image_info) {
     int width = MAX(MAX(image_info->scaled_width, image_info->scaled_height),
             _get_width(image_info, image_info->padding_options));
     LOGD("wprint_image_get_output_buff_size(): %dx%d", width, image_info->output_rows);
-    return (BYTES_PER_PIXEL(width * image_info->output_rows));
+    return (BYTES_PER_OUTPUT_PIXEL(image_info, width * image_info->output_rows));
 }
 
 static int _get_height(wprint_image_info_t *image_info, unsigned int padding_options) {
@@ -641,6 +730,21 @@ bool wprint_image_is_landscape(wprint_image_info_t *image_info) {
     return (image_info->width > image_info->height);
 }
 
+/*
+ * Copy count decoded RGB pixels to the output, converting them to gray for single component
+ * output
+ */
+static inline void _copy_pixels(wprint_image_info_t *image_info, unsigned char *dst,
+        const unsigned char *src, int count) {
+    if (image_info->num_components == 1) {
+        for (; count > 0; count--, src += BYTES_PER_PIXEL(1)) {
+            *dst++ = (unsigned char) (((src[0] << 6) + (src[1] * 160) + (src[2] << 5)) >> 8);
+        }
+    } else {
+        memcpy(dst, src, BYTES_PER_PIXEL(count));
+    }
+}
+
 int _decode_stripe(wprint_image_info_t *image_info, int start_row, int num_rows,
         unsigned int padding_options, unsigned char *rgb_pixels) {
     int image_y, image_x;
@@ -656,18 +760,18 @@ int _decode_stripe(wprint_image_info_t *image_info, int start_row, int num_rows,
 
     nbytes = 0;
     start_row += image_info->row_offset;
-    rbytes = BYTES_PER_PIXEL(image_info->output_width);
+    rbytes = BYTES_PER_OUTPUT_PIXEL(image_info, image_info->output_width);
 
     // get padding values
-    int padding_left = ((padding_options & PAD_LEFT) ? BYTES_PER_PIXEL(
+    int padding_left = ((padding_options & PAD_LEFT) ? BYTES_PER_OUTPUT_PIXEL(image_info,
             image_info->output_padding_left) : 0);
-    int padding_right = ((padding_options & PAD_RIGHT) ? BYTES_PER_PIXEL(
+    int padding_right = ((padding_options & PAD_RIGHT) ? BYTES_PER_OUTPUT_PIXEL(image_info,
             image_info->output_padding_right) : 0);
 
     old_num_rows = ~num_rows;
-    switch (image_info->rotation) {
+    switch (_decode_rotation(image_info)) {
         case ROT_90:
-            col_offset = BYTES_PER_PIXEL(image_info->col_offset);
+            col_offset = BYTES_PER_OUTPUT_PIXEL(image_info, image_info->col_offset);
             while (num_rows > 0) {
                 if (start_row > image_info->sampled_width) {
                     return nbytes;
@@ -696,11 +800,11 @@ int _decode_stripe(wprint_image_info_t *image_info, int start_row, int num_rows,
                                 ((image_x + image_info->output_swath_start) <
                                         image_info->sampled_width));
                                 image_x++) {
-                            memcpy(image_info->output_cache[image_x] + BYTES_PER_PIXEL(
-                                            (image_info->sampled_height - image_y - 1)),
+                            _copy_pixels(image_info, image_info->output_cache[image_x] +
+                                            BYTES_PER_OUTPUT_PIXEL(image_info,
+                                                    (image_info->sampled_height - image_y - 1)),
                                     image_data + BYTES_PER_PIXEL(
-                                            (image_info->output_swath_start + image_x)),
-                                    BYTES_PER_PIXEL(1));
+                                            (image_info->output_swath_start + image_x)), 1);
                         }
                     }
                 }
@@ -728,17 +832,17 @@ int _decode_stripe(wprint_image_info_t *image_info, int start_row, int num_rows,
                     return ERROR;
                 }
                 for (image_x = 0; image_x < image_info->output_width; image_x++) {
-                    memcpy(rgb_pixels + padding_left + BYTES_PER_PIXEL(image_x),
+                    _copy_pixels(image_info,
+                            rgb_pixels + padding_left + BYTES_PER_OUTPUT_PIXEL(image_info, image_x),
                             image_data + BYTES_PER_PIXEL(image_info->sampled_width -
-                                    image_x - col_offset - 1),
-                            BYTES_PER_PIXEL(1));
+                                    image_x - col_offset - 1), 1);
                 }
                 nbytes += rbytes + padding_left + padding_right;
                 rgb_pixels += rbytes + padding_left + padding_right;
             }
             break;
         case ROT_270:
-            col_offset = BYTES_PER_PIXEL(image_info->col_offset);
+            col_offset = BYTES_PER_OUTPUT_PIXEL(image_info, image_info->col_offset);
             while (num_rows > 0) {
                 if (start_row > image_info->sampled_width) {
                     return nbytes;
@@ -767,11 +871,11 @@ int _decode_stripe(wprint_image_info_t *image_info, int start_row, int num_rows,
                                 ((image_x + image_info->output_swath_start) <
                                         image_info->sampled_width));
                                 image_x++) {
-                            memcpy(image_info->output_cache[image_x] + BYTES_PER_PIXEL(image_y),
+                            _copy_pixels(image_info, image_info->output_cache[image_x] +
+                                            BYTES_PER_OUTPUT_PIXEL(image_info, image_y),
                                     image_data + BYTES_PER_PIXEL(image_info->sampled_width -
                                             (image_info->output_swath_start +
-                                                    image_x) - 1),
-                                    BYTES_PER_PIXEL(1));
+                                                    image_x) - 1), 1);
                         }
                     }
                 }
@@ -800,7 +904,8 @@ int _decode_stripe(wprint_image_info_t *image_info, int start_row, int num_rows,
                     LOGE("ERROR: received no data for row: %d", image_y);
                     return ERROR;
                 }
-                memcpy(rgb_pixels + padding_left, image_data + col_offset, rbytes);
+                _copy_pixels(image_info, rgb_pixels + padding_left, image_data + col_offset,
+                        image_info->output_width);
                 nbytes += rbytes + padding_left + padding_right;
                 rgb_pixels += rbytes + padding_left + padding_right;
             }
@@ -812,7 +917,8 @@ int _decode_stripe(wprint_image_info_t *image_info, int start_row, int num_rows,
 int wprint_image_decode_stripe(wprint_image_info_t *image_info, int start_row, int *height,
         unsigned char *rgb_pixels) {
     int nbytes = 0;
-    int bytes_per_row = BYTES_PER_PIXEL(_get_width(image_info, image_info->padding_options));
+    int bytes_per_row = BYTES_PER_OUTPUT_PIXEL(image_info,
+            _get_width(image_info, image_info->padding_options));
 
     if (height == NULL) {
         return -1;
@@ -823,10 +929,10 @@ int wprint_image_decode_stripe(wprint_image_info_t *image_info, int start_row, i
     *height = 0;
 
     // get padding values
-    int padding_left = ((image_info->padding_options & PAD_LEFT) ? BYTES_PER_PIXEL(
-            image_info->output_padding_left) : 0);
-    int padding_right = ((image_info->padding_options & PAD_RIGHT) ? BYTES_PER_PIXEL(
-            image_info->output_padding_right) : 0);
+    int padding_left = ((image_info->padding_options & PAD_LEFT) ? BYTES_PER_OUTPUT_PIXEL(
+            image_info, image_info->output_padding_left) : 0);
+    int padding_right = ((image_info->padding_options & PAD_RIGHT) ? BYTES_PER_OUTPUT_PIXEL(
+            image_info, image_info->output_padding_right) : 0);
     int padding_top = ((image_info->padding_options & PAD_TOP) ?
             image_info->output_padding_top : 0);
     // handle invalid requests
@@ -876,9 +982,10 @@ int wprint_image_decode_stripe(wprint_image_info_t *image_info, int start_row, i
             scaled_start_row += ((image_info->scaled_height - image_info->printable_height) / 2);
         }
         uint32 stripe_height, mixed;
-        uint16 unscaled_row_start, unscaled_row_end;
-        uint16 generated_rows, row_offset;
+        uint32 unscaled_row_start, unscaled_row_end;
+        uint32 generated_rows, row_offset;
         uint32 predecoded_rows;
+        unsigned int i;
 
         int scaled_num_rows = (((scaled_start_row + num_rows) > image_info->scaled_height) ?
                 (image_info->scaled_height - scaled_start_row) : num_rows);
@@ -894,15 +1001,16 @@ int wprint_image_decode_stripe(wprint_image_info_t *image_info, int start_row, i
                 return -1;
             }
 
+            if ((image_info->unscaled_rows == NULL) || (image_info->unscaled_row_table == NULL)) {
+                LOGE("no memory for unscaled rows");
+                return -1;
+            }
+
             predecoded_rows = 0;
-            if (unscaled_row_start <= image_info->unscaled_end_row) {
-                // shift over any rows we need that were decoded in the previous pass
+            if ((unscaled_row_start >= image_info->unscaled_start_row) &&
+                    (unscaled_row_start <= image_info->unscaled_end_row)) {
+                // rows decoded in the previous pass are still in their ring slots
                 predecoded_rows = (image_info->unscaled_end_row - unscaled_row_start) + 1;
-
-                memmove(image_info->unscaled_rows, image_info->unscaled_rows +
-                        BYTES_PER_PIXEL(((unscaled_row_start - image_info->unscaled_start_row) *
-                                image_info->output_width)),
-                        BYTES_PER_PIXEL((predecoded_rows * image_info->output_width)));
             }
 
             image_info->unscaled_start_row = unscaled_row_start;
@@ -915,30 +1023,48 @@ int wprint_image_decode_stripe(wprint_image_info_t *image_info, int start_row, i
             int rowsLeftToDecode = ((image_info->unscaled_end_row -
                     (image_info->unscaled_start_row + predecoded_rows)) + 1);
             if (rowsLeftToDecode > 0) {
-                int dbytes = _decode_stripe(image_info,
-                        image_info->unscaled_start_row + predecoded_rows, rowsLeftToDecode,
-                        PAD_NONE, (image_info->unscaled_rows + BYTES_PER_PIXEL(predecoded_rows *
-                                image_info->output_width)));
-                if (dbytes <= 0) {
-                    if (dbytes < 0) {
-                        LOGE("couldn't decode rows");
+                int decode_row = image_info->unscaled_start_row + predecoded_rows;
+                while (rowsLeftToDecode > 0) {
+                    // decode up to the end of the ring, then wrap around to the first slot
+                    int slot = decode_row % image_info->unscaled_rows_needed;
+                    int rows = MIN(rowsLeftToDecode,
+                            (int) image_info->unscaled_rows_needed - slot);
+                    int dbytes = _decode_stripe(image_info, decode_row, rows, PAD_NONE,
+                            (image_info->unscaled_rows +
+                                    BYTES_PER_OUTPUT_PIXEL(image_info,
+                                            slot * image_info->output_width)));
+                    if (dbytes <= 0) {
+                        if (dbytes < 0) {
+                            LOGE("couldn't decode rows");
+                        }
+                        return dbytes;
                     }
-                    return dbytes;
+                    decode_row += rows;
+                    rowsLeftToDecode -= rows;
                 }
             } else if (predecoded_rows <= 0) {
                 return 0;
             }
 
+            // point the scaler at the ring slots holding this stripe's rows, in order
+            for (i = 0; i < image_info->unscaled_rows_needed; i++) {
+                image_info->unscaled_row_table[i] = image_info->unscaled_rows +
+                        BYTES_PER_OUTPUT_PIXEL(image_info,
+                                ((image_info->unscaled_start_row + i) %
+                                        image_info->unscaled_rows_needed) *
+                                        image_info->output_width);
+            }
+
             // scale the data to it's final size
-            scaler_scale_image_data(image_info->unscaled_rows, (void *) &image_info->scaler_config,
-                    rgb_pixels, image_info->mixed_memory);
+            scaler_scale_image_rows(image_info->unscaled_row_table,
+                    (void *) &image_info->scaler_config, rgb_pixels, image_info->mixed_memory);
             // do we have to move the data around??
             if ((row_offset != 0) ||
                     (image_info->scaled_width > image_info->printable_width) ||
                     (padding_left > 0) ||
                     (padding_right > 0)) {
                 int delta = 0;
-                int pixelsToMove = BYTES_PER_PIXEL(MIN(image_info->scaled_width,
+                int pixelsToMove = BYTES_PER_OUTPUT_PIXEL(image_info, MIN(image_info->scaled_width,
                         image_info->printable_width));
 
                 int memMoveRow = ((bytes_per_row < image_info->scaler_config.iOutBufWidth) ? 0 : (
@@ -948,7 +1074,7 @@ int wprint_image_decode_stripe(wprint_image_info_t *image_info, int start_row, i
 
                 // if scaled width is greater than the printable area drop pixels on either size
                 if (image_info->scaled_width > image_info->printable_width) {
-                    delta = BYTES_PER_PIXEL(
+                    delta = BYTES_PER_OUTPUT_PIXEL(image_info,
                             ((image_info->scaled_width - image_info->printable_width) / 2));
                 }
 
@@ -1029,13 +1155,13 @@ int wprint_image_compute_rows_to_cache(wprint_image_info_t *image_info) {
     int i;
     int row_width, max_rows;
     unsigned char output_mem;
-    int available_mem = MAX_DECODE_MEM;
+    int available_mem = image_info->memory_budget;
     int width, height;
 
     width = image_info->sampled_width;
     height = image_info->sampled_height;
 
-    switch (image_info->rotation) {
+    switch (_decode_rotation(image_info)) {
         case ROT_90:
         case ROT_270:
             output_mem = 1;
@@ -1053,17 +1179,18 @@ int wprint_image_compute_rows_to_cache(wprint_image_info_t *image_info) {
             image_info->concurrent_stripes);
     if (image_info->unscaled_rows != NULL) {
         // remove any memory allocated for scaling from our pool
-        available_mem -= BYTES_PER_PIXEL(
+        available_mem -= BYTES_PER_OUTPUT_PIXEL(image_info,
                 image_info->unscaled_rows_needed * image_info->output_width);
         available_mem -= image_info->mixed_memory_needed;
     }
 
     // make sure we have a valid amount of memory to work with
-    available_mem = MAX(available_mem, MIN_DECODE_MEM);
+    available_mem = MAX(available_mem,
+            (int) (image_info->memory_budget / MIN_DECODE_MEM_DIVISOR));
 
     LOGD("wprint_image_compute_rows_to_cache(): %d bytes available for row caching", available_mem);
 
-    row_width = BYTES_PER_PIXEL(row_width);
+    row_width = BYTES_PER_OUTPUT_PIXEL(image_info, row_width);
     max_rows = (available_mem / row_width);
 
     if (max_rows > 0xf) {
@@ -1096,6 +1223,24 @@ int wprint_image_input_rows_cached(wprint_image_info_t *image_info) {
     return ((image_info->output_cache != NULL) ? 1 : image_info->rows_cached);
 }
 
+unsigned int wprint_image_get_memory_used(wprint_image_info_t *image_info) {
+    unsigned int used = image_info->decoder_mem_used;
+    if (image_info->unscaled_rows != NULL) {
+        used += BYTES_PER_OUTPUT_PIXEL(image_info,
+                image_info->unscaled_rows_needed * image_info->output_width);
+        used += image_info->unscaled_rows_needed * sizeof(unsigned char *);
+    }
+    if (image_info->mixed_memory != NULL) {
+        used += image_info->mixed_memory_needed;
+    }
+    if (image_info->output_cache != NULL) {
+        // only rotated output is cached, in rows of the unrotated height
+        used += image_info->rows_cached *
+                BYTES_PER_OUTPUT_PIXEL(image_info, image_info->sampled_height);
+    }
+    return used;
+}
+
 void wprint_image_cleanup(wprint_image_info_t *image_info) {
     int i;
     const image_decode_ifc_t *decode_ifc = image_info->decode_ifc;
@@ -1109,6 +1254,10 @@ void wprint_image_cleanup(wprint_image_info_t *image_info) {
         free(image_info->unscaled_rows);
         image_info->unscaled_rows = NULL;
     }
+    if (image_info->unscaled_row_table != NULL) {
+        free(image_info->unscaled_row_table);
+        image_info->unscaled_row_table = NULL;
+    }
 
     // free memory allocated needed for mixed scaling
     if (image_info->mixed_memory != NULL) {
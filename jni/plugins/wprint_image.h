@@ -31,6 +31,7 @@ extern "C"
 #endif
 
 #define BYTES_PER_PIXEL(X)  ((X)*3)
+#define BYTES_PER_OUTPUT_PIXEL(image_info, X)  ((X)*(image_info)->num_components)
 #define BITS_PER_CHANNEL    8
 
 /*
@@ -90,10 +91,12 @@ typedef struct {
     // output information
     unsigned int output_width;
     unsigned int output_height;
-    int num_components;
+    int num_components; // 3 for RGB output, or 1 when decoded rows are converted to gray
     int pdf_render_resolution;
 
     // memory optimization parameters
+    unsigned int memory_budget;
+    unsigned int decoder_mem_used;
     unsigned int stripe_height;
     unsigned int concurrent_stripes;
     unsigned int output_rows;
@@ -106,11 +109,17 @@ typedef struct {
     int unscaled_end_row;
     unsigned int unscaled_rows_needed;
     unsigned char *unscaled_rows;
+    unsigned char **unscaled_row_table;
     unsigned int mixed_memory_needed;
     unsigned char *mixed_memory;
     unsigned char scaling_needed;
     scaler_config_t scaler_config;
 
+    // decoder-side transform parameters
+    unsigned char render_transform;
+    unsigned int render_width;
+    unsigned int render_height;
+
     // padding parameters
     unsigned int output_padding_top;
     unsigned int output_padding_bottom;
@@ -162,6 +171,12 @@ typedef struct _image_decode_ifc_st {
      * Return resolution in DPI
      */
     int (*native_units)(wprint_image_info_t *image_info);
+
+    /*
+     * Return OK if the decoder can supply rows already rotated by image_info->rotation and
+     * scaled to render_width x render_height. May be NULL.
+     */
+    status_t (*supports_transform)(wprint_image_info_t *image_info);
 } image_decode_ifc_t;
 
 /*
@@ -173,7 +188,8 @@ const image_decode_ifc_t *wprint_image_get_decode_ifc(wprint_image_info_t *image
  * Initializes image_info with supplied parameters
  */
 void wprint_image_setup(wprint_image_info_t *image_info, const char *mime_type,
-        const ifc_wprint_t *wprint_ifc, unsigned int output_resolution, int pdf_render_resolution);
+        const ifc_wprint_t *wprint_ifc, unsigned int output_resolution, int pdf_render_resolution,
+        unsigned int memory_budget);
 
 /*
  * Open an initialized image from a file
@@ -181,13 +197,15 @@ void wprint_image_setup(wprint_image_info_t *image_info, const char *mime_type,
 status_t wprint_image_get_info(FILE *imgfile, wprint_image_info_t *image_info);
 
 /*
- * Configure image_info parameters as supplied
+ * Configure image_info parameters as supplied. output_components selects RGB (3) or gray (1)
+ * output; decoders always deliver RGB so gray conversion happens as rows are decoded.
  */
 status_t wprint_image_set_output_properties(wprint_image_info_t *image_info,
         wprint_rotation_t rotation, unsigned int printable_width, unsigned int printable_height,
         unsigned int top_margin, unsigned int left_margin, unsigned int right_margin,
         unsigned int bottom_margin, unsigned int render_flags, unsigned int max_decode_stripe,
-        unsigned int concurrent_stripes, unsigned int padding_options);
+        unsigned int concurrent_stripes, unsigned int padding_options,
+        unsigned int output_components);
 
 /*
  * Return true if the image is wider than it is high (landscape orientation)
@@ -226,6 +244,11 @@ int wprint_image_compute_rows_to_cache(wprint_image_info_t *image_info);
  */
 int wprint_image_input_rows_cached(wprint_image_info_t *image_info);
 
+/*
+ * Return the bytes currently allocated for decoding, scaling and caching rows
+ */
+unsigned int wprint_image_get_memory_used(wprint_image_info_t *image_info);
+
 /*
  * Free all image resources
  */
@@ -42,11 +42,21 @@ typedef struct {
 
     // PDF data
     struct {
+        void *render_ptr;
         void *bitmap_ptr;
         void *fz_context_ptr;
         void *fz_doc_ptr;
         void *fz_page_ptr;
         void *fz_pixmap_ptr;
+        double page_width;
+        double page_height;
+        unsigned int row_width;
+        unsigned int render_height;
+        float zoom;
+        int rotation;
+        int band_start;
+        unsigned int band_rows;
+        unsigned int band_count;
     } pdf_info;
 } decoder_data_t;
 
@@ -16,6 +16,8 @@
  * limitations under the License.
  */
 
+#include <pthread.h>
+#include <string.h>
 #include <time.h>
 #include "wprint_mupdf.h"
 #include "lib_wprint.h"
@@ -25,10 +27,38 @@
 #define MUPDF_DEFAULT_RESOLUTION 72
 #define RGB_NUMBER_PIXELS_NUM_COMPONENTS 3
 
-static pdf_render_ifc_t *pdf_render;
+/*
+ * Every pdf_render interface drives the same PdfRender object, which holds a single open
+ * document. Calls from concurrent jobs and page workers are serialized, and the document is
+ * reopened whenever the caller's file is not the one last opened.
+ */
+static pthread_mutex_t _render_lock = PTHREAD_MUTEX_INITIALIZER;
+static char _open_path[MAX_PATHNAME_LENGTH + 1];
+
+#define _PDF_RENDER(IMAGE_INFO) \
+        ((pdf_render_ifc_t *) (IMAGE_INFO)->decoder_data.pdf_info.render_ptr)
 
 static void _mupdf_init(wprint_image_info_t *image_info) {
-    pdf_render = create_pdf_render_ifc();
+    // each image gets its own interface since it is bound to the calling thread
+    image_info->decoder_data.pdf_info.render_ptr = create_pdf_render_ifc();
+}
+
+/*
+ * Opens the image's document in the renderer. Must be called with _render_lock held. Returns
+ * the document's page count, or a value below 1 on failure.
+ */
+static int _mupdf_open_locked(wprint_image_info_t *image_info, bool force) {
+    int pages = 1;
+    if (force || (strcmp(_open_path, image_info->decoder_data.urlPath) != 0)) {
+        pages = _PDF_RENDER(image_info)->openDocument(_PDF_RENDER(image_info),
+                image_info->decoder_data.urlPath);
+        if (pages < 1) {
+            _open_path[0] = '\0';
+        } else {
+            strncpy(_open_path, image_info->decoder_data.urlPath, MAX_PATHNAME_LENGTH);
+        }
+    }
+    return pages;
 }
 
 /* Return current clock time in milliseconds */
@@ -41,70 +71,180 @@ static long get_millis() {
 static status_t _mupdf_get_hdr(wprint_image_info_t *image_info) {
     double pageWidth, pageHeight;
     float zoom;
-    unsigned int imageWidth;
-    unsigned int imageHeight;
-    int size;
-    char *rawBuffer;
     status_t result;
     int pages;
 
-    pages = pdf_render->openDocument(pdf_render, image_info->decoder_data.urlPath);
-    if (pages < 1) return ERROR;
+    if (_PDF_RENDER(image_info) == NULL) return ERROR;
 
-    result = pdf_render->getPageAttributes(pdf_render, image_info->decoder_data.page, &pageWidth,
-            &pageHeight);
+    pthread_mutex_lock(&_render_lock);
+    pages = _mupdf_open_locked(image_info, true);
+    result = (pages < 1) ? ERROR : _PDF_RENDER(image_info)->getPageAttributes(
+            _PDF_RENDER(image_info), image_info->decoder_data.page, &pageWidth, &pageHeight);
+    pthread_mutex_unlock(&_render_lock);
     if (result != OK) return result;
 
     const float POINTS_PER_INCH = MUPDF_DEFAULT_RESOLUTION;
     zoom = (image_info->pdf_render_resolution) / POINTS_PER_INCH;
 
-    imageWidth = (unsigned int) (pageWidth * zoom);
-    imageHeight = (unsigned int) (pageHeight * zoom);
+    image_info->width = (unsigned int) (pageWidth * zoom);
+    image_info->height = (unsigned int) (pageHeight * zoom);
+    image_info->num_components = RGB_NUMBER_PIXELS_NUM_COMPONENTS;
+
+    // Rendering is deferred to the first decoded row so that the output transform is known
+    image_info->decoder_data.pdf_info.page_width = pageWidth;
+    image_info->decoder_data.pdf_info.page_height = pageHeight;
+    image_info->decoder_data.pdf_info.fz_pixmap_ptr = NULL;
+    image_info->decoder_data.pdf_info.bitmap_ptr = NULL;
+
+    return OK;
+}
+
+/*
+ * Work out the rendered page size and transform, rotated and sized as requested by
+ * the image pipeline if a render transform was accepted, and allocate the band buffer.
+ * The page is rendered in bands so the raw RGB data stays within the memory budget.
+ */
+static status_t _mupdf_setup_render(wprint_image_info_t *image_info) {
+    unsigned int imageWidth = image_info->width;
+    unsigned int imageHeight = image_info->height;
+    unsigned int rowBytes, bandRows;
+    int rotation = 0;
+    float zoom;
+    char *rawBuffer;
 
-    image_info->width = imageWidth;
-    image_info->height = imageHeight;
+    const float POINTS_PER_INCH = MUPDF_DEFAULT_RESOLUTION;
+    zoom = (image_info->pdf_render_resolution) / POINTS_PER_INCH;
+
+    if (image_info->render_transform) {
+        double rotatedPageWidth = image_info->decoder_data.pdf_info.page_width;
+        switch (image_info->rotation) {
+            case ROT_90:
+                rotation = 90;
+                rotatedPageWidth = image_info->decoder_data.pdf_info.page_height;
+                break;
+            case ROT_180:
+                rotation = 180;
+                break;
+            case ROT_270:
+                rotation = 270;
+                rotatedPageWidth = image_info->decoder_data.pdf_info.page_height;
+                break;
+            case ROT_0:
+            default:
+                break;
+        }
+        imageWidth = image_info->render_width;
+        imageHeight = image_info->render_height;
+        zoom = (float) (imageWidth / rotatedPageWidth);
+    }
 
-    size = imageWidth * imageHeight * 3;
+    // Band height follows the row cache. When the cache holds rotated output, every swath reads
+    // every row of the page, so banding would render the page again for each swath. The page
+    // is then rendered once, whole, and each swath crops its columns from it.
+    rowBytes = imageWidth * RGB_NUMBER_PIXELS_NUM_COMPONENTS;
+    if (image_info->output_cache == NULL) {
+        bandRows = MAX(1, MIN((unsigned int) image_info->rows_cached, imageHeight));
+    } else {
+        bandRows = imageHeight;
+        if ((unsigned long long) bandRows * rowBytes > image_info->memory_budget) {
+            LOGI("_mupdf_setup_render(): rotated page of %u bytes exceeds the %u byte budget",
+                    bandRows * rowBytes, image_info->memory_budget);
+        }
+    }
 
-    rawBuffer = (char *) malloc((size_t) size);
+    rawBuffer = (char *) malloc((size_t) bandRows * rowBytes);
     if (!rawBuffer) return ERROR;
 
-    LOGI("Render page=%d w=%.0f h=%.0f res=%d zoom=%0.2f size=%d", image_info->decoder_data.page,
-            pageWidth, pageHeight, image_info->pdf_render_resolution, zoom, size);
+    image_info->decoder_data.pdf_info.bitmap_ptr = malloc(rowBytes);
+    if (!image_info->decoder_data.pdf_info.bitmap_ptr) {
+        free(rawBuffer);
+        return ERROR;
+    }
+
+    LOGI("Render page=%d w=%d h=%d res=%d zoom=%0.2f rotation=%d band=%d rows",
+            image_info->decoder_data.page, imageWidth, imageHeight,
+            image_info->pdf_render_resolution, zoom, rotation, bandRows);
+
+    image_info->decoder_data.pdf_info.fz_pixmap_ptr = rawBuffer;
+    image_info->decoder_data.pdf_info.row_width = imageWidth;
+    image_info->decoder_data.pdf_info.render_height = imageHeight;
+    image_info->decoder_data.pdf_info.zoom = zoom;
+    image_info->decoder_data.pdf_info.rotation = rotation;
+    image_info->decoder_data.pdf_info.band_start = -1;
+    image_info->decoder_data.pdf_info.band_rows = bandRows;
+    image_info->decoder_data.pdf_info.band_count = 0;
+    image_info->decoder_mem_used = (bandRows + 1) * rowBytes;
+    return OK;
+}
+
+/*
+ * Render the band of the page containing row into the band buffer
+ */
+static status_t _mupdf_render_band(wprint_image_info_t *image_info, int row) {
+    unsigned int bandRows = image_info->decoder_data.pdf_info.band_rows;
+    int bandStart = (row / bandRows) * bandRows;
+    unsigned int bandCount = MIN(bandRows,
+            image_info->decoder_data.pdf_info.render_height - bandStart);
+    status_t result;
 
     long now = get_millis();
 
-    result = pdf_render->renderPageStripe(pdf_render, image_info->decoder_data.page, imageWidth,
-            imageHeight, zoom, rawBuffer);
+    pthread_mutex_lock(&_render_lock);
+    result = (_mupdf_open_locked(image_info, false) < 1) ? ERROR :
+            _PDF_RENDER(image_info)->renderPageStripe(_PDF_RENDER(image_info),
+            image_info->decoder_data.page, bandStart, image_info->decoder_data.pdf_info.row_width,
+            bandCount, image_info->decoder_data.pdf_info.zoom,
+            image_info->decoder_data.pdf_info.rotation,
+            image_info->decoder_data.pdf_info.fz_pixmap_ptr);
+    pthread_mutex_unlock(&_render_lock);
     if (result != OK) {
-        free(rawBuffer);
+        image_info->decoder_data.pdf_info.band_start = -1;
         return result;
     }
 
-    LOGI("Render complete in %ld ms", get_millis() - now);
-
-    image_info->decoder_data.pdf_info.fz_pixmap_ptr = rawBuffer;
-    image_info->decoder_data.pdf_info.bitmap_ptr = malloc(
-            image_info->width * RGB_NUMBER_PIXELS_NUM_COMPONENTS);
-    image_info->num_components = RGB_NUMBER_PIXELS_NUM_COMPONENTS;
+    LOGD("Rendered rows %d-%d in %ld ms", bandStart, bandStart + bandCount - 1,
+            get_millis() - now);
 
+    image_info->decoder_data.pdf_info.band_start = bandStart;
+    image_info->decoder_data.pdf_info.band_count = bandCount;
     return OK;
 }
 
 static unsigned char *_mupdf_decode_row(wprint_image_info_t *image_info, int row) {
     unsigned char *rgbPixels = 0;
+    unsigned int rowBytes;
+    int bandStart;
 
     if (image_info->swath_start == -1) {
         wprint_image_compute_rows_to_cache(image_info);
     }
 
-    image_info->swath_start = row;
-    if (NULL != image_info->decoder_data.pdf_info.fz_pixmap_ptr) {
-        rgbPixels = (unsigned char *) image_info->decoder_data.pdf_info.bitmap_ptr;
-        memcpy(rgbPixels, (char *) (image_info->decoder_data.pdf_info.fz_pixmap_ptr) +
-                        row * image_info->width * RGB_NUMBER_PIXELS_NUM_COMPONENTS,
-                image_info->width * RGB_NUMBER_PIXELS_NUM_COMPONENTS);
+    if ((NULL == image_info->decoder_data.pdf_info.fz_pixmap_ptr) &&
+            (_mupdf_setup_render(image_info) != OK)) {
+        LOGE("_mupdf_decode_row(): could not render page %d", image_info->decoder_data.page);
+        return NULL;
+    }
+
+    if ((row < 0) || ((unsigned int) row >= image_info->decoder_data.pdf_info.render_height)) {
+        return NULL;
     }
+
+    bandStart = image_info->decoder_data.pdf_info.band_start;
+    if ((bandStart < 0) || (row < bandStart) ||
+            (row >= bandStart + (int) image_info->decoder_data.pdf_info.band_count)) {
+        if (_mupdf_render_band(image_info, row) != OK) {
+            LOGE("_mupdf_decode_row(): could not render page %d",
+                    image_info->decoder_data.page);
+            return NULL;
+        }
+        bandStart = image_info->decoder_data.pdf_info.band_start;
+    }
+
+    image_info->swath_start = row;
+    rowBytes = image_info->decoder_data.pdf_info.row_width * RGB_NUMBER_PIXELS_NUM_COMPONENTS;
+    rgbPixels = (unsigned char *) image_info->decoder_data.pdf_info.bitmap_ptr;
+    memcpy(rgbPixels, (char *) (image_info->decoder_data.pdf_info.fz_pixmap_ptr) +
+            (row - bandStart) * rowBytes, rowBytes);
     return rgbPixels;
 }
 
@@ -116,9 +256,12 @@ static status_t _mupdf_cleanup(wprint_image_info_t *image_info) {
     }
     if (image_info->decoder_data.pdf_info.bitmap_ptr != NULL) {
         free(image_info->decoder_data.pdf_info.bitmap_ptr);
+        image_info->decoder_data.pdf_info.bitmap_ptr = NULL;
+    }
+    if (_PDF_RENDER(image_info) != NULL) {
+        _PDF_RENDER(image_info)->destroy(_PDF_RENDER(image_info));
+        image_info->decoder_data.pdf_info.render_ptr = NULL;
     }
-    pdf_render->destroy(pdf_render);
-    pdf_render = NULL;
     return OK;
 }
 
@@ -131,9 +274,19 @@ static int _mupdf_native_units(wprint_image_info_t *image_info) {
     return image_info->pdf_render_resolution;
 }
 
+static status_t _mupdf_supports_transform(wprint_image_info_t *image_info) {
+    // The renderer rasterizes vectors directly at any size and orientation
+    if ((_PDF_RENDER(image_info) == NULL) || (image_info->render_width == 0) ||
+            (image_info->render_height == 0)) {
+        return ERROR;
+    }
+    return OK;
+}
+
 static const image_decode_ifc_t _mupdf_decode_ifc = {&_mupdf_init, &_mupdf_get_hdr,
         &_mupdf_decode_row, &_mupdf_cleanup,
         &_mupdf_supports_subsampling,
-        &_mupdf_native_units,};
+        &_mupdf_native_units,
+        &_mupdf_supports_transform,};
 
 const image_decode_ifc_t *wprint_mupdf_decode_ifc = &_mupdf_decode_ifc;
\ No newline at end of file
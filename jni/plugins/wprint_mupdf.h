@@ -37,11 +37,13 @@ struct pdf_render_ifc {
     int (*openDocument)(pdf_render_ifc_t *self, const char *fileName);
 
     /*
-     * Render a page (1-based) at the specified zoom level into the supplied output buffer. The
-     * buffer must be large enough to contain width * height * 3 (RGB). Returns success.
+     * Render a stripe of a page (1-based) at the specified zoom level, rotated clockwise by
+     * rotation degrees (0, 90, 180 or 270), into the supplied output buffer. The stripe starts
+     * y rows down the rotated output and is width x height. The buffer must be large enough to
+     * contain width * height * 3 (RGB). Returns success.
      */
-    status_t (*renderPageStripe)(pdf_render_ifc_t *self, int page, int width,
-            int height, float zoom, char *buffer);
+    status_t (*renderPageStripe)(pdf_render_ifc_t *self, int page, int y, int width,
+            int height, float zoom, int rotation, char *buffer);
 
     /*
      * Determine the width and height of a particular page (1-based), returning success.
@@ -19,26 +19,36 @@
 #include "wprint_scaler.h"
 #include <assert.h>
 #include <stdio.h>
+#include <string.h>
 
 #define ROUND_4_DOWN(x) ((x) & ~3)
 #define ROUND_4_UP(x)   (ROUND_4_DOWN((x) + 3))
 #define PSCALER_FRACT_BITS_COUNT 24
 
+// Scale up position error stays below one interpolation step (1/1024) up to this width
+#define PSCALER_RATIO_1_2_MAX_WIDTH 16384
+
 typedef enum {
     FRACTION_ROUND_UP,
     FRACTION_TRUNCATE
 } pscaler_fraction_t;
 
 static uint32
-        _scaler_fraction_part(uint32 iNum, uint32 iDen, pscaler_fraction_t mode, bool_t *overflow);
+        _scaler_fraction_part(uint64 iNum, uint32 iDen, pscaler_fraction_t mode, bool_t *overflow);
 
 static void _hw_scale_image_plane(scaler_config_t *pscaler_config, scaler_mode_t scaleMode);
 
 static void _calculate_factors(scaler_config_t *pscaler_config, scaler_mode_t scaleMode);
 
-void scaler_make_image_scaler_tables(uint16 image_input_width, uint16 image_input_buf_width,
-        uint16 image_output_width, uint16 image_output_buf_width, uint16 image_input_height,
-        uint16 image_output_height, scaler_config_t *pscaler_config) {
+static scaler_ratio_t _find_ratio(scaler_config_t *pscaler_config);
+
+static void _scale_image(scaler_config_t *pscaler_config, uint8 *scaled_output_plane,
+        uint8 *temp_buffer_for_mixed_axis_scaling);
+
+void scaler_make_image_scaler_tables(uint32 image_input_width, uint32 image_input_buf_width,
+        uint32 image_output_width, uint32 image_output_buf_width, uint32 image_input_height,
+        uint32 image_output_height, uint32 components, scaler_config_t *pscaler_config) {
+    pscaler_config->iComponents = (components == 1) ? 1 : 3;
     pscaler_config->iSrcWidth = image_input_width;
     pscaler_config->iSrcHeight = image_input_height;
     pscaler_config->iOutWidth = image_output_width;
@@ -58,6 +68,7 @@ void scaler_make_image_scaler_tables(uint16 image_input_width, uint16 image_inpu
 
     // Setup scale factors
     _calculate_factors(pscaler_config, pscaler_config->scaleMode);
+    pscaler_config->ratio = _find_ratio(pscaler_config);
 
     // calculates initial buffer sizes for scaling whole image
     //  start rows    == 0
@@ -72,13 +83,14 @@ void scaler_make_image_scaler_tables(uint16 image_input_width, uint16 image_inpu
     pscaler_config->iOutEndRow = pscaler_config->iOutHeight;
     pscaler_config->iOutBufWidth = image_output_buf_width;
     pscaler_config->pSrcBuf = NULL;
+    pscaler_config->ppSrcRows = NULL;
     pscaler_config->pOutBuf = NULL;
     pscaler_config->pTmpBuf = NULL;
 }
 
-void scaler_calculate_scaling_rows(uint16 start_output_row_number, uint16 end_output_row_number,
-        void *tables_ptr, uint16 *start_input_row_number, uint16 *end_input_row_number,
-        uint16 *num_output_rows_generated, uint16 *num_rows_offset_to_start_output_row,
+void scaler_calculate_scaling_rows(uint32 start_output_row_number, uint32 end_output_row_number,
+        void *tables_ptr, uint32 *start_input_row_number, uint32 *end_input_row_number,
+        uint32 *num_output_rows_generated, uint32 *num_rows_offset_to_start_output_row,
         uint32 *mixed_axis_temp_buffer_size_needed) {
     float64_t fSrcEndRow;
     bool_t overflow;
@@ -116,12 +128,13 @@ void scaler_calculate_scaling_rows(uint16 start_output_row_number, uint16 end_ou
         pscaler_config->iOutHeight--;
     }
 
-    pscaler_config->fSrcStartRow.decimal = (uint32) pscaler_config->iOutStartRow *
-            (uint32) pscaler_config->iSrcHeight / (uint32) pscaler_config->iOutHeight;
+    // row products can exceed 32 bits on very tall pages
+    pscaler_config->fSrcStartRow.decimal = (uint32) ((uint64) pscaler_config->iOutStartRow *
+            pscaler_config->iSrcHeight / pscaler_config->iOutHeight);
 
     pscaler_config->fSrcStartRow.fraction = _scaler_fraction_part(
-            (uint32) pscaler_config->iOutStartRow * (uint32) pscaler_config->iSrcHeight,
-            (uint32) pscaler_config->iOutHeight, FRACTION_ROUND_UP, &overflow);
+            (uint64) pscaler_config->iOutStartRow * pscaler_config->iSrcHeight,
+            pscaler_config->iOutHeight, FRACTION_ROUND_UP, &overflow);
 
     if (overflow) {
         pscaler_config->fSrcStartRow.decimal++;
@@ -131,13 +144,13 @@ void scaler_calculate_scaling_rows(uint16 start_output_row_number, uint16 end_ou
 
     if (pscaler_config->scaleMode == PSCALER_SCALE_UP ||
             pscaler_config->scaleMode == PSCALER_SCALE_MIXED_YUP) {
-        fSrcEndRow.decimal = (uint32) pscaler_config->iOutEndRow *
-                (uint32) pscaler_config->iSrcHeight / (uint32) pscaler_config->iOutHeight;
+        fSrcEndRow.decimal = (uint32) ((uint64) pscaler_config->iOutEndRow *
+                pscaler_config->iSrcHeight / pscaler_config->iOutHeight);
         fSrcEndRow.fraction = _scaler_fraction_part(
-                (uint32) pscaler_config->iOutEndRow * (uint32) pscaler_config->iSrcHeight,
-                (uint32) pscaler_config->iOutHeight, FRACTION_TRUNCATE, &overflow);
+                (uint64) pscaler_config->iOutEndRow * pscaler_config->iSrcHeight,
+                pscaler_config->iOutHeight, FRACTION_TRUNCATE, &overflow);
 
-        pscaler_config->iSrcEndRow = (uint16) fSrcEndRow.decimal;
+        pscaler_config->iSrcEndRow = fSrcEndRow.decimal;
 
         if (0 != fSrcEndRow.fraction) {
             // will cause an extra output row to be created...
@@ -149,15 +162,14 @@ void scaler_calculate_scaling_rows(uint16 start_output_row_number, uint16 end_ou
         pscaler_config->iSrcHeight++;
         pscaler_config->iOutHeight++;
     } else {
-        fSrcEndRow.decimal = (uint32) (pscaler_config->iOutEndRow + 1) *
-                (uint32) pscaler_config->iSrcHeight /
-                (uint32) pscaler_config->iOutHeight;
+        fSrcEndRow.decimal = (uint32) ((uint64) (pscaler_config->iOutEndRow + 1) *
+                pscaler_config->iSrcHeight / pscaler_config->iOutHeight);
 
         fSrcEndRow.fraction = _scaler_fraction_part(
-                (uint32) (pscaler_config->iOutEndRow + 1) * (uint32) pscaler_config->iSrcHeight,
-                (uint32) pscaler_config->iOutHeight, FRACTION_TRUNCATE, &overflow);
+                (uint64) (pscaler_config->iOutEndRow + 1) * pscaler_config->iSrcHeight,
+                pscaler_config->iOutHeight, FRACTION_TRUNCATE, &overflow);
 
-        pscaler_config->iSrcEndRow = (uint16) fSrcEndRow.decimal;
+        pscaler_config->iSrcEndRow = fSrcEndRow.decimal;
 
         if (0 == fSrcEndRow.fraction) {
             pscaler_config->iSrcEndRow--;
@@ -176,11 +188,11 @@ void scaler_calculate_scaling_rows(uint16 start_output_row_number, uint16 end_ou
     // Calculate the 2nd pass buffer size if mixed scaling is done
     if (pscaler_config->scaleMode == PSCALER_SCALE_MIXED_XUP) {
         *mixed_axis_temp_buffer_size_needed =
-                ROUND_4_UP(pscaler_config->iOutWidth + 1) *
+                ROUND_4_UP(pscaler_config->iOutWidth + 1) * pscaler_config->iComponents *
                         (*end_input_row_number - *start_input_row_number + 1);
     } else if (pscaler_config->scaleMode == PSCALER_SCALE_MIXED_YUP) {
-        *mixed_axis_temp_buffer_size_needed =
-                ROUND_4_UP(pscaler_config->iSrcWidth) * (*num_output_rows_generated + 1);
+        *mixed_axis_temp_buffer_size_needed = ROUND_4_UP(pscaler_config->iSrcWidth) *
+                pscaler_config->iComponents * (*num_output_rows_generated + 1);
     } else {
         *mixed_axis_temp_buffer_size_needed = 0;
     }
@@ -190,14 +202,29 @@ void scaler_calculate_scaling_rows(uint16 start_output_row_number, uint16 end_ou
 
 void scaler_scale_image_data(uint8 *input_plane, void *tables_ptr, uint8 *scaled_output_plane,
         uint8 *temp_buffer_for_mixed_axis_scaling) {
-    uint16 iOrigWidth, iOrigHeight, iOrigOutBufWidth, iOrigSrcBufWidth;
-    uint16 iOrigOutStartRow, iOrigOutEndRow, iOrigSrcStartRow, iOrigSrcEndRow;
+    scaler_config_t *pscaler_config = (scaler_config_t *) tables_ptr;
+    pscaler_config->pSrcBuf = input_plane;
+    pscaler_config->ppSrcRows = NULL;
+    _scale_image(pscaler_config, scaled_output_plane, temp_buffer_for_mixed_axis_scaling);
+}
+
+void scaler_scale_image_rows(uint8 **input_rows, void *tables_ptr, uint8 *scaled_output_plane,
+        uint8 *temp_buffer_for_mixed_axis_scaling) {
+    scaler_config_t *pscaler_config = (scaler_config_t *) tables_ptr;
+    pscaler_config->pSrcBuf = NULL;
+    pscaler_config->ppSrcRows = input_rows;
+    _scale_image(pscaler_config, scaled_output_plane, temp_buffer_for_mixed_axis_scaling);
+    pscaler_config->ppSrcRows = NULL;
+}
+
+static void _scale_image(scaler_config_t *pscaler_config, uint8 *scaled_output_plane,
+        uint8 *temp_buffer_for_mixed_axis_scaling) {
+    uint32 iOrigWidth, iOrigHeight, iOrigOutBufWidth, iOrigSrcBufWidth;
+    uint32 iOrigOutStartRow, iOrigOutEndRow, iOrigSrcStartRow, iOrigSrcEndRow;
     float64_t fOrigSrcStartRow;
     uint8 *pOrigBuf;
-    scaler_config_t *pscaler_config;
+    uint8 **ppOrigRows;
 
-    pscaler_config = (scaler_config_t *) tables_ptr;
-    pscaler_config->pSrcBuf = input_plane;
     pscaler_config->pOutBuf = scaled_output_plane;
 
     if ((PSCALER_SCALE_MIXED_XUP == pscaler_config->scaleMode) ||
@@ -258,9 +285,11 @@ void scaler_scale_image_data(uint8 *input_plane, void *tables_ptr, uint8 *scaled
 
         // save the original input buffer
         pOrigBuf = pscaler_config->pSrcBuf;
+        ppOrigRows = pscaler_config->ppSrcRows;
 
         // use the previous output (temp) buffer as the new input buffer
         pscaler_config->pSrcBuf = pscaler_config->pTmpBuf;
+        pscaler_config->ppSrcRows = NULL;
 
         if (PSCALER_SCALE_MIXED_YUP == pscaler_config->scaleMode) {
             // save the original input height and rows
@@ -312,6 +341,7 @@ void scaler_scale_image_data(uint8 *input_plane, void *tables_ptr, uint8 *scaled
         // restore the input buffer
         pscaler_config->pTmpBuf = pscaler_config->pSrcBuf;
         pscaler_config->pSrcBuf = pOrigBuf;
+        pscaler_config->ppSrcRows = ppOrigRows;
 
         // release the temp buffer
         pscaler_config->pTmpBuf = NULL;
@@ -382,10 +412,36 @@ static void _calculate_factors(scaler_config_t *pscaler_config, scaler_mode_t sc
     }
 }
 
-static uint32 _scaler_fraction_part(uint32 iNum, uint32 iDen, pscaler_fraction_t mode,
+/*
+ * Returns the exact integer ratio between input and output sizes that has a specialised kernel,
+ * or PSCALER_RATIO_ANY. The specialised kernels give the same results as the generic ones.
+ */
+static scaler_ratio_t _find_ratio(scaler_config_t *pscaler_config) {
+    uint32 src_w = pscaler_config->iSrcWidth, src_h = pscaler_config->iSrcHeight;
+    uint32 out_w = pscaler_config->iOutWidth, out_h = pscaler_config->iOutHeight;
+
+    if (pscaler_config->scaleMode == PSCALER_SCALE_DOWN) {
+        if ((src_w == out_w) && (src_h == out_h)) {
+            return PSCALER_RATIO_1_1;
+        } else if ((src_w == (out_w * 2)) && (src_h == (out_h * 2))) {
+            return PSCALER_RATIO_2_1;
+        } else if ((src_w == (out_w * 4)) && (src_h == (out_h * 4))) {
+            return PSCALER_RATIO_4_1;
+        }
+    } else if (pscaler_config->scaleMode == PSCALER_SCALE_UP) {
+        // scale up factors are (dim-1)/(dim-1), so only this gives a half pixel step
+        if ((src_w > 1) && (src_h > 1) && (out_w < PSCALER_RATIO_1_2_MAX_WIDTH) &&
+                ((out_w - 1) == ((src_w - 1) * 2)) && ((out_h - 1) == ((src_h - 1) * 2))) {
+            return PSCALER_RATIO_1_2;
+        }
+    }
+    return PSCALER_RATIO_ANY;
+}
+
+static uint32 _scaler_fraction_part(uint64 iNum, uint32 iDen, pscaler_fraction_t mode,
         bool_t *overflow) {
     uint32 iFract;     // fractional part
-    uint32 iRem;       // remainder part
+    uint64 iRem;       // remainder part, shifted up to twice iDen
     int i;          // loop counter
 
     *overflow = 0;
@@ -840,11 +896,17 @@ static inline void _scale_row_down_2in(uint8 *_RESTRICT_ in0, uint8 *_RESTRICT_
     }
 }
 
-static inline void _scale_row_down(uint8 *in, uint8 *_RESTRICT_ out, uint32 in_row_ofs,
-        uint64 position_x, uint64 position_y, uint64 x_factor_inv, uint64 y_factor_inv,
-        uint32 weight_reciprocal, int out_width) {
+/*
+ * Input row y of the window starts at in_rows[y] if a row table is given, otherwise at
+ * in + y * in_row_ofs
+ */
+#define _IN_ROW(y) ((in_rows != NULL) ? in_rows[(y)] : (in + (y) * in_row_ofs))
+
+static inline void _scale_row_down(uint8 *in, uint8 **in_rows, uint32 in_row_ofs,
+        uint8 *_RESTRICT_ out, uint64 position_x, uint64 position_y, uint64 x_factor_inv,
+        uint64 y_factor_inv, uint32 weight_reciprocal, int out_width, uint32 components) {
     int x;
-    uint32 y, in_col, in_rows, top_weight, bot_weight;
+    uint32 y, in_col, num_rows, top_weight, bot_weight;
     sint32 total_weight;
 
     total_weight = y_factor_inv >> 24;
@@ -869,46 +931,71 @@ static inline void _scale_row_down(uint8 *in, uint8 *_RESTRICT_ out, uint32 in_r
     assert(total_weight >= 0);
     assert((total_weight & 0xff) == 0);
 
-    in_rows = 2 + (total_weight >> 8);
+    num_rows = 2 + (total_weight >> 8);
+
+    if (components == 1) {
+        // gray pixels, same weighting as the RGB loop at the bottom
+        for (x = 0; x < out_width; x++) {
+            uint32 acc = 0;
+            uint32 curr_weight = 256 - ((position_x >> 24) & 0xff);
+            total_weight = x_factor_inv >> 24;
+
+            in_col = position_x >> 32;
+
+            while (total_weight > 0) {
+                acc += (uint32) _IN_ROW(0)[in_col] * curr_weight * top_weight;
+                for (y = 1; y < num_rows - 1; y++) {
+                    acc += (uint32) _IN_ROW(y)[in_col] * curr_weight * 256;
+                }
+                acc += (uint32) _IN_ROW(y)[in_col] * curr_weight * bot_weight;
+
+                in_col++;
+                total_weight -= curr_weight;
+                curr_weight = total_weight > 256 ? 256 : total_weight;
+            }
+
+            position_x += x_factor_inv;
 
-    if (in_rows == 2) {
-        _scale_row_down_2in(in, in + in_row_ofs,
+            out[x] = ((uint64) acc * weight_reciprocal + ((uint64) 1 << 31)) >> 32;
+        }
+    } else if (num_rows == 2) {
+        _scale_row_down_2in(_IN_ROW(0), _IN_ROW(1),
                 out, position_x, x_factor_inv, top_weight, bot_weight, weight_reciprocal,
                 out_width);
-    } else if (in_rows == 3) {
-        _scale_row_down_3in(in, in + in_row_ofs, in + 2 * in_row_ofs,
+    } else if (num_rows == 3) {
+        _scale_row_down_3in(_IN_ROW(0), _IN_ROW(1), _IN_ROW(2),
                 out, position_x, x_factor_inv, top_weight, bot_weight, weight_reciprocal,
                 out_width);
-    } else if (in_rows == 4) {
-        _scale_row_down_4in(in, in + in_row_ofs, in + 2 * in_row_ofs, in + 3 * in_row_ofs,
+    } else if (num_rows == 4) {
+        _scale_row_down_4in(_IN_ROW(0), _IN_ROW(1), _IN_ROW(2), _IN_ROW(3),
                 out, position_x, x_factor_inv, top_weight, bot_weight, weight_reciprocal,
                 out_width);
-    } else if (in_rows == 5) {
-        _scale_row_down_5in(in, in + in_row_ofs, in + 2 * in_row_ofs, in + 3 * in_row_ofs,
-                in + 4 * in_row_ofs,
+    } else if (num_rows == 5) {
+        _scale_row_down_5in(_IN_ROW(0), _IN_ROW(1), _IN_ROW(2), _IN_ROW(3),
+                _IN_ROW(4),
                 out, position_x, x_factor_inv,
                 top_weight, bot_weight, weight_reciprocal,
                 out_width);
-    } else if (in_rows == 6) {
-        _scale_row_down_6in(in, in + in_row_ofs, in + 2 * in_row_ofs, in + 3 * in_row_ofs,
-                in + 4 * in_row_ofs, in + 5 * in_row_ofs,
+    } else if (num_rows == 6) {
+        _scale_row_down_6in(_IN_ROW(0), _IN_ROW(1), _IN_ROW(2), _IN_ROW(3),
+                _IN_ROW(4), _IN_ROW(5),
                 out, position_x, x_factor_inv, top_weight, bot_weight, weight_reciprocal,
                 out_width);
-    } else if (in_rows == 7) {
-        _scale_row_down_7in(in, in + in_row_ofs, in + 2 * in_row_ofs, in + 3 * in_row_ofs,
-                in + 4 * in_row_ofs, in + 5 * in_row_ofs, in + 6 * in_row_ofs,
+    } else if (num_rows == 7) {
+        _scale_row_down_7in(_IN_ROW(0), _IN_ROW(1), _IN_ROW(2), _IN_ROW(3),
+                _IN_ROW(4), _IN_ROW(5), _IN_ROW(6),
                 out, position_x, x_factor_inv, top_weight, bot_weight, weight_reciprocal,
                 out_width);
-    } else if (in_rows == 8) {
-        _scale_row_down_8in(in, in + in_row_ofs, in + 2 * in_row_ofs, in + 3 * in_row_ofs,
-                in + 4 * in_row_ofs, in + 5 * in_row_ofs, in + 6 * in_row_ofs,
-                in + 7 * in_row_ofs,
+    } else if (num_rows == 8) {
+        _scale_row_down_8in(_IN_ROW(0), _IN_ROW(1), _IN_ROW(2), _IN_ROW(3),
+                _IN_ROW(4), _IN_ROW(5), _IN_ROW(6),
+                _IN_ROW(7),
                 out, position_x, x_factor_inv, top_weight, bot_weight, weight_reciprocal,
                 out_width);
-    } else if (in_rows == 9) {
-        _scale_row_down_9in(in, in + in_row_ofs, in + 2 * in_row_ofs, in + 3 * in_row_ofs,
-                in + 4 * in_row_ofs, in + 5 * in_row_ofs, in + 6 * in_row_ofs,
-                in + 7 * in_row_ofs, in + 8 * in_row_ofs,
+    } else if (num_rows == 9) {
+        _scale_row_down_9in(_IN_ROW(0), _IN_ROW(1), _IN_ROW(2), _IN_ROW(3),
+                _IN_ROW(4), _IN_ROW(5), _IN_ROW(6),
+                _IN_ROW(7), _IN_ROW(8),
                 out, position_x, x_factor_inv, top_weight, bot_weight, weight_reciprocal,
                 out_width);
     } else {
@@ -922,22 +1009,22 @@ static inline void _scale_row_down(uint8 *in, uint8 *_RESTRICT_ out, uint32 in_r
             in_col = position_x >> 32;
 
             while (total_weight > 0) {
-                acc_r += (uint32) in[(in_col * 3) + 0] * curr_weight * top_weight;
-                acc_g += (uint32) in[(in_col * 3) + 1] * curr_weight * top_weight;
-                acc_b += (uint32) in[(in_col * 3) + 2] * curr_weight * top_weight;
-
-                for (y = 1; y < in_rows - 1; y++) {
-                    acc_r += (uint32) in[y * in_row_ofs + ((in_col * 3) + 0)] * curr_weight * 256;
-                    acc_g += (uint32) in[y * in_row_ofs + ((in_col * 3) + 1)] * curr_weight * 256;
-                    acc_b += (uint32) in[y * in_row_ofs + ((in_col * 3) + 2)] * curr_weight * 256;
+                uint8 *row = _IN_ROW(0);
+                acc_r += (uint32) row[(in_col * 3) + 0] * curr_weight * top_weight;
+                acc_g += (uint32) row[(in_col * 3) + 1] * curr_weight * top_weight;
+                acc_b += (uint32) row[(in_col * 3) + 2] * curr_weight * top_weight;
+
+                for (y = 1; y < num_rows - 1; y++) {
+                    row = _IN_ROW(y);
+                    acc_r += (uint32) row[(in_col * 3) + 0] * curr_weight * 256;
+                    acc_g += (uint32) row[(in_col * 3) + 1] * curr_weight * 256;
+                    acc_b += (uint32) row[(in_col * 3) + 2] * curr_weight * 256;
                 }
 
-                acc_r +=
-                        (uint32) in[y * in_row_ofs + ((in_col * 3) + 0)] * curr_weight * bot_weight;
-                acc_g +=
-                        (uint32) in[y * in_row_ofs + ((in_col * 3) + 1)] * curr_weight * bot_weight;
-                acc_b +=
-                        (uint32) in[y * in_row_ofs + ((in_col * 3) + 2)] * curr_weight * bot_weight;
+                row = _IN_ROW(y);
+                acc_r += (uint32) row[(in_col * 3) + 0] * curr_weight * bot_weight;
+                acc_g += (uint32) row[(in_col * 3) + 1] * curr_weight * bot_weight;
+                acc_b += (uint32) row[(in_col * 3) + 2] * curr_weight * bot_weight;
 
                 in_col++;
                 total_weight -= curr_weight;
@@ -953,6 +1040,8 @@ static inline void _scale_row_down(uint8 *in, uint8 *_RESTRICT_ out, uint32 in_r
     }
 }
 
+#undef _IN_ROW
+
 static void _scale_row_up(uint8 *_RESTRICT_ in0, uint8 *_RESTRICT_ in1, uint8 *_RESTRICT_ out,
         sint32 weight_y, uint64 position_x, uint64 increment_x, int out_width) {
     int x;
@@ -994,6 +1083,88 @@ static void _scale_row_up(uint8 *_RESTRICT_ in0, uint8 *_RESTRICT_ in1, uint8 *_
     }
 }
 
+/*
+ * Gray version of _scale_row_up
+ */
+static void _scale_row_up_1c(uint8 *_RESTRICT_ in0, uint8 *_RESTRICT_ in1, uint8 *_RESTRICT_ out,
+        sint32 weight_y, uint64 position_x, uint64 increment_x, int out_width) {
+    int x;
+    for (x = 0; x < out_width; x++) {
+        uint32 pix_x = position_x >> 32;
+        sint32 weight_x = (position_x & 0xffffffff) >> 22;
+
+        sint32 top_val = (in0[pix_x] << 10) + weight_x * ((sint32) in0[pix_x + 1] - in0[pix_x]);
+        sint32 bot_val = (in1[pix_x] << 10) + weight_x * ((sint32) in1[pix_x + 1] - in1[pix_x]);
+
+        out[x] = ((top_val << 10) + weight_y * (bot_val - top_val)) >> 20;
+
+        position_x += increment_x;
+    }
+}
+
+/*
+ * 2:1 box filter, each output pixel is the rounded average of a 2x2 input block
+ */
+static inline void _scale_row_down_2to1(uint8 *_RESTRICT_ in0, uint8 *_RESTRICT_ in1,
+        uint8 *_RESTRICT_ out, int out_width, const int nc) {
+    int x;
+    for (x = 0; x < out_width * nc; x += nc) {
+        int c;
+        for (c = 0; c < nc; c++) {
+            out[x + c] = ((uint32) in0[(x * 2) + c] + in0[(x * 2) + nc + c] +
+                    in1[(x * 2) + c] + in1[(x * 2) + nc + c] + 2) >> 2;
+        }
+    }
+}
+
+/*
+ * 4:1 box filter, each output pixel is the rounded average of a 4x4 input block
+ */
+static inline void _scale_row_down_4to1(uint8 *_RESTRICT_ in0, uint8 *_RESTRICT_ in1,
+        uint8 *_RESTRICT_ in2, uint8 *_RESTRICT_ in3, uint8 *_RESTRICT_ out, int out_width,
+        const int nc) {
+    int x;
+    for (x = 0; x < out_width * nc; x += nc) {
+        int c;
+        for (c = 0; c < nc; c++) {
+            uint32 acc = 8;
+            int i;
+            for (i = 0; i < 4 * nc; i += nc) {
+                acc += (uint32) in0[(x * 4) + i + c] + in1[(x * 4) + i + c] +
+                        in2[(x * 4) + i + c] + in3[(x * 4) + i + c];
+            }
+            out[x + c] = acc >> 4;
+        }
+    }
+}
+
+/*
+ * 1:2 interpolation on an exact half pixel grid. Even output columns copy an input pixel and
+ * odd ones average two neighbours. weight_y must be 0 (use in0) or 512 (average in0 and in1).
+ */
+static inline void _scale_row_up_1to2(uint8 *_RESTRICT_ in0, uint8 *_RESTRICT_ in1,
+        uint8 *_RESTRICT_ out, sint32 weight_y, int out_width, const int nc) {
+    int x, c;
+    if (weight_y == 0) {
+        for (x = 0; x < out_width; x++) {
+            uint8 *in = in0 + ((x >> 1) * nc);
+            for (c = 0; c < nc; c++) {
+                out[(x * nc) + c] = (x & 1) ? (((uint32) in[c] + in[nc + c]) >> 1) : in[c];
+            }
+        }
+    } else {
+        for (x = 0; x < out_width; x++) {
+            uint8 *top = in0 + ((x >> 1) * nc);
+            uint8 *bot = in1 + ((x >> 1) * nc);
+            for (c = 0; c < nc; c++) {
+                out[(x * nc) + c] = (x & 1) ?
+                        (((uint32) top[c] + top[nc + c] + bot[c] + bot[nc + c]) >> 2) :
+                        (((uint32) top[c] + bot[c]) >> 1);
+            }
+        }
+    }
+}
+
 static void _hw_scale_image_plane(scaler_config_t *pscaler_config, scaler_mode_t scaleMode) {
     // These pointers duplicate h/w regs
     uint64 x_factor, y_factor, x_factor_inv, y_factor_inv;
@@ -1005,6 +1176,8 @@ static void _hw_scale_image_plane(scaler_config_t *pscaler_config, scaler_mode_t
     // These are internal state
     uint32 r;
     uint8 *outp;
+    scaler_ratio_t ratio;
+    uint32 components = pscaler_config->iComponents;
 
     x_output_width = pscaler_config->iOutWidth;
     y_output_width = pscaler_config->iOutEndRow -
@@ -1043,25 +1216,71 @@ static void _hw_scale_image_plane(scaler_config_t *pscaler_config, scaler_mode_t
     weight_reciprocal = ((uint64) 1 << 32);
     weight_reciprocal /= (x_factor_inv >> 24) * (y_factor_inv >> 24);
 
-    outp = (pscaler_config->pOutBuf) + (first_xi * 3);
+    outp = (pscaler_config->pOutBuf) + (first_xi * components);
 
     // PC - Assume pSrcBuf is already aligned to "true" base of input,
     // so ignore whole-number part of first_y_src.
     first_y_src = first_y_src & 0xffffffff;
 
+    /*
+     * The exact ratio kernels only apply to the single pass modes, and scaling down needs
+     * the slice to start on a whole input row
+     */
+    ratio = (scaleMode == pscaler_config->scaleMode) ? pscaler_config->ratio : PSCALER_RATIO_ANY;
+    if ((ratio != PSCALER_RATIO_ANY) && (ratio != PSCALER_RATIO_1_2) && (first_y_src != 0)) {
+        ratio = PSCALER_RATIO_ANY;
+    }
+
     for (r = 0; r < y_output_width; r++) {
-        uint8 *inp = (pscaler_config->pSrcBuf) +
-                (first_y_src >> 32) * input_pixel_ptr_offset;
-        {
-            if (scaleMode == PSCALER_SCALE_UP) {
-                _scale_row_up(inp, inp + input_pixel_ptr_offset, outp,
-                        (first_y_src & 0xffffffff) >> 22, first_x_src,
-                        x_factor_inv, x_output_width);
+        uint32 in_row = (uint32) (first_y_src >> 32);
+        uint8 **in_rows = (pscaler_config->ppSrcRows != NULL) ?
+                (pscaler_config->ppSrcRows + in_row) : NULL;
+        uint8 *inp = (in_rows != NULL) ? in_rows[0] :
+                ((pscaler_config->pSrcBuf) + in_row * input_pixel_ptr_offset);
+        uint8 *in1 = NULL;
+        sint32 weight_y = (first_y_src & 0xffffffff) >> 22;
+
+        // Component counts are passed as constants so the compiler unrolls the pixel loops
+        // Only look up the second input row for kernels that read it
+        if ((ratio != PSCALER_RATIO_1_1) &&
+                ((ratio != PSCALER_RATIO_ANY) || (scaleMode == PSCALER_SCALE_UP))) {
+            in1 = (in_rows != NULL) ? in_rows[1] : (inp + input_pixel_ptr_offset);
+        }
+
+        if (ratio == PSCALER_RATIO_1_1) {
+            memcpy(outp, inp, x_output_width * components);
+        } else if (ratio == PSCALER_RATIO_2_1) {
+            if (components == 1) {
+                _scale_row_down_2to1(inp, in1, outp, x_output_width, 1);
+            } else {
+                _scale_row_down_2to1(inp, in1, outp, x_output_width, 3);
+            }
+        } else if (ratio == PSCALER_RATIO_4_1) {
+            uint8 *in2 = (in_rows != NULL) ? in_rows[2] : (inp + 2 * input_pixel_ptr_offset);
+            uint8 *in3 = (in_rows != NULL) ? in_rows[3] : (inp + 3 * input_pixel_ptr_offset);
+            if (components == 1) {
+                _scale_row_down_4to1(inp, in1, in2, in3, outp, x_output_width, 1);
+            } else {
+                _scale_row_down_4to1(inp, in1, in2, in3, outp, x_output_width, 3);
+            }
+        } else if ((ratio == PSCALER_RATIO_1_2) && ((weight_y == 0) || (weight_y == 512))) {
+            if (components == 1) {
+                _scale_row_up_1to2(inp, in1, outp, weight_y, x_output_width, 1);
             } else {
-                _scale_row_down(inp, outp, input_pixel_ptr_offset,
-                        first_x_src, first_y_src, x_factor_inv, y_factor_inv,
-                        weight_reciprocal, x_output_width);
+                _scale_row_up_1to2(inp, in1, outp, weight_y, x_output_width, 3);
             }
+        } else if (scaleMode == PSCALER_SCALE_UP) {
+            if (components == 1) {
+                _scale_row_up_1c(inp, in1, outp, weight_y, first_x_src, x_factor_inv,
+                        x_output_width);
+            } else {
+                _scale_row_up(inp, in1, outp, weight_y, first_x_src, x_factor_inv,
+                        x_output_width);
+            }
+        } else {
+            _scale_row_down(inp, in_rows, input_pixel_ptr_offset, outp,
+                    first_x_src, first_y_src, x_factor_inv, y_factor_inv,
+                    weight_reciprocal, x_output_width, components);
         }
         first_y_src += y_factor_inv;
         outp += output_pixel_ptr_offset;
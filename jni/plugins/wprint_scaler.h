@@ -47,33 +47,45 @@ typedef enum scaler_modes_e {
     PSCALER_SCALE_MODE_INVALID
 } scaler_mode_t;
 
+/*
+ * Exact integer ratio detected for a scaling operation, which has a specialised kernel
+ */
+typedef enum scaler_ratios_e {
+    PSCALER_RATIO_ANY = 0,      // no exact ratio, use the generic kernels
+    PSCALER_RATIO_1_1,          // input and output sizes match
+    PSCALER_RATIO_2_1,          // scale down by 2 on both axes
+    PSCALER_RATIO_4_1,          // scale down by 4 on both axes
+    PSCALER_RATIO_1_2,          // scale up by 2 on both axes (as (dim-1)/(dim-1))
+} scaler_ratio_t;
+
 /*
  * Context structure for a scaling operation
  */
 typedef struct scaler_config_s {
-    uint16 iSrcWidth;           // input width (x-axis dimension)
-    uint16 iSrcHeight;          // input height (y-axis dimension)
+    uint32 iSrcWidth;           // input width (x-axis dimension)
+    uint32 iSrcHeight;          // input height (y-axis dimension)
 
-    uint16 iOutWidth;           // output width (x-axis dimension)
-    uint16 iOutHeight;          // output height (y-axis dimension)
+    uint32 iOutWidth;           // output width (x-axis dimension)
+    uint32 iOutHeight;          // output height (y-axis dimension)
 
     uint8 *pSrcBuf;             // input buffers [plane]
-    uint16 iSrcBufWidth;        // input buffer width (typically source width)
+    uint8 **ppSrcRows;          // optional input row table, used instead of pSrcBuf if set
+    uint32 iSrcBufWidth;        // input buffer width (typically source width)
 
     uint8 *pOutBuf;             // output buffers [plane]
-    uint16 iOutBufWidth;        // output buffer width
+    uint32 iOutBufWidth;        // output buffer width
 
     uint8 *pTmpBuf;             // mixed axis temp buffer
     float64_t fSrcStartRow;     // first input row as a float
-    uint16 iSrcStartRow;        // first input row of this slice
-    uint16 iSrcEndRow;          // last input row of this slice
+    uint32 iSrcStartRow;        // first input row of this slice
+    uint32 iSrcEndRow;          // last input row of this slice
 
-    uint16 iOutStartRow;        // first output row of this slice
-    uint16 iOutEndRow;          // last output row of this slice
+    uint32 iOutStartRow;        // first output row of this slice
+    uint32 iOutEndRow;          // last output row of this slice
 
     float64_t fSrcStartColumn;  // first input column as a float
 
-    uint16 iOutStartColumn;     // first output column of this slice
+    uint32 iOutStartColumn;     // first output column of this slice
 
     float64_t fXfactor;         // x_factor_int & x_factor_fract
     float64_t fXfactorInv;      // x_factor_inv_int & x_factor_inv_fract
@@ -81,23 +93,26 @@ typedef struct scaler_config_s {
     float64_t fYfactorInv;      // y_factor_inv_int & y_factor_inv_fract
 
     scaler_mode_t scaleMode;    // scale mode for the current image
+    scaler_ratio_t ratio;       // exact ratio of the current image, if any
+    uint32 iComponents;         // bytes per pixel, 3 for RGB or 1 for gray
 } scaler_config_t;
 
 /*
- * Called once per job to initialize pscaler_config for specified input/output sizes
+ * Called once per job to initialize pscaler_config for specified input/output sizes. Pixels
+ * have the given number of 8-bit components, 3 (RGB) or 1 (gray).
  */
-extern void scaler_make_image_scaler_tables(uint16 image_input_width, uint16 image_input_buf_width,
-        uint16 image_output_width, uint16 image_output_buf_width, uint16 image_input_height,
-        uint16 image_output_height, scaler_config_t *pscaler_config);
+extern void scaler_make_image_scaler_tables(uint32 image_input_width, uint32 image_input_buf_width,
+        uint32 image_output_width, uint32 image_output_buf_width, uint32 image_input_height,
+        uint32 image_output_height, uint32 components, scaler_config_t *pscaler_config);
 
 /*
  * Called once to configure a single image stripe/slice. Must be called after
  * scaler_make_image_scaler_tables.
  */
-extern void scaler_calculate_scaling_rows(uint16 start_output_row_number,
-        uint16 end_output_row_number, void *tables_ptr, uint16 *start_input_row_number,
-        uint16 *end_input_row_number, uint16 *num_output_rows_generated,
-        uint16 *num_rows_offset_to_start_output_row,
+extern void scaler_calculate_scaling_rows(uint32 start_output_row_number,
+        uint32 end_output_row_number, void *tables_ptr, uint32 *start_input_row_number,
+        uint32 *end_input_row_number, uint32 *num_output_rows_generated,
+        uint32 *num_rows_offset_to_start_output_row,
         uint32 *mixed_axis_temp_buffer_size_needed);
 
 /*
@@ -106,6 +121,13 @@ extern void scaler_calculate_scaling_rows(uint16 start_output_row_number,
 extern void scaler_scale_image_data(uint8 *input_plane, void *tables_ptr,
         uint8 *scaled_output_plane, uint8 *temp_buffer_for_mixed_axis_scaling);
 
+/*
+ * Same as scaler_scale_image_data but reads input row n of the slice through input_rows[n],
+ * so the caller can keep its input rows in a ring without moving them between slices.
+ */
+extern void scaler_scale_image_rows(uint8 **input_rows, void *tables_ptr,
+        uint8 *scaled_output_plane, uint8 *temp_buffer_for_mixed_axis_scaling);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,124 @@
+/*
+ * Copyright (C) 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#include "wprint_strip_ring.h"
+
+// Checks of the ring state before a waiting side parks on the futex
+#define _SPIN_TRIES 64
+
+/*
+ * Returns the number of entries pushed but not yet released
+ */
+static inline unsigned int _pending(strip_ring_t *ring) {
+    return atomic_load(&ring->head) - atomic_load(&ring->tail);
+}
+
+/*
+ * Returns true while the calling side has to wait: the consumer while the ring is empty, the
+ * producer while limit or more entries are pending
+ */
+static inline bool _blocked(strip_ring_t *ring, bool consumer, unsigned int limit) {
+    return consumer ? (_pending(ring) == 0) : (_pending(ring) >= limit);
+}
+
+/*
+ * Waits until _blocked() clears. The event word is sampled before parked is raised and the
+ * state is checked once more afterwards, so a move made by the other side either shows up in
+ * that check or makes the futex wait return at once.
+ */
+static void _wait(strip_ring_t *ring, bool consumer, unsigned int limit) {
+    int tries = 0;
+    while (_blocked(ring, consumer, limit)) {
+        unsigned int seen;
+        if (tries++ < _SPIN_TRIES) {
+            continue;
+        }
+        seen = atomic_load(&ring->event);
+        atomic_fetch_add(&ring->parked, 1);
+        if (_blocked(ring, consumer, limit)) {
+            syscall(__NR_futex, &ring->event, FUTEX_WAIT_PRIVATE, seen, NULL, NULL, 0);
+        }
+        atomic_fetch_sub(&ring->parked, 1);
+    }
+}
+
+/*
+ * Publishes a head or tail move to the other side, waking it only if it is parked
+ */
+static inline void _notify(strip_ring_t *ring) {
+    atomic_fetch_add(&ring->event, 1);
+    if (atomic_load(&ring->parked) > 0) {
+        syscall(__NR_futex, &ring->event, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+    }
+}
+
+strip_ring_t *strip_ring_create(unsigned int min_entries, unsigned int entry_size) {
+    strip_ring_t *ring;
+    unsigned int num_entries = 1;
+
+    while (num_entries < min_entries) {
+        num_entries <<= 1;
+    }
+
+    ring = (strip_ring_t *) malloc(sizeof(strip_ring_t) + (size_t) num_entries * entry_size);
+    if (ring != NULL) {
+        atomic_init(&ring->head, 0);
+        atomic_init(&ring->tail, 0);
+        atomic_init(&ring->event, 0);
+        atomic_init(&ring->parked, 0);
+        ring->mask = num_entries - 1;
+        ring->entry_size = entry_size;
+    }
+    return ring;
+}
+
+void strip_ring_destroy(strip_ring_t *ring) {
+    free(ring);
+}
+
+void strip_ring_wait_space(strip_ring_t *ring, unsigned int limit) {
+    _wait(ring, false, MIN(limit, ring->mask + 1));
+}
+
+void strip_ring_push(strip_ring_t *ring, const void *entry) {
+    unsigned int head;
+
+    _wait(ring, false, ring->mask + 1);
+    head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    memcpy(ring->entries + (head & ring->mask) * ring->entry_size, entry, ring->entry_size);
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+    _notify(ring);
+}
+
+void strip_ring_peek(strip_ring_t *ring, void *entry) {
+    unsigned int tail;
+
+    _wait(ring, true, 0);
+    tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    memcpy(entry, ring->entries + (tail & ring->mask) * ring->entry_size, ring->entry_size);
+}
+
+void strip_ring_release(strip_ring_t *ring) {
+    atomic_fetch_add_explicit(&ring->tail, 1, memory_order_release);
+    _notify(ring);
+}
@@ -0,0 +1,72 @@
+/*
+ * Copyright (C) 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __WPRINT_STRIP_RING__
+#define __WPRINT_STRIP_RING__
+
+#include <stdatomic.h>
+#include "wtypes.h"
+
+/*
+ * Single-producer/single-consumer ring of fixed size entries. Pushing and consuming take no
+ * lock; a side only parks on a futex when the ring is full or empty. Exactly one thread may
+ * call the producer functions and exactly one thread the consumer functions.
+ */
+typedef struct {
+    atomic_uint head; // next entry to write, advanced by the producer
+    atomic_uint tail; // next entry to read, advanced by the consumer
+    atomic_uint event; // bumped on every head or tail move, used as the futex word
+    atomic_int parked; // number of threads parked on event
+    unsigned int mask;
+    unsigned int entry_size;
+    char entries[];
+} strip_ring_t;
+
+/*
+ * Allocate a ring holding at least min_entries entries of entry_size bytes. Returns NULL on
+ * failure.
+ */
+strip_ring_t *strip_ring_create(unsigned int min_entries, unsigned int entry_size);
+
+/*
+ * Free a ring. Neither side may be using it.
+ */
+void strip_ring_destroy(strip_ring_t *ring);
+
+/*
+ * Producer: block until fewer than limit entries are pending. A limit larger than the ring
+ * capacity is clamped to it.
+ */
+void strip_ring_wait_space(strip_ring_t *ring, unsigned int limit);
+
+/*
+ * Producer: copy an entry in, blocking while the ring is full
+ */
+void strip_ring_push(strip_ring_t *ring, const void *entry);
+
+/*
+ * Consumer: copy the oldest entry out, blocking while the ring is empty. The entry stays
+ * pending until strip_ring_release() is called, so the producer can treat anything it refers
+ * to as in use until then.
+ */
+void strip_ring_peek(strip_ring_t *ring, void *entry);
+
+/*
+ * Consumer: retire the entry returned by the last strip_ring_peek()
+ */
+void strip_ring_release(strip_ring_t *ring);
+
+#endif // __WPRINT_STRIP_RING__
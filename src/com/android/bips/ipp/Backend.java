@@ -75,6 +75,8 @@ public class Backend implements JobCallback {
         nativeSetSourceInfo(context.getString(R.string.app_name).toLowerCase(Locale.US),
                 getApplicationVersion(context).toLowerCase(Locale.US),
                 BackendConstants.WPRINT_APPLICATION_ID.toLowerCase(Locale.US));
+        // Let short jobs overtake long ones queued for the same printer
+        nativeSetSchedulingPolicy(BackendConstants.SCHED_SHORTEST_FIRST);
     }
 
     /** Return the current application version or VERSION_UNKNOWN */
@@ -198,6 +200,12 @@ public class Backend implements JobCallback {
             if (!TextUtils.isEmpty(params.printerState)) {
                 updateBlockedReasons(builder, params);
             } else if (!TextUtils.isEmpty(params.jobState)) {
+                if (BackendConstants.JOB_STATE_RUNNING.equals(params.jobState)
+                        && !BackendConstants.JOB_STATE_RUNNING.equals(
+                                mCurrentJobStatus.getJobState())) {
+                    Log.i(TAG, "Job " + jobId + " waited " + params.queueWaitMsec
+                            + "ms in the spool");
+                }
                 builder.setJobState(params.jobState);
                 if (!TextUtils.isEmpty(params.jobDoneResult)) {
                     builder.setJobResult(params.jobDoneResult);
@@ -263,6 +271,14 @@ public class Backend implements JobCallback {
      */
     native void nativeSetSourceInfo(String appName, String version, String appId);
 
+    /**
+     * Select how spooled jobs of equal priority are ordered.
+     *
+     * @param policy {@link BackendConstants#SCHED_FIFO} or
+     *               {@link BackendConstants#SCHED_SHORTEST_FIRST}
+     */
+    native void nativeSetSchedulingPolicy(int policy);
+
     /**
      * Request capabilities from a printer.
      *
@@ -17,6 +17,7 @@
 
 package com.android.bips.ipp;
 
+import android.app.ActivityManager;
 import android.content.Context;
 import android.graphics.pdf.PdfRenderer;
 import android.net.Uri;
@@ -71,6 +72,9 @@ class StartJobTask extends AsyncTask<Void, Void, Integer> {
     private static final int BORDERLESS_OFF = 0;
     private static final int BORDERLESS_ON = 1;
 
+    // Decode memory budget on low-RAM devices; elsewhere it is sized from device RAM
+    private static final int LOW_RAM_MEMORY_BUDGET = 2 * 1024 * 1024;
+
     private final Context mContext;
     private final Backend mBackend;
     private final Uri mDestination;
@@ -116,6 +120,7 @@ class StartJobTask extends AsyncTask<Void, Void, Integer> {
         mJobParams.document_category = getDocumentCategory();
         mJobParams.shared_photo = isSharedPhoto();
         mJobParams.preserve_scaling = false;
+        mJobParams.memory_budget = getMemoryBudget();
 
         mJobParams.job_margin_top = Math.max(mJobParams.job_margin_top, 0.0f);
         mJobParams.job_margin_left = Math.max(mJobParams.job_margin_left, 0.0f);
@@ -208,6 +213,13 @@ class StartJobTask extends AsyncTask<Void, Void, Integer> {
         }
     }
 
+    /** Return a small decode memory budget on low-RAM devices, or 0 to size it from RAM */
+    private int getMemoryBudget() {
+        ActivityManager activityManager = mContext.getSystemService(ActivityManager.class);
+        return (activityManager != null && activityManager.isLowRamDevice())
+                ? LOW_RAM_MEMORY_BUDGET : 0;
+    }
+
     private boolean isBorderless() {
         return mCapabilities.borderless
                 && mDocInfo.getContentType() == PrintDocumentInfo.CONTENT_TYPE_PHOTO;
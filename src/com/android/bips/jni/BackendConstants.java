@@ -28,6 +28,11 @@ public class BackendConstants {
 
     public static final int STATUS_OK = 0;
 
+    /** Spooled jobs of equal priority run in the order they were started */
+    public static final int SCHED_FIFO = 0;
+    /** Spooled jobs of equal priority run smallest first */
+    public static final int SCHED_SHORTEST_FIRST = 1;
+
     public static final String PRINT_DOCUMENT_CATEGORY__DOCUMENT = "Doc";
     public static final String PRINT_DOCUMENT_CATEGORY__PHOTO = "Photo";
 
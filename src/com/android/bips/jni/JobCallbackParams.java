@@ -25,4 +25,6 @@ public final class JobCallbackParams {
     public String jobDoneResult;
     public String[] blockedReasons;
     public byte[] certificate;
+    /** Milliseconds the job waited in the spool before it started running */
+    public int queueWaitMsec;
 }
@@ -68,6 +68,9 @@ public final class LocalJobParams {
     public boolean shared_photo;
     public boolean preserve_scaling;
 
+    /** Decode memory budget in bytes, 0 to size it from device RAM */
+    public int memory_budget;
+
     @Override
     public String toString() {
         return "LocalJobParams{"
@@ -109,6 +112,7 @@ public final class LocalJobParams {
                 + " source_height=" + source_height
                 + " shared_photo=" + shared_photo
                 + " preserve_scaling=" + preserve_scaling
+                + " memory_budget=" + memory_budget
                 + "}";
     }
 }
@@ -144,14 +144,15 @@ public class PdfRender {
      * @param width width of area to render
      * @param height height of area to render
      * @param zoomFactor zoom factor to use when rendering data
+     * @param rotation clockwise rotation in degrees (0, 90, 180 or 270) to apply to the page
      * @param target target byte buffer to fill with results
      * @return true if rendering was successful
      */
     public boolean renderPageStripe(int page, int y, int width, int height,
-            double zoomFactor, ByteBuffer target) {
+            double zoomFactor, int rotation, ByteBuffer target) {
         if (DEBUG) {
             Log.d(TAG, "renderPageStripe() page=" + page + " y=" + y + " w=" + width
-                    + " h=" + height + " zoom=" + zoomFactor);
+                    + " h=" + height + " zoom=" + zoomFactor + " rotation=" + rotation);
         }
         if (mService == null) {
             return false;
@@ -160,7 +161,7 @@ public class PdfRender {
         try {
             long start = System.currentTimeMillis();
             ParcelFileDescriptor input = mService.renderPageStripe(page - 1, y, width, height,
-                    zoomFactor);
+                    zoomFactor, rotation);
 
             // Copy received data into the ByteBuffer
             int expectedSize = width * height * 3;
@@ -79,7 +79,7 @@ public class PdfRenderService extends Service {
 
         @Override
         public ParcelFileDescriptor renderPageStripe(int page, int y, int width, int height,
-                double zoomFactor)
+                double zoomFactor, int rotation)
                 throws RemoteException {
             if (!openPage(page)) {
                 return null;
@@ -94,7 +94,7 @@ public class PdfRenderService extends Service {
             }
 
             // Use a thread to spool out the bitmap data
-            new RenderThread(mPage, y, width, height, zoomFactor, pipes[1]).start();
+            new RenderThread(mPage, y, width, height, zoomFactor, rotation, pipes[1]).start();
 
             // Return the corresponding input stream.
             return pipes[0];
@@ -175,17 +175,19 @@ public class PdfRenderService extends Service {
         private final int mYOffset;
         private final int mHeight;
         private final double mZoomFactor;
+        private final int mRotation;
         private final int mRowsPerStripe;
         private final ParcelFileDescriptor mOutput;
         private final ByteBuffer mBuffer;
 
         RenderThread(PdfRenderer.Page page, int y, int width, int height, double zoom,
-                ParcelFileDescriptor output) {
+                int rotation, ParcelFileDescriptor output) {
             mPage = page;
             mWidth = width;
             mYOffset = y;
             mHeight = height;
             mZoomFactor = zoom;
+            mRotation = rotation;
             mOutput = output;
 
             // Buffer will temporarily hold RGBA data from Bitmap
@@ -231,6 +233,23 @@ public class PdfRenderService extends Service {
             Matrix matrix = new Matrix();
             // The scaling matrix increases DPI (default is 72dpi) to page output
             matrix.setScale((float) mZoomFactor, (float) mZoomFactor);
+            // Rotate clockwise and shift the rotated page back to the origin
+            if (mRotation != 0) {
+                float pageWidth = (float) (mPage.getWidth() * mZoomFactor);
+                float pageHeight = (float) (mPage.getHeight() * mZoomFactor);
+                matrix.postRotate(mRotation);
+                switch (mRotation) {
+                    case 90:
+                        matrix.postTranslate(pageHeight, 0);
+                        break;
+                    case 180:
+                        matrix.postTranslate(pageWidth, pageHeight);
+                        break;
+                    case 270:
+                        matrix.postTranslate(0, pageWidth);
+                        break;
+                }
+            }
             // The translate specifies adjusts which part of the page we are rendering
             matrix.postTranslate(0, 0 - startRow);
             bitmap.eraseColor(0xFFFFFFFF);